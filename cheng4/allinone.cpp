@@ -32,6 +32,7 @@ or as public domain (where applicable)
 	#define _SECURE_SCL			0
 #endif
 
+#include "attacks.cpp"
 #include "autoplay.cpp"
 #include "board.cpp"
 #include "book.cpp"
@@ -48,6 +49,7 @@ or as public domain (where applicable)
 #include "movegen.cpp"
 #include "protocol.cpp"
 #include "psq.cpp"
+#include "repetition.cpp"
 #include "search.cpp"
 #include "see.cpp"
 #include "tables.cpp"
@@ -61,3 +63,7 @@ or as public domain (where applicable)
 #include "tb.cpp"
 #include "labelfen.cpp"
 #include "net.cpp"
+#include "trainfile.cpp"
+#include "sigset.cpp"
+#include "mapfile.cpp"
+#include "iothread.cpp"
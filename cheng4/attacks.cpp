@@ -0,0 +1,115 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "attacks.h"
+#include <memory.h>
+
+namespace cheng4
+{
+
+// AttackMap
+
+Bitboard AttackMap::pieceAttacks( Piece p, Square sq, Bitboard occ )
+{
+	switch( PiecePack::type( p ) )
+	{
+	case ptPawn:
+		return Tables::pawnAttm[ PiecePack::color( p ) ][ sq ];
+	case ptKnight:
+		return Tables::knightAttm[ sq ];
+	case ptBishop:
+		return Magic::bishopAttm( sq, occ );
+	case ptRook:
+		return Magic::rookAttm( sq, occ );
+	case ptQueen:
+		return Magic::queenAttm( sq, occ );
+	case ptKing:
+		return Tables::kingAttm[ sq ];
+	default:
+		return 0;
+	}
+}
+
+void AttackMap::init( const Board &b )
+{
+	memset( to, 0, sizeof(to) );
+
+	Bitboard occ = b.occupied();
+
+	for ( Square sq = 0; sq < 64; sq++ )
+	{
+		Bitboard att = from[ sq ] = pieceAttacks( b.piece( sq ), sq, occ );
+		while ( att )
+			to[ BitOp::popBit( att ) ] |= BitOp::oneShl( sq );
+	}
+}
+
+void AttackMap::update( const Board &b, Bitboard changed )
+{
+	Bitboard occ = b.occupied();
+
+	// sliders seeing a changed square before the move are the only other pieces whose attacks may change
+	Bitboard dirty = changed;
+	Bitboard tmp = changed;
+	while ( tmp )
+		dirty |= to[ BitOp::popBit( tmp ) ];
+	dirty &= changed | b.diagSliders() | b.orthoSliders();
+
+	while ( dirty )
+	{
+		Square sq = BitOp::popBit( dirty );
+		Bitboard att = pieceAttacks( b.piece( sq ), sq, occ );
+		Bitboard diff = from[ sq ] ^ att;
+		if ( !diff )
+			continue;
+		from[ sq ] = att;
+
+		Bitboard sqmask = BitOp::oneShl( sq );
+		Bitboard added = diff & att;
+		Bitboard removed = diff ^ added;
+
+		while ( added )
+			to[ BitOp::popBit( added ) ] |= sqmask;
+		while ( removed )
+			to[ BitOp::popBit( removed ) ] &= ~sqmask;
+	}
+}
+
+Bitboard AttackMap::attacked( const Board &b, Color c ) const
+{
+	Bitboard res = 0;
+	Bitboard tmp = b.pieces( c );
+	while ( tmp )
+		res |= from[ BitOp::popBit( tmp ) ];
+	return res;
+}
+
+bool AttackMap::isValid( const Board &b ) const
+{
+	AttackMap tmp;
+	tmp.init( b );
+	return memcmp( tmp.from, from, sizeof(from) ) == 0 && memcmp( tmp.to, to, sizeof(to) ) == 0;
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include "board.h"
+
+namespace cheng4
+{
+
+// optional incremental attack map
+// maintained by doMove when UndoInfo::attacks is set
+// works as copy-make (like net cache): copy into the next ply's slot before doMove, no explicit undo
+struct AttackMap
+{
+	Bitboard from[64];			// squares attacked by piece on square (0 if empty)
+	Bitboard to[64];			// squares of pieces (both colors) attacking square, no x-rays
+
+	// full rebuild
+	void init( const Board &b );
+
+	// incremental update; board must already have the move made
+	// changed: squares whose contents changed
+	void update( const Board &b, Bitboard changed );
+
+	// returns attack mask of piece on sq given occupancy
+	static Bitboard pieceAttacks( Piece p, Square sq, Bitboard occ );
+
+	// all direct attackers to sq (both colors)
+	inline Bitboard attackersTo( Square sq ) const
+	{
+		assert( sq < 64 );
+		return to[ sq ];
+	}
+
+	// direct attackers of color to sq
+	inline Bitboard attackersTo( const Board &b, Color c, Square sq ) const
+	{
+		return attackersTo( sq ) & b.pieces( c );
+	}
+
+	// number of attackers of color to sq
+	inline uint attackCount( const Board &b, Color c, Square sq ) const
+	{
+		return BitOp::popCount( attackersTo( b, c, sq ) );
+	}
+
+	// returns 1 if sq is attacked by color
+	inline bool doesAttack( const Board &b, Color c, Square sq ) const
+	{
+		return attackersTo( b, c, sq ) != 0;
+	}
+
+	// get checkers from stm's point of view
+	inline Bitboard checkers( const Board &b ) const
+	{
+		return attackersTo( b, flip( b.turn() ), b.king( b.turn() ) );
+	}
+
+	// all squares attacked by color
+	Bitboard attacked( const Board &b, Color c ) const;
+
+	// compare to full rebuild (debug)
+	bool isValid( const Board &b ) const;
+};
+
+}
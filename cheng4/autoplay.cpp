@@ -26,9 +26,12 @@ or as public domain (where applicable)
 #include "search.h"
 #include "thread.h"
 #include "shuffle.h"
+#include "trainfile.h"
 
 #include <atomic>
-#include <mutex>
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
 
 namespace cheng4
 {
@@ -36,35 +39,37 @@ namespace cheng4
 class AutoPlayWorker : public Thread
 {
 public:
-	std::mutex *mutex = nullptr;
 	Search *s = nullptr;
 	AutoPlay *self = nullptr;
-	FILE *file = nullptr;
-	int64_t numGames = 0;
+	// own output shard, no locking needed
+	TrainWriter writer;
 	int workerIndex = 0;
 	bool doneFlag = 0;
+	std::atomic<bool> finished{false};
 
 	std::vector<Board> boards;
 	std::vector<float> outcomes;
 	std::vector<Score> labels;
 
+	// game mode (storeGames)
+	TrainGame game;
+	std::vector<u8> gameData;
+	uint gamePositions = 0;
+
 	FastRandom rng;
 
 	bool genInitialBoard()
 	{
-		int randplies = 8;
+		int randplies = self->randomPlies;
 
-		if ((rng.Next() & 7) == 0)
+		if (rng.Next() < self->frcRatio * 4294967296.0)
 		{
 			// use FRC position
 			s->board.resetFRC(int(rng.Next64() % 960));
-			randplies = 4;
+			randplies = self->randomPlies / 2;
 		}
 		else
-		{
 			s->board.reset();
-			randplies = 8;
-		}
 
 		for (int i=0; i<randplies; i++)
 		{
@@ -101,46 +106,22 @@ public:
 
 	void flushBoards()
 	{
-		mutex->lock();
-
-		self->games += numGames;
-		numGames = 0;
-
 		for (size_t i=0; i<boards.size(); i++)
-		{
-			i16 tmp = (i16)labels[i];
-			fwrite(&tmp, 2, 1, file);
-
-			i8 tmpi;
-			tmpi = i8(outcomes[i]*2);
-			fwrite(&tmpi, 1, 1, file);
-
-			tmpi = boards[i].turn() == ctBlack ? 1 : 0;
-			fwrite(&tmpi, 1, 1, file);
-
-			// compress the board
-			uint8_t buf[16];
-			auto occ = boards[i].compressPiecesOccupancy(buf);
-			fwrite(&occ, 8, 1, file);
-			fwrite(buf, 1, 16, file);
-		}
+			writer.add(labels[i], outcomes[i], boards[i]);
 
-		fflush(file);
-
-		self->positions += (int64_t)boards.size();
-
-		double complete = self->positions * 100.0 / self->limit;
-
-		std::cout << self->positions << " positions (" << self->games << " games) " << complete << "% completed" << std::endl;
-
-		if (self->positions >= self->limit)
-			doneFlag = 1;
-
-		mutex->unlock();
+		if (!gameData.empty())
+			writer.addGames(gameData.data(), gameData.size(), gamePositions);
 
 		boards.clear();
 		outcomes.clear();
 		labels.clear();
+		gameData.clear();
+		gamePositions = 0;
+	}
+
+	size_t pendingPositions() const
+	{
+		return boards.size() + gamePositions;
 	}
 
 	void playGame()
@@ -155,6 +136,9 @@ public:
 
 		size_t boardStart = boards.size();
 
+		if (self->storeGames)
+			game.begin(s->board);
+
 		while (!doneFlag)
 		{
 			if (g.adjudicate())
@@ -162,7 +146,9 @@ public:
 
 			SearchMode sm;
 			sm.reset();
-			sm.maxNodes = 6144;
+			sm.maxNodes = self->nodes;
+			// always limit depth: an analyzing search would wait for stop if it ran out of plies
+			sm.maxDepth = self->depth ? (Depth)self->depth : (Depth)maxDepth;
 			const auto tb = s->board;
 			Score sc = s->iterate(tb, sm);
 
@@ -189,24 +175,19 @@ public:
 			s->rep.push(s->board.sig(), !s->board.fifty());
 
 			// label conditions met?
-			if (abs(sc) > 1600 || tb.inCheck() || MovePack::isSpecial(move) || g.curBoard.move() < 4)
-				continue;
+			bool labeled = !(abs(sc) > 1600 || tb.inCheck() || MovePack::isSpecial(move) || g.curBoard.move() < 4);
 
-			Signature sig = g.curBoard.sig();
+			// ignore dups (shared across workers)
+			if (labeled && !self->dedup.insert(tb.sig()))
+				labeled = false;
 
-			bool dup = false;
+			if (self->storeGames)
+				game.add(move, sc, labeled);
 
-			for (auto &it : boards)
-			{
-				if (it.sig() == sig)
-				{
-					dup = true;
-					break;
-				}
-			}
+			if (!labeled)
+				continue;
 
-			// ignore local dups
-			if (dup)
+			if (self->storeGames)
 				continue;
 
 			boards.push_back(tb);
@@ -222,6 +203,9 @@ public:
 
 		for (size_t i=0; i<count; i++)
 			outcomes.push_back(outcome);
+
+		if (self->storeGames)
+			gamePositions += game.finish(outcome, gameData);
 	}
 
 	void work() override
@@ -231,7 +215,6 @@ public:
 
 		rng.Seed(seed);
 
-		numGames = 0;
 
 		while (!doneFlag)
 		{
@@ -241,27 +224,75 @@ public:
 			// gen_board_somehow
 			while (!genInitialBoard());
 
+			size_t pending = pendingPositions();
 			playGame();
-			++numGames;
 
-			if (boards.size() >= 16*1024)
+			// count per game so that progress and limit don't depend on flush granularity
+			++self->games;
+			if ((self->positions += (int64_t)(pendingPositions() - pending)) >= self->limit)
+				doneFlag = 1;
+
+			if (pendingPositions() >= 16*1024)
 				flushBoards();
 		}
 
 		flushBoards();
+		writer.close();
+		finished = true;
 	}
 };
 
-void AutoPlay::go(const char *labelFile, int64_t posLimit)
+static std::string shardName(const char *labelFile, size_t index)
 {
-	FILE *fo = fopen(labelFile, "wb");
-
-	if (!fo)
-		return;
+	char buf[32];
+	sprintf(buf, ".%u", (uint)index);
+	return std::string(labelFile) + buf;
+}
 
+bool AutoPlay::go(const char *labelFile, int64_t posLimit)
+{
 	limit = posLimit;
+	positions = 0;
+	games = 0;
+
+	const int numThreads = std::max(1, threads);
+
+	if (!nodes && !depth)
+		nodes = 6144;
+
+	std::cout << "autoplay: " << numThreads << " threads, nodes " << nodes << ", depth " << (int)depth
+		<< ", random plies " << randomPlies << ", frc ratio " << frcRatio << (storeGames ? ", games" : "") << std::endl;
+
+	const size_t dedupBytes = (size_t)std::max(0, dedupMB) << 20;
+	bool wasBloom = dedupBloom;
+
+	if (!dedupFile.empty() && std::ifstream(dedupFile.c_str()).good())
+	{
+		// continue previous runs
+		if (!dedup.load(dedupFile.c_str()))
+		{
+			std::cout << "failed to load dedup set " << dedupFile << std::endl;
+			return false;
+		}
+
+		std::cout << "dedup: " << dedup.count() << " signatures loaded from " << dedupFile << std::endl;
+		wasBloom = dedup.mode() == SigSet::ssBloom;
+
+		if (!dedup.grow((u64)limit, dedupBytes))
+		{
+			std::cout << "failed to allocate dedup set" << std::endl;
+			return false;
+		}
+	}
+	else if (!dedup.initFor((u64)limit, dedupBytes, dedupBloom ? SigSet::ssBloom : SigSet::ssExact))
+	{
+		std::cout << "failed to allocate dedup set" << std::endl;
+		return false;
+	}
 
-	const int numThreads = 16;
+	if (dedup.mode() == SigSet::ssBloom && !wasBloom)
+		std::cout << "dedup: exact set for " << dedup.count() + limit << " positions exceeds " << dedupMB
+			<< " MB, using bloom filter" << std::endl;
 
 	std::vector<TransTable *> tt;
 	tt.resize(numThreads);
@@ -286,21 +317,53 @@ void AutoPlay::go(const char *labelFile, int64_t posLimit)
 	std::vector<AutoPlayWorker *> w;
 	w.resize(numThreads);
 
-	std::mutex mutex;
+	bool ok = true;
 
-	for (size_t i=0; i<numThreads; i++)
+	for (size_t i=0; i<(size_t)numThreads; i++)
 	{
 		auto *apw = new AutoPlayWorker;
 		apw->workerIndex = (int)i;
 		apw->s = s[i];
-		apw->mutex = &mutex;
 		apw->self = this;
-		apw->file = fo;
+		ok &= apw->writer.open(shardName(labelFile, i).c_str(), true, 65536, storeGames);
 		w[i] = apw;
 	}
 
-	for (auto *it : w)
-		it->run();
+	if (ok)
+	{
+		for (auto *it : w)
+			it->run();
+
+		// progress report
+		i32 startTicks = Timer::getMillisec();
+		bool warnedFull = false;
+
+		for (;;)
+		{
+			size_t running = 0;
+
+			for (auto *it : w)
+				running += !it->finished;
+
+			if (!running)
+				break;
+
+			Thread::sleep(1000);
+
+			double secs = std::max(1, Timer::getMillisec() - startTicks) / 1000.0;
+			int64_t pos = positions;
+			int64_t gms = games;
+
+			std::cout << pos << " positions (" << gms << " games) " << pos * 100.0 / limit << "% completed, "
+				<< (int64_t)(pos / secs) << " pos/s, " << gms / secs << " games/s" << std::endl;
+
+			if (!warnedFull && dedup.overflows())
+			{
+				std::cout << "warning: dedup set is full, duplicates are no longer filtered" << std::endl;
+				warnedFull = true;
+			}
+		}
+	}
 
 	for (auto *it : w)
 		it->kill();
@@ -311,7 +374,42 @@ void AutoPlay::go(const char *labelFile, int64_t posLimit)
 	for (auto *it : s)
 		delete it;
 
-	fclose(fo);
+	// merge shards
+	TrainWriter fo;
+	ok = ok && (rawOutput ? fo.openRaw(labelFile) : fo.open(labelFile, true, 65536, storeGames));
+
+	for (size_t i=0; i<(size_t)numThreads; i++)
+	{
+		auto shard = shardName(labelFile, i);
+
+		if (ok)
+		{
+			TrainReader tr;
+			ok = tr.open(shard.c_str()) && fo.appendChunks(tr);
+		}
+
+		remove(shard.c_str());
+	}
+
+	ok = fo.close() && ok;
+
+	std::cout << positions << " positions (" << games << " games) written to " << labelFile << std::endl;
+	dedup.report("dedup: ");
+
+	if (!dedupFile.empty())
+	{
+		if (dedup.save(dedupFile.c_str()))
+			std::cout << "dedup: " << dedup.count() << " signatures saved to " << dedupFile << std::endl;
+		else
+		{
+			std::cout << "failed to save dedup set " << dedupFile << std::endl;
+			ok = false;
+		}
+	}
+
+	dedup.release();
+
+	return ok;
 }
 
 }
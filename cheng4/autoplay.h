@@ -24,6 +24,9 @@ or as public domain (where applicable)
 #pragma once
 
 #include "game.h"
+#include "sigset.h"
+#include <atomic>
+#include <string>
 
 namespace cheng4
 {
@@ -31,11 +34,35 @@ namespace cheng4
 struct AutoPlay
 {
 	// 400m by default
-	void go(const char *labelFile, int64_t posLimit = U64C(400000000));
+	// each worker writes its own shard (labelFile.N), shards are merged into labelFile at the end
+	bool go(const char *labelFile, int64_t posLimit = U64C(400000000));
 
-	int64_t positions = 0;
-	int64_t games = 0;
+	std::atomic<int64_t> positions{0};
+	std::atomic<int64_t> games{0};
 	int64_t limit = 0;
+
+	// labeled position dedup, shared by all workers
+	SigSet dedup;
+
+	// parameters
+	int threads = 16;
+	// search limits per move (0 = none)
+	NodeCount nodes = 6144;
+	Depth depth = 0;
+	// random opening plies (FRC positions use half)
+	int randomPlies = 8;
+	// fraction of games starting from a random FRC position
+	double frcRatio = 0.125;
+	// store game sequences (start position + moves) instead of individual positions
+	bool storeGames = false;
+	// write plain packed records instead of a training data container
+	bool rawOutput = false;
+	// maximum dedup set size in MB; the set is sized from the position limit
+	// and becomes a bloom filter if an exact set wouldn't fit
+	int dedupMB = 1024;
+	bool dedupBloom = false;
+	// if not empty, dedup set is loaded from (if present) and saved to this file => dedup across runs
+	std::string dedupFile;
 };
 
 }
@@ -22,6 +22,7 @@ or as public domain (where applicable)
 */
 
 #include "board.h"
+#include "attacks.h"
 #include "movegen.h"
 #include "utils.h"
 #include "eval.h"
@@ -371,7 +372,7 @@ void Board::update()
 			while ( tmp )
 			{
 				Square sq = BitOp::popBit(tmp);
-				bpieces[ sq ] = PiecePack::init( c, p );
+				setSquare( sq, PiecePack::init( c, p ) );
 
 				bb[ bbiWOcc + c ] |= BitOp::oneShl( sq );
 
@@ -397,7 +398,7 @@ void Board::update()
 	for ( Color c = ctWhite; c <= ctBlack; c++ )
 	{
 		Square kp = king(c);
-		bpieces[ kp ] = PiecePack::init( c, ptKing );
+		setSquare( kp, PiecePack::init( c, ptKing ) );
 		h ^= Zobrist::piece[ c ][ ptKing ][ kp ];
 		bb[ bbiWOcc + c ] |= BitOp::oneShl( kp );
 
@@ -937,7 +938,12 @@ void Board::doNullMove( UndoInfo &ui )
 // undo nullmove
 void Board::undoNullMove( const UndoInfo &ui )
 {
-	undoMove( ui );
+	// note: can't use undoMove here because null move doesn't save mailbox
+	bhash = ui.bhash;
+	bep = ui.ep;
+	bturn = flip( bturn );
+	bfifty--;
+	assert( isValid() );
 }
 
 // castling move is special
@@ -1005,18 +1011,15 @@ void Board::doCastlingMove( Move move, UndoInfo &ui, bool ischeck )
 	bhash ^= Zobrist::piece[ color ][ ptRook ][ rto ];
 
 	// save pieces
-	ui.savePiece( kfrom, piece( kfrom ) );
-	ui.savePiece( kto, piece( kto ) );
-	ui.savePiece( rfrom, piece( rfrom ) );
-	ui.savePiece( rto, piece( rto ) );
+	ui.saveMailbox( bpieces );
 
 	// move pieces
-	Piece kfp = bpieces[ kfrom ];
-	Piece rfp = bpieces[ rfrom ];
-	bpieces[ kfrom ] = ptNone;
-	bpieces[ rfrom ] = ptNone;
-	bpieces[ kto ] = kfp;
-	bpieces[ rto ] = rfp;
+	Piece kfp = piece( kfrom );
+	Piece rfp = piece( rfrom );
+	setSquare( kfrom, ptNone );
+	setSquare( rfrom, ptNone );
+	setSquare( kto, kfp );
+	setSquare( rto, rfp );
 
 	// save king state
 	saveKingState( ui );
@@ -1054,10 +1057,14 @@ void Board::doCastlingMove( Move move, UndoInfo &ui, bool ischeck )
 		calcEvasMask();
 	}
 
+	if ( ui.attacks )
+		ui.attacks->update( *this, kft | rft );
+
 	assert( bcheck == doesAttack<1>( flip(bturn), king( bturn ) ) );
 	assert( bhash == recomputeHash() );
 	assert( bpawnHash == recomputePawnHash() );
 	assert( isValid() );
+	assert( !ui.attacks || ui.attacks->isValid( *this ) );
 }
 
 void Board::doMove( Move move, UndoInfo &ui, bool isCheck )
@@ -1167,15 +1174,7 @@ void Board::undoMove( const UndoInfo &ui )
 		bb[ ui.bbi[i] ] = ui.bb[ i ];
 
 	// restore pieces
-	for (u8 i=0; i<ui.pieceCount; i++)
-	{
-		Square sq = ui.squares[i];
-
-		Piece newp = ui.pieces[i];
-
-		assert( PiecePack::type( newp ) <= ptKing );
-		bpieces[ sq ] = newp;
-	}
+	memcpy( bpieces, ui.mailbox, sizeof(bpieces) );
 
 	// restore turn flag
 	bturn = flip( bturn );
@@ -1853,7 +1852,7 @@ bool Board::isValid() const
 {
 	Board tmp(*this);
 
-	Piece opieces[64];
+	u8 opieces[32];
 	memcpy( opieces, bpieces, sizeof(opieces) );
 
 	// make sure bit representations match squares
@@ -2218,7 +2217,7 @@ bool Board::setPiece( Color c, Piece p, Square sq )
 {
 	if ( c > ctBlack || p > ptKing || sq > 63 )
 		return 0;
-	bpieces[ sq ] = PiecePack::init( c, p );
+	setSquare( sq, PiecePack::init( c, p ) );
 	return 1;
 }
 
@@ -2250,17 +2249,15 @@ void Board::updateBitboards()
 // swap white<=>black
 void Board::swap()
 {
-	for ( Square s=0; s<32; s++)
-	{
-		Square fs = SquarePack::flipV(s);
-		std::swap( bpieces[s], bpieces[fs] );
-	}
+	Piece opieces[64];
+	for ( Square s=0; s<64; s++)
+		opieces[s] = piece(s);
 	for ( Square s=0; s<64; s++)
 	{
-		Piece p = bpieces[s];
-		if ( PiecePack::type(p) == ptNone )
-			continue;
-		bpieces[s] ^= (Piece)1 << psColor;
+		Piece p = opieces[ SquarePack::flipV(s) ];
+		if ( PiecePack::type(p) != ptNone )
+			p ^= (Piece)1 << psColor;
+		setSquare( s, p );
 	}
 	std::swap( bcastRights[ ctWhite ], bcastRights[ ctBlack ] );
 	if ( bep )
@@ -2597,8 +2594,8 @@ void Board::doMoveTemplate( Move move, Square from, Square to, UndoInfo &ui, boo
 	Piece toPiece;
 
 	// prepare to update pieces on board
-	ui.savePiece( from, toPiece = piece(from) );
-	ui.savePiece( to, piece(to) );
+	ui.saveMailbox( bpieces );
+	toPiece = piece(from);
 
 	assert( PiecePack::type( toPiece ) );
 
@@ -2767,14 +2764,13 @@ void Board::doMoveTemplate( Move move, Square from, Square to, UndoInfo &ui, boo
 		{
 			assert( MovePack::isEpCapture( move ) );
 			// ep capture
-			ui.savePiece( cto, cap );
-			bpieces[ cto ] = ptNone;
+			setSquare( cto, ptNone );
 		}
 	}
 
 	// finish updating board pieces
-	bpieces[to] = toPiece;
-	bpieces[from] = ptNone;
+	setSquare( to, toPiece );
+	setSquare( from, ptNone );
 
 	// update delta material
 
@@ -2833,10 +2829,19 @@ void Board::doMoveTemplate( Move move, Square from, Square to, UndoInfo &ui, boo
 	if ( isCheck )
 		calcEvasMask();
 
+	if ( ui.attacks )
+	{
+		Bitboard changed = ftmask;
+		if ( ptype == ptPawn && MovePack::isEpCapture( move ) )
+			changed |= BitOp::oneShl( SquarePack::epTarget( ui.ep, from ) );
+		ui.attacks->update( *this, changed );
+	}
+
 	assert( bcheck == doesAttack<1>( flip(bturn), king( bturn ) ) );
 	assert( bhash == recomputeHash() );
 	assert( bpawnHash == recomputePawnHash() );
 	assert( isValid() );
+	assert( !ui.attacks || ui.attacks->isValid( *this ) );
 }
 
 uint64_t Board::compressPiecesOccupancy(uint8_t buf[16]) const
@@ -2895,22 +2900,8 @@ void Board::uncompressPiecesOccupancy(uint64_t occ, const uint8_t buf[16])
 
 void Board::compressPieces(uint8_t buf[32]) const
 {
-	memset(buf, 0, 32);
-	auto occ = occupied();
-
-	while (occ)
-	{
-		Square sq = BitOp::popBit(occ);
-		Piece p = piece(sq);
-		p &= 15;
-
-		// simple nibble-packing
-		if (sq & 1)
-			p <<= 4;
-
-		// and store
-		buf[sq >> 1] |= p;
-	}
+	// mailbox is already nibble-packed
+	memcpy(buf, bpieces, 32);
 }
 
 void Board::uncompressPieces(const uint8_t buf[32])
@@ -2918,22 +2909,7 @@ void Board::uncompressPieces(const uint8_t buf[32])
 	reset();
 	clearPieces();
 
-	for (int sq=0; sq<64; sq++)
-	{
-		Piece p = Piece(buf[sq >> 1]);
-
-		if (sq & 1)
-			p >>= 4;
-
-		p &= 15;
-
-		Piece pt = PiecePack::type(p);
-
-		if (pt == ptNone)
-			continue;
-
-		setPiece(PiecePack::color(p), pt, (Square)sq);
-	}
+	memcpy(bpieces, buf, 32);
 
 	updateBitboards();
 }
@@ -29,6 +29,7 @@ or as public domain (where applicable)
 #include "psq.h"
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 // TODO: move large methods to cpp
@@ -39,6 +40,7 @@ namespace cheng4
 class MoveGen;
 
 struct NetCache;
+struct AttackMap;
 
 typedef uint UndoMask;
 
@@ -57,6 +59,8 @@ struct UndoInfo
 {
 	// holds NetCache
 	Eval *eval;
+	// optional incremental attack map (null = disabled)
+	AttackMap *attacks;
 	UndoMask flags;				// undo flags
 	// ep square will be restored
 	Signature bhash;			// board hash (always)
@@ -66,10 +70,8 @@ struct UndoInfo
 	NPMat npmat[2];				// original non-pawn material
 	u8 bbi[7];					// indices to restore
 	u8 bbCount;					// number of bbs to restore
-	Piece pieces[4];			// board pieces to restore
-	Square squares[4];			// board squares to restore
+	u8 mailbox[32];				// nibble-packed board pieces to restore (always for real moves)
 	Square ep;					// original ep square (always)
-	u8 pieceCount;				// number of board pieces to restore
 	FiftyCount fifty;			// original fifty move counter type (if needed)
 	CastRights castRights[2];	// original castling rights (if needed)
 	u8 kingPos;					// original king position (always)
@@ -77,13 +79,14 @@ struct UndoInfo
 
 	inline UndoInfo()
 		: eval(nullptr)
+		, attacks(nullptr)
 	{
 	}
 
 	inline void clear()
 	{
 		flags = 0;
-		bbCount = pieceCount = 0;
+		bbCount = 0;
 	}
 
 	inline void saveBB( u8 index, Bitboard bboard )
@@ -94,12 +97,10 @@ struct UndoInfo
 		bbi[ bbCount++ ] = index;
 	}
 
-	inline void savePiece( Square square, Piece piece )
+	// saving the whole packed mailbox is cheaper than read-modify-write of single nibbles
+	inline void saveMailbox( const u8 *src )
 	{
-		assert( PiecePack::type( piece ) <= ptKing );
-		assert( pieceCount < 4 );
-		pieces[ pieceCount ] = piece;
-		squares[ pieceCount++ ] = square;
+		memcpy( mailbox, src, sizeof(mailbox) );
 	}
 };
 
@@ -108,23 +109,35 @@ class Board
 protected:
 	friend class MoveGen;
 
+	// layout: hash and scalar state + occupancy/pawns/knights share the first cache line,
+	// remaining bitboards fill the second one, the rest goes to the third one
+	// note: Board isn't declared alignas(64) because pre-C++17 new doesn't honor over-alignment
 	Signature bhash;			// current hash signature
-	Signature bpawnHash;		// current pawn hash signature
-	Bitboard bb[ bbiMax ];		// bitboard for pieces (indexed using BBI)
-	Piece bpieces[ 64 ];		// pieces: color in MSBit
-	DMat bdmat[2];				// delta-material [gamephase] - in centipawns
-	NPMat bnpmat[2];			// non-pawn material (white, black)
 	Square bkingPos[2];			// kings not stored using bitboards
 	Color bturn;				// ctWhite(0) or ctBlack(1)
 	Square bep;					// enpassant square (new: where opp captures; was a flaw in cheng3)
 	FiftyCount bfifty;			// fifty move counter
 	CastRights bcastRights[2];	// castling rights for white/black, indexed by colorType
 	bool bcheck;				// in check flag
+	Bitboard bb[ bbiMax ];		// bitboard for pieces (indexed using BBI)
+	Signature bpawnHash;		// current pawn hash signature
+	u8 bpieces[ 32 ];			// nibble-packed pieces (odd squares in high nibble): color in MSBit
+	DMat bdmat[2];				// delta-material [gamephase] - in centipawns
+	NPMat bnpmat[2];			// non-pawn material (white, black)
 
 	// extra stuff (not used during search)
 	bool frc;					// is fischer random?
 	uint curMove;				// current move number
 
+	// set piece at square (mailbox only)
+	inline void setSquare( Square sq, Piece p )
+	{
+		assert( sq < 64 && p < 16 );
+		uint shift = (sq & 1) << 2;
+		u8 &dst = bpieces[ sq >> 1 ];
+		dst = (u8)((dst & ~(15u << shift)) | ((uint)p << shift));
+	}
+
 	// castling move is special
 	void doCastlingMove( Move move, UndoInfo &ui, bool ischeck );
 
@@ -178,6 +191,10 @@ protected:
 
 	template< Color c > Draw isDrawByMaterial( MaterialKey mk ) const;
 
+	// threshold see core, occ/attk already updated for the initial capture
+	bool seeGEFrom( Square from, Square to, int threshold, Bitboard occ, Bitboard attk,
+		Bitboard diagSliders, Bitboard orthoSliders ) const;
+
 	void calcEvasMask();
 
 public:
@@ -390,7 +407,7 @@ public:
 	inline Piece piece( Square sq ) const
 	{
 		assert( sq < 64 );
-		return bpieces[ sq ];
+		return (Piece)((bpieces[ sq >> 1 ] >> ((sq & 1) << 2)) & 15);
 	}
 
 	// clear pieces (used in xboard edit mode)
@@ -727,6 +744,13 @@ public:
 	// fast => used in movegen (where only bad/good capture = sign matters)
 	template< bool fast > int see( Move m ) const;
 
+	// returns 1 if see( m ) >= threshold, stops as soon as the outcome is decided
+	// am: optional attack map of this position (initial attackers are read from it)
+	bool seeGE( Move m, int threshold, const AttackMap *am = nullptr ) const;
+
+	// seeGE for many moves of this position at once (shares attackers to common target squares)
+	void seeGEBatch( const Move *moves, int count, int threshold, bool *res, const AttackMap *am = nullptr ) const;
+
 	// returns 1 if move is irreversible
 	inline bool isIrreversible( Move m ) const
 	{
@@ -141,7 +141,22 @@ static u64 PGHash( const Board &b )
 
 static const BookProbe maxCounter = 8;
 
-Book::Book() : counter(0), stream(0), numEntries(0), numPositions(0)
+// book file layout: 32-byte header, BookBits, entries
+static const size_t bookHeaderSize = 32;
+static const size_t bookEntriesOffset = bookHeaderSize + sizeof(BookBits);
+static const size_t bookEntrySize = 12;
+
+// books up to this size are read into memory (avoids page faults on network filesystems)
+static const size_t bookLoadLimit = 16u*1024*1024;
+
+static inline u64 bookEntrySig( const u8 *ptr )
+{
+	u64 res;
+	memcpy( &res, ptr, sizeof(res) );
+	return res;
+}
+
+Book::Book() : counter(0), entries(0), numEntries(0), numPositions(0)
 {
 	memset( bits.bits, 0, sizeof(bits.bits) );
 	rng = new PRNG( Timer::getMillisec() );
@@ -156,64 +171,75 @@ Book::~Book()
 bool Book::open(const char *fnm)
 {
 	close();
-	stream = new std::ifstream( fnm, std::ios::in | std::ios::binary );
-	if ( !*stream )
+	if ( !file.open( fnm ) || file.size() < bookEntriesOffset )
 	{
 		close();
 		return 0;
 	}
-	stream->seekg( (std::streampos)(16u) );
-	stream->read( (char *)&numEntries, sizeof(numEntries) );
-	stream->read( (char *)&numPositions, sizeof(numPositions) );
-	stream->seekg( (std::streampos)(32u) );
-	stream->read( (char *)bits.bits, 65536u );
-	if ( stream->fail() )
+
+	const u8 *data = file.data();
+	size_t size = file.size();
+
+	if ( size <= bookLoadLimit )
 	{
-		close();
-		return 0;
+		buffer.assign( data, data + size );
+		file.close();
+		data = buffer.data();
 	}
+
+	memcpy( &numEntries, data + 16, sizeof(numEntries) );
+	memcpy( &numPositions, data + 20, sizeof(numPositions) );
+	memcpy( bits.bits, data + bookHeaderSize, sizeof(bits.bits) );
+
+	// truncated file => only use complete entries
+	size_t maxEntries = (size - bookEntriesOffset) / bookEntrySize;
+	if ( numEntries > maxEntries )
+		numEntries = (u32)maxEntries;
+
+	entries = data + bookEntriesOffset;
 	return 1;
 }
 
 bool Book::close()
 {
-	if ( !stream )
-		return 0;
+	bool res = entries != 0;
 	numEntries = 0;
-	stream->close();
-	delete stream;
-	stream = 0;
-	return 1;
+	entries = 0;
+	file.close();
+	std::vector<u8>().swap( buffer );
+	return res;
 }
 
-bool Book::readEntry( size_t idx, BookEntry &e )
+void Book::readEntry( size_t idx, BookEntry &e ) const
 {
-	if ( !stream )
-		return 0;
-	stream->seekg( (std::streampos)(32u+65536u+12u*idx) );
-	stream->read( (char *)&e, 12 );
-	if ( stream->fail() )
-		return 0;
-	return 1;
+	assert( idx < numEntries );
+	const u8 *ptr = entries + bookEntrySize*idx;
+	e.sig = bookEntrySig( ptr );
+	memcpy( &e.move, ptr + 8, sizeof(e.move) );
+	memcpy( &e.count, ptr + 10, sizeof(e.count) );
 }
 
-u32 Book::findEntry( u64 sig, BookEntry &ent )
+u32 Book::findEntry( u64 sig, BookEntry &ent ) const
 {
-	i32 l = 0;
-	i32 h = (i32)numEntries-1;
-	while ( l<h )
+	if ( !numEntries )
+		return numEntries;
+
+	// branchless lower bound
+	u32 idx = 0;
+	u32 n = numEntries;
+	while ( n > 1 )
 	{
-		i32 m = (l+h)/2;
-		if ( !readEntry( (u32)m, ent ) )
-			return 0;
-		if ( sig <= ent.sig )
-			h = m;
-		else
-			l = m+1;
+		u32 half = n/2;
+		idx = bookEntrySig( entries + bookEntrySize*(idx + half) ) < sig ? idx + half : idx;
+		n -= half;
 	}
-	if ( !readEntry( (u32)l, ent ) )
-		return 0;
-	return ent.sig == sig ? l : numEntries;
+	idx += bookEntrySig( entries + bookEntrySize*idx ) < sig;
+
+	if ( idx >= numEntries )
+		return numEntries;
+
+	readEntry( idx, ent );
+	return ent.sig == sig ? idx : numEntries;
 }
 
 // enum moves for current entry
@@ -247,8 +273,7 @@ u32 Book::enumEntries( const Board &b, std::vector<Move> &moves, bool avoid, std
 		ents.push_back( ent );
 		if ( ++ei >= numEntries )
 			break;
-		if ( !readEntry( ei, ent ) )
-			break;
+		readEntry( ei, ent );
 		if ( ent.sig != hash )
 			break;
 	}
@@ -25,7 +25,7 @@ or as public domain (where applicable)
 
 #include "chtypes.h"
 #include "board.h"
-#include <fstream>
+#include "mapfile.h"
 #include <vector>
 
 namespace cheng4
@@ -64,16 +64,21 @@ class Book
 protected:
 	BookProbe counter;
 	BookBits bits;
-	std::ifstream *stream;
+	// book file: mapped, small books are loaded into memory instead
+	MappedFile file;
+	std::vector<u8> buffer;
+	// sorted 12-byte entries (u64 sig, u16 move, u16 count)
+	const u8 *entries;
 	u32 numEntries;
 	u32 numPositions;
 
 	PRNG *rng;
 
-	bool readEntry( size_t idx, BookEntry &e );
+	void readEntry( size_t idx, BookEntry &e ) const;
 
-	// find leftmost entry
-	u32 findEntry( u64 sig, BookEntry &e );
+	// find leftmost entry (branchless binary search in memory)
+	// returns numEntries if not found
+	u32 findEntry( u64 sig, BookEntry &e ) const;
 
 public:
 
@@ -29,6 +29,7 @@ or as public domain (where applicable)
 #include "tb.h"
 
 #include <memory.h>
+#include <string.h>
 #include <iostream>
 
 namespace cheng4
@@ -75,18 +76,49 @@ void EngineThread::work()
 
 // Engine
 
+bool Engine::startupBench = 0;
+static u64 startupFirst = 0;
+static u64 startupLast = 0;
+
+void Engine::startupStep( const char *name )
+{
+	if ( !startupBench )
+		return;
+	u64 now = Timer::getMicrosec();
+	std::cout << name << ": " << (now - startupLast) << " us (total " << (now - startupFirst) << " us)" << std::endl;
+	startupLast = now;
+}
+
 void Engine::init( int npar, const char **par )
 {
 	Timer::init();
+	startupFirst = startupLast = Timer::getMicrosec();
 	Tables::init();
+	startupStep( "Tables::init" );
 	BitOp::init();
+	startupStep( "BitOp::init" );
 	Magic::init();
+	startupStep( "Magic::init" );
 	Zobrist::init();
+	startupStep( "Zobrist::init" );
+	Cuckoo::init();
+	startupStep( "Cuckoo::init" );
 	PSq::init();
+	startupStep( "PSq::init" );
 	KPK::init();
+	startupStep( "KPK::init" );
 	Eval::init();
+	startupStep( "Eval::init" );
 	Search::init();
-	extractFeatures();
+	startupStep( "Search::init" );
+	initFeatures();
+	startupStep( "initFeatures" );
+	if ( startupBench )
+	{
+		// normally loaded by the first Eval
+		Network::embedded();
+		startupStep( "embedded net" );
+	}
 #ifdef USE_TUNING
 	// pass parameters:
 	for (int i=0; i<npar; i+=2)
@@ -99,7 +131,9 @@ void Engine::init( int npar, const char **par )
 
 void Engine::done()
 {
+#ifdef USE_TUNING
 	freeFeatures();
+#endif
 	Magic::done();
 	Timer::done();
 }
@@ -119,8 +153,8 @@ Engine::Engine( size_t transMegs )
 
 	// hash table init goes here
 	tt = new TransTable;
+	// note: resize clears the table
 	tt->resize( transMegs * 1048576 );
-	tt->clear();
 
 	mainThread = new EngineThread;
 	mainThread->search.setHashTable( tt );
@@ -377,8 +411,9 @@ void Engine::clearHash()
 bool Engine::setHash( uint megs )
 {
 	abortSearch();
+	// note: resize clears the table, so only the slots need clearing
 	bool res = mainThread->search.tt->resize( (size_t)megs * (size_t)1048576 );
-	clearHash();
+	mainThread->search.clearSlots();
 	return res;
 }
 
@@ -442,6 +477,12 @@ void Engine::setThreads( uint nt )
 	mainThread->search.setThreads( nt-1 );
 }
 
+// get number of threads
+uint Engine::getThreads() const
+{
+	return (uint)mainThread->search.smpThreads.size() + 1;
+}
+
 // limit number of threads, default is 512
 void Engine::limitThreads( uint maxt )
 {
@@ -478,6 +519,12 @@ void Engine::setNullMove( bool nmv )
 	mainThread->search.enableNullMove( nmv );
 }
 
+// set attack map flag
+void Engine::setAttackMap( bool amap )
+{
+	mainThread->search.enableAttackMap( amap );
+}
+
 // set elo limit master flag
 void Engine::setLimit( bool limit )
 {
@@ -503,6 +550,21 @@ const Book &Engine::getBook() const
 }
 
 // init tablebases
+bool Engine::setEvalFile(const char *fname, const char *infoPrefix)
+{
+	abortSearch();
+
+	std::string error;
+	bool res = Network::setCurrent(fname, error);
+
+	if (res)
+		std::cout << infoPrefix << " network " << (*fname && strcmp(fname, "<empty>") ? fname : "<embedded>") << " loaded" << std::endl;
+	else
+		std::cout << infoPrefix << " network load failed: " << error << std::endl;
+
+	return res;
+}
+
 bool Engine::initTb(const char *paths, const char *infoPrefix)
 {
 	abortSearch();
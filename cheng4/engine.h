@@ -86,6 +86,11 @@ public:
 	static void init( int npar = 0, const char **par = 0 );
 	static void done();
 
+	// startup timing report (--startup-bench)
+	static bool startupBench;
+	// print time since previous step (only if startupBench is set)
+	static void startupStep( const char *name );
+
 	EngineThread *mainThread;
 
 	Engine( size_t transMegs = 32 );
@@ -169,6 +174,9 @@ public:
 	// set number of threads, default is 1
 	void setThreads( uint nt );
 
+	// get number of threads
+	uint getThreads() const;
+
 	// limit number of threads, default is 512
 	void limitThreads( uint maxt );
 
@@ -184,6 +192,9 @@ public:
 	// set nullmove flag
 	void setNullMove( bool nmv );
 
+	// set attack map flag
+	void setAttackMap( bool amap );
+
 	// set elo limit master flag
 	void setLimit( bool limit );
 
@@ -199,6 +210,9 @@ public:
 	// init tablebases
 	bool initTb(const char *paths, const char *infoPrefix);
 
+	// load network file (raw or compressed), empty = embedded net
+	bool setEvalFile(const char *fname, const char *infoPrefix);
+
 	// enable tablebases
 	void enableTb(bool flag);
 
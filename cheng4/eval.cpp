@@ -34,8 +34,6 @@ or as public domain (where applicable)
 namespace cheng4
 {
 
-#include "nets/net_embed.h"
-
 volatile bool Eval::useHCE = false;
 
 // eval helper
@@ -510,16 +508,9 @@ Eval::Eval() : occ(0), pe(0)
 	rookVertAttacks[ctWhite] = rookVertAttacks[ctBlack] = 0;
 	memset( attm, 0, sizeof(attm) );
 
-	if (!net.init_topology())
-		assert(0 && "net topo init failed!");
-
-	if (!net.load_buffer_compressed(NET_DATA, NET_DATA_SIZE))
-	{
-		std::cout << "failed to load netfile!" << std::endl;
-		abort();
-	}
-
-	net.transpose_weights();
+	// shared, loaded once
+	net = &Network::current();
+	netSerial = net->serial;
 }
 
 void Eval::setContempt( Score contempt )
@@ -563,8 +554,8 @@ void Eval::netCacheAddIndex(Color stm, int index)
 	int windex = stm == ctWhite ? index : findex;
 	int bindex = stm == ctWhite ? findex : index;
 
-	net.cache_add_index(netCache[ctWhite], windex);
-	net.cache_add_index(netCache[ctBlack], bindex);
+	netCacheAdd(netCache[ctWhite], windex);
+	netCacheAdd(netCache[ctBlack], bindex);
 }
 
 void Eval::netCacheSubIndex(Color stm, int index)
@@ -578,24 +569,69 @@ void Eval::netCacheSubIndex(Color stm, int index)
 	int windex = stm == ctWhite ? index : findex;
 	int bindex = stm == ctWhite ? findex : index;
 
-	net.cache_sub_index(netCache[ctWhite], windex);
-	net.cache_sub_index(netCache[ctBlack], bindex);
+	netCacheSub(netCache[ctWhite], windex);
+	netCacheSub(netCache[ctBlack], bindex);
+}
+
+void Eval::netCacheAdd(NetCache &nc, i32 index)
+{
+	if (nc.kingBase < 0)
+		return;
+
+	// own king (0..63) crossing to another bucket or half => refresh on next eval
+	if (index < 64 && (nc.kingXor != net->arch.kingXor(index) || nc.kingBase != net->arch.kingBase(index)))
+	{
+		nc.kingBase = -1;
+		return;
+	}
+
+	net->cache_add_index(nc, (index ^ nc.kingXor) + nc.kingBase);
+}
+
+void Eval::netCacheSub(NetCache &nc, i32 index)
+{
+	if (nc.kingBase < 0)
+		return;
+
+	net->cache_sub_index(nc, (index ^ nc.kingXor) + nc.kingBase);
+}
+
+void Eval::netCacheRefresh(const Board &b, Color c, NetCache &nc)
+{
+	i32 inds[64];
+	int count = b.netIndicesStm(c, inds);
+
+	// own king from c's point of view, see Board::netIndex
+	i32 ksq = b.king(c) ^ (c == ctBlack ? 0x38 : 0);
+	nc.kingXor = net->arch.kingXor(ksq);
+	nc.kingBase = net->arch.kingBase(ksq);
+
+	if (nc.kingXor | nc.kingBase)
+		for (int i=0; i<count; i++)
+			inds[i] = (inds[i] ^ nc.kingXor) + nc.kingBase;
+
+	net->cache_init(inds, count, nc);
 }
 
 void Eval::updateNetCache(const Board &b, NetCache *ncache)
 {
+	// pick up network swapped between searches (EvalFile)
+	const Network *cur = &Network::current();
+
+	if (cur != net || cur->serial != netSerial)
+	{
+		net = cur;
+		netSerial = cur->serial;
+		ecache.clear();
+	}
+
 	if (useHCE)
 		return;
 
 	netCache = ncache;
 
-	i32 inds[768];
-
 	for (Color c = ctWhite; c <= ctBlack; c++)
-	{
-		int count = b.netIndicesStm(c, inds);
-		net.cache_init(inds, count, netCache[c]);
-	}
+		netCacheRefresh(b, c, netCache[c]);
 }
 
 template< Color c > static inline bool isBareKing( const Board &b )
@@ -738,11 +774,15 @@ Score Eval::ievalNet(const Board &b)
 	if ( ec->sig == b.sig() )
 		return ec->score;					// hit => nothing to do
 
-	fixedp outp;
+	for (Color c = ctWhite; c <= ctBlack; c++)
+		if (netCache[c].kingBase < 0)
+			netCacheRefresh(b, c, netCache[c]);
+
+	int bucket = net->arch.outputs > 1 ? net->arch.outputBucket((int)BitOp::popCount(b.occupied())) : 0;
 
-	net.forward_cache(netCache[b.turn()], netCache[flip(b.turn())], &outp, 1);
+	fixedp outp = net->forward_cache(netCache[b.turn()], netCache[flip(b.turn())], bucket);
 
-	Score sc = net.to_centipawns(outp);
+	Score sc = Network::to_centipawns(outp);
 	Score corr = sign(b.turn()) * ScorePack::initFine(sc);
 
 	corr = augmentNet(b, corr);
@@ -1132,7 +1172,7 @@ template< PopCountMode pcm, Color c > void Eval::evalBishops( const Board &b )
 				{
 					// trapped by pawn
 					// confirm with see
-					if ( b.see<1>( MovePack::initCapture( sq, blocksq ) ) < 0 )
+					if ( !b.seeGE( MovePack::initCapture( sq, blocksq ), 0 ) )
 					{
 						fscore[phOpening] -= sign<c>()*trappedBishopOpening;
 						fscore[phEndgame] -= sign<c>()*trappedBishopEndgame;
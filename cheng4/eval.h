@@ -199,7 +199,14 @@ struct Eval
 		if (!useHCE)
 		{
 			ui.eval = this;
-			memcpy(dst, netCache, ctMax*sizeof(NetCache));
+			// only the used part of the accumulators
+			const size_t bytes = net->cache_size()*sizeof(wfixedp);
+			for (Color c = ctWhite; c <= ctBlack; c++)
+			{
+				memcpy(dst[c].cache, netCache[c].cache, bytes);
+				dst[c].kingXor = netCache[c].kingXor;
+				dst[c].kingBase = netCache[c].kingBase;
+			}
 			netCache = dst;
 		}
 	}
@@ -213,8 +220,10 @@ struct Eval
 	static volatile bool useHCE;
 
 private:
-	// new: net!
-	Network net;
+	// new: net! (process-wide, read-only)
+	const Network *net;
+	// serial of net, see Network::serial
+	u32 netSerial;
 	NetCache *netCache;
 
 	Score contemptFactor[ctMax];
@@ -242,6 +251,12 @@ private:
 
 	Score ievalNet(const Board &b);
 
+	// incremental update of single accumulator, index from accumulator's point of view
+	void netCacheAdd(NetCache &nc, i32 index);
+	void netCacheSub(NetCache &nc, i32 index);
+	// rebuild accumulator from scratch (king buckets)
+	void netCacheRefresh(const Board &b, Color c, NetCache &nc);
+
 	template< PopCountMode pcm > Score ieval( const Board &b, Score alpha = -scInfinity, Score beta = +scInfinity );
 
 	template< PopCountMode pcm, Color c, bool slow > void evalPawns( const Board &b );
@@ -25,11 +25,12 @@ or as public domain (where applicable)
 #include "board.h"
 #include "search.h"
 #include "shuffle.h"
-#include <set>
+#include "thread.h"
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <cctype>
+#include <algorithm>
 
 namespace cheng4
 {
@@ -43,14 +44,78 @@ void FilterPgn::Game::clear()
 	result = -1;
 }
 
-// FilterPgn
+// FilterPgn::Parser
 
-FilterPgn::FilterPgn()
+FilterPgn::Parser::Parser()
 {
 	tt.resize(1);
 	s.setHashTable(&tt);
 }
 
+// pooled worker: parses one chunk per command
+class FilterPgnWorker : public Thread
+{
+public:
+	FilterPgn::Parser *parser = nullptr;
+	const std::vector<char> *buf = nullptr;
+	u32 seed = 0;
+	bool result = false;
+
+	Event commandEvent;			// set when a chunk is pending
+	Event doneEvent;			// set when done with chunk
+	Event quitEvent;			// quit event
+	volatile bool shouldQuit = false;
+
+	// parse buf asynchronously
+	void start()
+	{
+		commandEvent.signal();
+	}
+
+	// wait for chunk to finish
+	void finish()
+	{
+		doneEvent.wait();
+	}
+
+	void destroy() override
+	{
+		shouldQuit = 1;
+		commandEvent.signal();
+		quitEvent.wait();
+	}
+
+	void work() override
+	{
+		for (;;)
+		{
+			commandEvent.wait();
+
+			if (shouldQuit)
+				break;
+
+			// buffer is zero-terminated
+			const char *ptr = buf->data();
+			result = parser->parse(ptr, ptr + buf->size() - 1, seed);
+			doneEvent.signal();
+		}
+
+		quitEvent.signal();
+	}
+};
+
+// FilterPgn
+
+FilterPgn::FilterPgn()
+{
+}
+
+FilterPgn::~FilterPgn()
+{
+	for (auto *it : parsers)
+		delete it;
+}
+
 bool FilterPgn::write(const char *fname)
 {
 	std::ofstream ofs( fname, std::ios::out | std::ios::binary );
@@ -77,42 +142,181 @@ bool FilterPgn::writeLines(const char *fname)
 	return true;
 }
 
+bool FilterPgn::readChunk(std::ifstream &ifs, std::vector<char> &buf, std::vector<char> &carry)
+{
+	buf.swap(carry);
+	carry.clear();
+
+	if (buf.empty() && !ifs.good())
+		return false;
+
+	// games start with a tag at line start; cut at the last game start
+	static const char marker[] = "\n[Event ";
+	const size_t markerLen = sizeof(marker)-1;
+	size_t searchFrom = 0;
+
+	while (ifs.good())
+	{
+		size_t old = buf.size();
+		buf.resize(old + chunkSize);
+		ifs.read(buf.data() + old, (std::streamsize)chunkSize);
+		buf.resize(old + (size_t)ifs.gcount());
+
+		if (!ifs.good())
+			break;
+
+		auto it = std::find_end(buf.begin() + (std::ptrdiff_t)searchFrom, buf.end(), marker, marker + markerLen);
+
+		if (it != buf.end())
+		{
+			carry.assign(it + 1, buf.end());
+			buf.erase(it + 1, buf.end());
+			break;
+		}
+
+		// single game larger than chunk, keep reading
+		searchFrom = buf.size() > markerLen ? buf.size() - markerLen : 0;
+	}
+
+	buf.push_back(0);
+	return buf.size() > 1;
+}
+
 bool FilterPgn::parse(const char *fname, bool extractlines)
 {
 	extractLines = extractlines;
 
 	if ( *fname == 32 )
 		fname++;
-	cheng4::Board b;
-	b.reset();
+
 	std::ifstream ifs( fname, std::ios::in | std::ios::binary );
 	if (!ifs.is_open())
 		return 0;
+
 	ifs.seekg(0, std::ios_base::end);
-	std::streampos size = ifs.tellg();
+	size_t sz = (size_t)ifs.tellg();
 	ifs.seekg(0);
-	size_t sz = (size_t)size;
-	char *buf = new char[sz+1];
-	ifs.read( buf, sz );
-	buf[sz] = 0;
-	const char *ptr, *top;
-	ptr = buf;
-	top = ptr + sz;
+
+	globalGame.clear();
+	lines.clear();
+
+	// ~16 bytes of pgn per ply is a safe upper bound on unique positions
+	if (!globalDups.initFor(std::max<size_t>(sz/16, 65536), dedupMB << 20))
+		return 0;
+
+	const int numThreads = std::max(1, threads);
+
+	while (parsers.size() < (size_t)numThreads)
+		parsers.push_back(new Parser);
+
+	std::vector<FilterPgnWorker *> workers;
+
+	for (int i=0; i<numThreads; i++)
+	{
+		auto *fw = new FilterPgnWorker;
+		fw->parser = parsers[i];
+		fw->parser->extractLines = extractLines;
+		workers.push_back(fw);
+		fw->run();
+	}
+
+	// double buffered: next batch is read while the current one is processed
+	// one chunk per worker
+	const int batch = numThreads;
+	std::vector<std::vector<char>> bufs[2];
+	bufs[0].resize((size_t)batch);
+	bufs[1].resize((size_t)batch);
+	std::vector<char> carry;
+
+	int totalPos = 0;
+	int forfeits = 0;
+	int illegals = 0;
+	bool parseRes = 1;
+	u32 chunkIndex = 0;
+
+	int count = 0;
+
+	while (count < batch && readChunk(ifs, bufs[0][count], carry))
+		count++;
+
+	for (int cur = 0; count > 0; cur ^= 1)
+	{
+		for (int i=0; i<count; i++)
+		{
+			auto *fw = workers[i];
+			fw->buf = &bufs[cur][i];
+			// seed by chunk index => result doesn't depend on thread count
+			fw->seed = chunkIndex++;
+			fw->start();
+		}
+
+		int next = 0;
+
+		while (next < batch && readChunk(ifs, bufs[cur^1][next], carry))
+			next++;
+
+		// merge in chunk order
+		for (int i=0; i<count; i++)
+		{
+			workers[i]->finish();
+			parseRes = parseRes && workers[i]->result;
+
+			Parser &p = *parsers[i];
+
+			for (auto &&it : p.positions)
+			{
+				// remove dup positions
+				if (!globalDups.insert(it.sig))
+					continue;
+
+				globalGame.positions.push_back(std::move(it));
+			}
+
+			for (auto &&it : p.lines)
+				lines.push_back(std::move(it));
+
+			totalPos += p.totalPos;
+			forfeits += p.forfeits;
+			illegals += p.illegals;
+		}
+
+		printf("%d positions\n", totalPos);
+
+		count = next;
+	}
+
+	for (auto *it : workers)
+		it->kill();
+
+	printf("%d time forfeits skipped\n", forfeits);
+	printf("%d illegal moves skipped\n", illegals);
+
+	globalDups.report("dedup: ");
+	globalDups.release();
+	return parseRes;
+}
+
+bool FilterPgn::Parser::parse(const char *ptr, const char *top, u32 seed)
+{
 	ls.ptr = ptr;
 	ls.top = top;
 
+	rng.Seed(seed);
+
+	positions.clear();
+	lines.clear();
+	currentLine.clear();
+	totalPos = 0;
+	forfeits = 0;
+	illegals = 0;
+
 	bool forfeit = 0;
 	bool parseRes = 1;
 	std::string key, value, comment;
 
-	globalGame.clear();
-	globalDups.clear();
 	game.clear();
 
 	int ch;
-	int totalPos = 0;
-	int forfeits = 0;
-	int illegals = 0;
 	// 0 = tags, 1 = game
 	int state = 0;
 	while ( (ch = peekChar()) >= 0 )
@@ -122,6 +326,7 @@ bool FilterPgn::parse(const char *fname, bool extractlines)
 			{
 				flushGame();
 				game.clear();
+				forfeit = 0;
 				state = 0;
 			}
 			if (!parseTag(key, value))
@@ -176,12 +381,9 @@ bool FilterPgn::parse(const char *fname, bool extractlines)
 		{
 			// parse comment!
 			if (!parseComment(comment))
-			{
-				delete[] buf;
 				return 0;
-			}
 
-			if (extractlines)
+			if (extractLines)
 				continue;
 
 			// here we want to filter book moves and checkmates
@@ -210,7 +412,7 @@ bool FilterPgn::parse(const char *fname, bool extractlines)
 			continue;
 		}
 
-		if (extractlines)
+		if (extractLines)
 		{
 			std::string smove = game.board.toSAN(m);
 			if (currentLine.empty())
@@ -235,20 +437,13 @@ bool FilterPgn::parse(const char *fname, bool extractlines)
 		game.positions.push_back(pos);
 
 		++totalPos;
-
-		if (!(totalPos & 131071))
-			printf("%d positions\n", totalPos);
 	}
 
-	printf("%d time forfeits skipped\n", forfeits);
-	printf("%d illegal moves skipped\n", illegals);
-
 	flushGame();
-	delete[] buf;
 	return parseRes;
 }
 
-void FilterPgn::flushGame()
+void FilterPgn::Parser::flushGame()
 {
 	if (extractLines)
 	{
@@ -272,6 +467,7 @@ void FilterPgn::flushGame()
 
 		s.board.fromFEN(p.fen.c_str());
 		s.board.resetMoveCount();
+		const Signature sig = s.board.sig();
 		s.eval.updateNetCache(s.board, s.cacheStack[0].cache);
 
 		Score sc;
@@ -299,30 +495,20 @@ void FilterPgn::flushGame()
 			continue;
 
 		pos.push_back(p);
+		pos.back().sig = sig;
 	}
 
 	if (pos.empty())
 		return;
 
-	static FastRandom rng;
 	// shuffle!
 	ShuffleArray<Position, FastRandom>(&pos[0], &pos.back()+1, rng);
 
 	for (auto &&it : pos)
-	{
-		s.board.fromFEN(it.fen.c_str());
-		s.board.resetMoveCount();
-
-		// remove dup positions
-		if (globalDups.find(s.board.sig()) != globalDups.end())
-			continue;
-
-		globalDups.insert(s.board.sig());
-		globalGame.positions.push_back(it);
-	}
+		positions.push_back(std::move(it));
 }
 
-bool FilterPgn::parseTag(std::string &key, std::string &value )
+bool FilterPgn::Parser::parseTag(std::string &key, std::string &value )
 {
 	int ch = getChar();
 	if (ch != '[')
@@ -359,7 +545,7 @@ bool FilterPgn::parseTag(std::string &key, std::string &value )
 	return 0;
 }
 
-bool FilterPgn::parseString(std::string &str)
+bool FilterPgn::Parser::parseString(std::string &str)
 {
 	int ch = getChar();
 	if (ch != '"')
@@ -376,7 +562,7 @@ bool FilterPgn::parseString(std::string &str)
 	return 0;
 }
 
-bool FilterPgn::parseComment(std::string &str)
+bool FilterPgn::Parser::parseComment(std::string &str)
 {
 	int ch = getChar();
 	if (ch != '{')
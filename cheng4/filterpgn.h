@@ -25,16 +25,21 @@ or as public domain (where applicable)
 
 #include "board.h"
 #include "search.h"
+#include "sigset.h"
+#include "shuffle.h"
 #include <string>
 #include <vector>
-#include <set>
-#include <unordered_set>
+#include <fstream>
 
 namespace cheng4
 {
 
+class FilterPgnWorker;
+
 class FilterPgn
 {
+	friend class FilterPgnWorker;
+
 	struct LexState
 	{
 		const char *ptr, *top;
@@ -45,6 +50,8 @@ class FilterPgn
 		// from white's POV
 		// 0 = loss, 1 = win, 0.5 = draw
 		float outcome;
+		// computed by the parser for dedup (only valid for filtered positions)
+		Signature sig;
 	};
 	struct Game
 	{
@@ -55,8 +62,57 @@ class FilterPgn
 
 		void clear();
 	};
+
+	// parses and filters a chunk of whole games, one per thread
+	// results are merged (and deduplicated) in chunk order
+	struct Parser
+	{
+		LexState ls;
+		Game game;
+
+		TransTable tt;
+		Search s;
+		FastRandom rng;
+
+		bool extractLines = false;
+		std::string currentLine;
+
+		// chunk results
+		std::vector<Position> positions;
+		std::vector<std::string> lines;
+		int totalPos = 0;
+		int forfeits = 0;
+		int illegals = 0;
+
+		Parser();
+
+		// ptr[top-ptr] must be readable (zero terminator)
+		bool parse(const char *ptr, const char *top, u32 seed);
+
+		bool parseTag(std::string &key, std::string &value );
+		bool parseString(std::string &str);
+		bool parseComment(std::string &str);
+		void flushGame();
+
+		inline int getChar()
+		{
+			return ls.ptr < ls.top ? (*ls.ptr++ & 255) : -1;
+		}
+		inline int peekChar() const
+		{
+			return ls.ptr < ls.top ? (*ls.ptr & 255) : -1;
+		}
+	};
 public:
 	FilterPgn();
+	~FilterPgn();
+
+	// worker threads
+	int threads = 1;
+	// input chunk size (chunks are cut at game boundaries)
+	size_t chunkSize = 16*1024*1024;
+	// maximum dedup set size in MB (bloom filter if an exact set wouldn't fit)
+	size_t dedupMB = 1024;
 
 	bool parse(const char *fname, bool extractlines = false);
 	bool write(const char *fname);
@@ -64,31 +120,16 @@ public:
 	bool writeLines(const char *fname);
 
 private:
-	LexState ls;
-	Game game;
 	Game globalGame;
-	std::unordered_set<Signature> globalDups;
+	SigSet globalDups;
 
-	TransTable tt;
-	Search s;
+	std::vector<Parser *> parsers;
 
 	std::vector<std::string> lines;
-	std::string currentLine;
 	bool extractLines = false;
 
-	bool parseTag(std::string &key, std::string &value );
-	bool parseString(std::string &str);
-	bool parseComment(std::string &str);
-	void flushGame();
-
-	inline int getChar()
-	{
-		return ls.ptr < ls.top ? (*ls.ptr++ & 255) : -1;
-	}
-	inline int peekChar() const
-	{
-		return ls.ptr < ls.top ? (*ls.ptr & 255) : -1;
-	}
+	// read next chunk (whole games) into buf, keeping the rest in carry
+	bool readChunk(std::ifstream &ifs, std::vector<char> &buf, std::vector<char> &carry);
 };
 
 }
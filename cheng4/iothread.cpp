@@ -0,0 +1,139 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "iothread.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace cheng4
+{
+
+// OutputThread
+
+OutputThread::OutputThread() : head(nullptr), pushed(0), written(0), sleeping(0)
+{
+}
+
+void OutputThread::destroy()
+{
+	shouldTerminate = 1;
+	wakeEvent.signal();
+}
+
+void OutputThread::push( const char *line, size_t size )
+{
+	Node *n = static_cast<Node *>(malloc( offsetof(Node, text) + size + 1 ));
+	if ( !n )
+		abort();
+
+	memcpy( n->text, line, size );
+	n->text[size] = '\n';
+	n->size = size + 1;
+
+	pushed++;
+
+	n->next = head.load( std::memory_order_relaxed );
+	while ( !head.compare_exchange_weak( n->next, n ) )
+		;
+
+	// only bother the kernel if the writer is actually waiting
+	if ( sleeping.exchange( 0 ) )
+		wakeEvent.signal();
+}
+
+void OutputThread::flush()
+{
+	u64 target = pushed;
+
+	while ( written < target )
+		writtenEvent.wait( 10 );
+}
+
+bool OutputThread::writePending()
+{
+	Node *n = head.exchange( nullptr );
+
+	if ( !n )
+		return 0;
+
+	// reverse to restore push order
+	Node *fifo = 0;
+	u64 count = 0;
+
+	while ( n )
+	{
+		Node *next = n->next;
+		n->next = fifo;
+		fifo = n;
+		n = next;
+		count++;
+	}
+
+	batch.clear();
+
+	while ( fifo )
+	{
+		Node *next = fifo->next;
+		batch.append( fifo->text, fifo->size );
+		free( fifo );
+		fifo = next;
+	}
+
+	// stdout is unbuffered so this results in a single write
+	fwrite( batch.data(), 1, batch.size(), stdout );
+	fflush( stdout );
+
+	written += count;
+	writtenEvent.signal();
+	return 1;
+}
+
+void OutputThread::work()
+{
+	for (;;)
+	{
+		if ( writePending() )
+			continue;
+
+		if ( shouldTerminate )
+			break;
+
+		sleeping = 1;
+
+		// recheck, a producer may have pushed before seeing the flag
+		if ( head.load() || shouldTerminate )
+		{
+			sleeping = 0;
+			continue;
+		}
+
+		wakeEvent.wait();
+		sleeping = 0;
+	}
+}
+
+}
@@ -0,0 +1,70 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include "thread.h"
+#include <string>
+#include <atomic>
+
+namespace cheng4
+{
+
+// asynchronous stdout writer
+// producers push complete lines into a lock-free queue, writer thread batches them into a single write
+class OutputThread : public Thread
+{
+	// allocated as a single block with text following
+	struct Node
+	{
+		Node *next;
+		size_t size;
+		char text[1];
+	};
+
+	std::atomic<Node *> head;			// pending messages (newest first)
+	std::atomic<u64> pushed;			// number of messages pushed
+	std::atomic<u64> written;			// number of messages written
+	std::atomic<bool> sleeping;			// writer is waiting for messages
+	Event wakeEvent;					// set when messages are pending
+	Event writtenEvent;					// set after each batch is written
+	std::string batch;					// batch buffer (writer thread only)
+
+	// write all pending messages in one go
+	// returns 0 if there was nothing to write
+	bool writePending();
+public:
+	OutputThread();
+	void destroy();
+
+	// queue line for output (newline is appended), can be called from any thread
+	void push( const char *line, size_t size );
+
+	// wait until everything pushed so far has been written
+	void flush();
+
+	void work();
+};
+
+}
@@ -25,128 +25,140 @@ or as public domain (where applicable)
 #include "search.h"
 #include "utils.h"
 #include "thread.h"
+#include "trainfile.h"
+#include "sigset.h"
 
 #include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <string>
 
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 namespace cheng4
 {
 
-bool LabelFEN::load(const char *filename)
+// reorder buffer entry
+struct LFSlot
 {
-	if ( *filename == 32 )
-		filename++;
-
-	boards.clear();
-	outcomes.clear();
-	std::cout << "loading " << filename << std::endl;
-
-	std::ifstream ifs( filename, std::ios::in | std::ios::binary );
-
-	if (!ifs.is_open())
-		return false;
-
-	ifs.seekg(0, std::ios_base::end);
-	std::streampos size = ifs.tellg();
-	ifs.seekg(0);
-	size_t sz = (size_t)size;
-	std::vector<char> buf;
-	buf.resize(sz+1);
-	ifs.read( buf.data(), sz );
-
-	if (sz < buf.size())
-		buf[sz] = 0;
-
-	const char *ptr = buf.data();
-	const char *top = &buf[sz];
-
-	Board b;
-	b.reset();
-
-	size_t checks = 0;
-
-	while (ptr < top)
-	{
-		skipSpaces(ptr);
-		// "parse" game outcome
-
-		char *end = (char *)ptr;
-		double outcome = strtod(ptr, &end);
-		ptr = end;
-
-		skipSpaces(ptr);
-		ptr = b.fromFEN(ptr);
-
-		if (!ptr)
-			return false;
-
-		b.resetFifty();
-
-		skipUntilEOL(ptr);
-
-		if (b.inCheck())
-		{
-			checks++;
-			continue;
-		}
+	Board board;
+	float outcome;
+	Score label;
+	bool done;
+};
 
-		boards.push_back(b);
-		outcomes.push_back(outcome);
-	}
+// positions flow through a ring of slots:
+// [written, claimed) are being labeled, [claimed, produced) wait for a worker
+// the reader fills slots up to written + window and writes finished slots in order
+struct LFQueue
+{
+	std::mutex mutex;
+	std::condition_variable workCv;
+	std::condition_variable doneCv;
 
-	std::cout << boards.size() << " positions loaded" << std::endl;
-	std::cout << checks << " positions ignored (in check)" << std::endl;
+	LFSlot *slots = nullptr;
+	size_t window = 0;
 
-	return true;
-}
+	size_t produced = 0;
+	size_t claimed = 0;
+	bool eof = false;
+};
 
 class LFWorker : public Thread
 {
 public:
-	std::atomic_int *counter = nullptr;
+	LFQueue *queue = nullptr;
 	Search *s = nullptr;
-	LabelFEN *lfen;
+	LabelFEN *lfen = nullptr;
 
 	void work() override
 	{
-		auto limit = lfen->boards.size();
-
 		for (;;)
 		{
-			auto cur = ++*counter - 1;
+			size_t i;
 
-			if ((size_t)cur >= limit)
-				break;
+			{
+				std::unique_lock<std::mutex> lock(queue->mutex);
+
+				while (queue->claimed >= queue->produced && !queue->eof)
+					queue->workCv.wait(lock);
 
-			size_t i = cur;
+				if (queue->claimed >= queue->produced)
+					break;
 
-			if (!(i & 1023))
-				std::cout << i << " / " << lfen->boards.size() << std::endl;
+				i = queue->claimed++;
+			}
+
+			LFSlot &slot = queue->slots[i % queue->window];
 
 			s->rep.clear();
-			s->board = lfen->boards[i];
+			s->board = slot.board;
 
 			s->clearHash();
 			s->rep.push(s->board.sig(), true);
 			SearchMode sm;
 			sm.reset();
-			sm.maxDepth = 6;
-			Score sc = s->iterate(lfen->boards[i], sm);
-
-			lfen->labels[i] = sc;
+			// always limit depth: an analyzing search would wait for stop
+			sm.maxDepth = lfen->depth ? lfen->depth : (Depth)maxDepth;
+			sm.maxNodes = lfen->nodes;
+			Score sc = s->iterate(slot.board, sm);
+
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			slot.label = sc;
+			slot.done = true;
+			queue->doneCv.notify_one();
 		}
 	}
 };
 
-bool LabelFEN::process(const char *outfilename)
+bool LabelFEN::process(const char *filename, const char *outfilename)
 {
-	labels.resize(boards.size());
+	if ( *filename == 32 )
+		filename++;
 
-	const int numThreads = 16;
+	std::cout << "labeling " << filename << std::endl;
+
+	std::ifstream ifs( filename, std::ios::in | std::ios::binary );
+
+	if (!ifs.is_open())
+		return false;
+
+	ifs.seekg(0, std::ios_base::end);
+	size_t sz = (size_t)ifs.tellg();
+	ifs.seekg(0);
+
+	// dedup: typical fen lines take well over 32 bytes
+	SigSet dups;
+
+	if (!dedupFile.empty() && std::ifstream(dedupFile.c_str()).good())
+	{
+		// continue previous runs
+		if (!dups.load(dedupFile.c_str()) || !dups.grow(sz/32, dedupMB << 20))
+			return false;
+
+		std::cout << "dedup: " << dups.count() << " signatures loaded from " << dedupFile << std::endl;
+	}
+	else if (!dups.initFor(sz/32, dedupMB << 20))
+		return false;
+
+	TrainWriter fo;
+
+	if (!(rawOutput ? fo.openRaw(outfilename) : fo.open(outfilename)))
+		return false;
+
+	const int numThreads = std::max(1, threads);
+
+	if (!depth && !nodes)
+		depth = 6;
+
+	std::cout << "labelfen: " << numThreads << " threads, depth " << (int)depth << ", nodes " << nodes << std::endl;
+
+	LFQueue queue;
+	queue.window = std::max<size_t>(window, 2*numThreads);
+	queue.slots = new LFSlot[queue.window];
 
 	std::vector<TransTable *> tt;
 	tt.resize(numThreads);
@@ -154,8 +166,7 @@ bool LabelFEN::process(const char *outfilename)
 	for (auto &it : tt)
 	{
 		it = new TransTable;
-		// 1 MB
-		it->resize( 1*1024*1024 );
+		it->resize( (size_t)std::max(1u, hashMB)*1024*1024 );
 	}
 
 	std::vector<Search *> s;
@@ -171,84 +182,208 @@ bool LabelFEN::process(const char *outfilename)
 	std::vector<LFWorker *> w;
 	w.resize(numThreads);
 
-	std::atomic_int counter(0);
-
-	for (size_t i=0; i<numThreads; i++)
+	for (size_t i=0; i<(size_t)numThreads; i++)
 	{
 		auto *lfw = new LFWorker;
 		lfw->s = s[i];
 		lfw->lfen = this;
-		lfw->counter = &counter;
+		lfw->queue = &queue;
 		w[i] = lfw;
 	}
 
 	for (auto *it : w)
 		it->run();
 
-	for (auto *it : w)
-		it->kill();
+	std::string line;
+	Board b;
+	b.reset();
 
-	for (auto *it : tt)
-		delete it;
+	// reader-local copies, published under lock
+	size_t produced = 0;
+	size_t written = 0;
+	bool eof = false;
+	bool ok = true;
 
-	for (auto *it : s)
-		delete it;
+	size_t checks = 0;
+	size_t outcount = 0;
+	i32 startTicks = Timer::getMillisec();
 
-	FILE *fo = fopen(outfilename, "wb");
+	while (ok)
+	{
+		// parse input into free slots
+		size_t published = produced;
 
-	if (!fo)
-		return false;
+		while (!eof && produced - written < queue.window)
+		{
+			if (!std::getline(ifs, line))
+			{
+				eof = true;
+				break;
+			}
 
-	size_t outcount = 0;
+			const char *ptr = line.c_str();
+			skipSpaces(ptr);
 
-	for (size_t i=0; i<boards.size(); i++)
-	{
-		if (abs(labels[i]) > 1600)
-			continue;
+			if (!*ptr)
+				continue;
+
+			// "parse" game outcome
+			char *end = (char *)ptr;
+			double outcome = strtod(ptr, &end);
+			ptr = end;
+
+			skipSpaces(ptr);
 
-		i16 tmp = (i16)labels[i];
-		fwrite(&tmp, 2, 1, fo);
+			if (!b.fromFEN(ptr))
+			{
+				std::cout << "invalid fen: " << line << std::endl;
+				ok = false;
+				break;
+			}
+
+			b.resetFifty();
+
+			if (b.inCheck())
+			{
+				checks++;
+				continue;
+			}
 
-		i8 tmpi = i8(outcomes[i]*2);
-		fwrite(&tmpi, 1, 1, fo);
+			if (!dups.insert(b.sig()))
+				continue;
 
-		tmpi = boards[i].turn() == ctBlack ? 1 : 0;
-		fwrite(&tmpi, 1, 1, fo);
+			LFSlot &slot = queue.slots[produced % queue.window];
+			slot.board = b;
+			slot.outcome = (float)outcome;
+			slot.done = false;
+			++produced;
+
+			// feed workers early
+			if (produced - published >= 256)
+				break;
+		}
+
+		if (!ok)
+			break;
+
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.produced = produced;
+			queue.eof = eof;
+		}
+
+		queue.workCv.notify_all();
+
+		// write finished positions in input order
+		bool progress = false;
+
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(queue.mutex);
+
+			if (written >= produced)
+				break;
 
-		// compress the board
-		uint8_t buf[16];
-		uint64_t occ = boards[i].compressPiecesOccupancy(buf);
+			LFSlot &slot = queue.slots[written % queue.window];
+
+			if (!slot.done)
+			{
+				// only block if there's nothing else to do
+				if (progress || (!eof && produced - written < queue.window))
+					break;
+
+				queue.doneCv.wait(lock);
+				continue;
+			}
+
+			lock.unlock();
+
+			progress = true;
+			++written;
+
+			if (!(written & 65535))
+			{
+				double secs = std::max(1, Timer::getMillisec() - startTicks) / 1000.0;
+				std::cout << written << " positions labeled, " << (int64_t)(written / secs) << " pos/s" << std::endl;
+			}
+
+			if (abs(slot.label) > 1600)
+				continue;
 
 #ifdef _DEBUG
-		Board tmpb;
-		tmpb.uncompressPiecesOccupancy(occ, buf);
-		tmpb.setTurn(Color(tmp ? ctBlack : ctWhite));
+			// compress the board
+			uint8_t buf[16];
+			uint64_t occ = slot.board.compressPiecesOccupancy(buf);
+
+			Board tmpb;
+			tmpb.uncompressPiecesOccupancy(occ, buf);
+			tmpb.setTurn(slot.board.turn());
 
-		i32 inds0[64];
-		auto count0 = boards[i].netIndices(inds0);
-		std::sort(inds0, inds0+count0);
+			i32 inds0[64];
+			auto count0 = slot.board.netIndices(inds0);
+			std::sort(inds0, inds0+count0);
 
-		i32 inds1[64];
-		auto count1 = tmpb.netIndices(inds1);
-		std::sort(inds1, inds1+count1);
+			i32 inds1[64];
+			auto count1 = tmpb.netIndices(inds1);
+			std::sort(inds1, inds1+count1);
 
-		assert(count0 == count1);
-		for (int ix=0; ix<count0; ix++)
-			assert(inds0[ix] == inds1[ix]);
+			assert(count0 == count1);
+			for (int ix=0; ix<count0; ix++)
+				assert(inds0[ix] == inds1[ix]);
 #endif
 
-		fwrite(&occ, 8, 1, fo);
-		fwrite(buf, 1, 16, fo);
+			if (!fo.add(slot.label, slot.outcome, slot.board))
+			{
+				ok = false;
+				break;
+			}
 
-		++outcount;
+			++outcount;
+		}
+
+		if (eof && written >= produced)
+			break;
+	}
+
+	// let workers drain and stop
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.eof = true;
+
+		if (!ok)
+			queue.produced = queue.claimed;
 	}
 
-	fclose(fo);
+	queue.workCv.notify_all();
+
+	for (auto *it : w)
+		it->kill();
 
+	for (auto *it : tt)
+		delete it;
+
+	for (auto *it : s)
+		delete it;
+
+	delete[] queue.slots;
+
+	if (!fo.close() || !ok)
+		return false;
+
+	std::cout << written << " positions labeled" << std::endl;
+	std::cout << checks << " positions ignored (in check)" << std::endl;
+	dups.report("dedup: ");
+
+	if (!dedupFile.empty())
+	{
+		if (!dups.save(dedupFile.c_str()))
+			return false;
+
+		std::cout << "dedup: " << dups.count() << " signatures saved to " << dedupFile << std::endl;
+	}
 	std::cout << outcount << " total positions output" << std::endl;
 
 	return true;
 }
 
-
 }
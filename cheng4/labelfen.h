@@ -24,19 +24,32 @@ or as public domain (where applicable)
 #pragma once
 
 #include "board.h"
-#include <vector>
+#include <string>
 
 namespace cheng4
 {
 
 struct LabelFEN
 {
-	std::vector<Board> boards;
-	std::vector<double> outcomes;
-	std::vector<Score> labels;
-
-	bool load(const char *filename);
-	bool process(const char *outfilename);
+	// parameters
+	int threads = 16;
+	// search limits per position (0 = none)
+	Depth depth = 6;
+	NodeCount nodes = 0;
+	// hash per worker in MB
+	uint hashMB = 1;
+	// positions in flight (reorder buffer size); bounds memory use
+	size_t window = 65536;
+	// maximum dedup set size in MB (bloom filter if an exact set wouldn't fit)
+	size_t dedupMB = 1024;
+	// if not empty, dedup set is loaded from (if present) and saved to this file => dedup across runs
+	std::string dedupFile;
+	// write plain packed records instead of a training data container
+	bool rawOutput = false;
+
+	// label positions (one "outcome fen" per line), streaming input
+	// output is written incrementally in input order
+	bool process(const char *filename, const char *outfilename);
 };
 
 }
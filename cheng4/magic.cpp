@@ -283,6 +283,7 @@ u8 Magic::rookShr[64];
 u8 Magic::bishopShr[64];
 const Bitboard *Magic::rookPtr[64];
 const Bitboard *Magic::bishopPtr[64];
+Bitboard *Magic::attackTable = 0;
 
 const Bitboard Magic::rookMagic[64] = {
 	U64C(0x80001820804000),
@@ -418,20 +419,6 @@ const Bitboard Magic::bishopMagic[64] = {
 	U64C(0x284100220540484)
 };
 
-static Bitboard indexToU64( int index, int bits, u64 m )
-{
-	Bitboard result = 0;
-	for (int i = 0; i < bits; i++)
-	{
-		int j = m ? BitOp::getLSB( m ) : -1;
-		if ( j < 0 )
-			break;
-		if (index & (1 << i)) result |= BitOp::oneShl( (Square)j );
-		m &= BitOp::noneShl( (Square)j );
-	}
-	return result;
-}
-
 static u64 ratt(int sq, u64 block)
 {
 	u64 result = 0ULL;
@@ -478,29 +465,25 @@ static u64 batt(int sq, u64 block)
 	return result;
 }
 
-u32 Magic::initMagicPtrs( Square sq, bool bishop )
+u32 Magic::initMagicPtrs( Square sq, bool bishop, Bitboard *a )
 {
-	i32 i, n;
 	const u64 &mask = bishop ? bishopRelOcc[sq] : rookRelOcc[sq];
-	n = BitOp::popCount(mask);
-
-	// max 12 bits!
-	Bitboard *b = new Bitboard[ 4096 ];
-	Bitboard *a = new Bitboard[ (size_t)1u << n ];
-
-	memset( a, 0, ((size_t)1u << n) * sizeof(Bitboard) );
-
-	for (i = 0; i < (i32)(1 << n); i++) {
-		b[i] = indexToU64(i, n, mask);
+	u32 n = BitOp::popCount(mask);
 
+	// enumerate all subsets of mask (carry-rippler)
+	Bitboard occ = 0;
+	do
+	{
 		i32 j;
 		if ( bishop )
-			j = (i32)((b[i] * bishopMagic[sq]) >> bishopShr[sq]);
+			j = (i32)((occ * bishopMagic[sq]) >> bishopShr[sq]);
 		else
-			j = (i32)((b[i] * rookMagic[sq]) >> rookShr[sq]);
+			j = (i32)((occ * rookMagic[sq]) >> rookShr[sq]);
+
+		a[j] = bishop ? batt(sq, occ) : ratt(sq, occ);
+		occ = (occ - mask) & mask;
+	} while ( occ );
 
-		a[j] = bishop ? batt(sq, b[i]) : ratt(sq, b[i]);
-	}
 	if ( bishop )
 	{
 		bishopPtr[ sq ] = a;
@@ -509,8 +492,7 @@ u32 Magic::initMagicPtrs( Square sq, bool bishop )
 	{
 		rookPtr[ sq ] = a;
 	}
-	delete[] b;
-	return 8 * (1<<n);
+	return 1u << n;
 }
 
 void Magic::init()
@@ -551,18 +533,23 @@ void Magic::init()
 		bishopShr[ i ] = (u8)(64-BitOp::popCount(msk));
 	}
 
+	// all attack tables in one block
+	size_t total = 0;
+	for (Square i=0; i<64; i++)
+		total += ((size_t)1 << BitOp::popCount(rookRelOcc[i])) + ((size_t)1 << BitOp::popCount(bishopRelOcc[i]));
+
+	attackTable = new Bitboard[ total ]();
+	Bitboard *a = attackTable;
+
 	for (Square i=0; i<64; i++)
 		for (uint j=0; j<2; j++)
-			initMagicPtrs( i, j ? 1 : 0 );
+			a += initMagicPtrs( i, j ? 1 : 0, a );
 }
 
 void Magic::done()
 {
-	for (Square i=0; i<64; i++)
-	{
-		delete[] bishopPtr[i];
-		delete[] rookPtr[i];
-	}
+	delete[] attackTable;
+	attackTable = 0;
 }
 
 }
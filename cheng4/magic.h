@@ -33,7 +33,8 @@ namespace cheng4
 class Magic
 {
 protected:
-	static u32 initMagicPtrs( Square sq, bool bishop );
+	// fills attack table for sq at a, returns number of entries used
+	static u32 initMagicPtrs( Square sq, bool bishop, Bitboard *a );
 	// rook/bishop relevant occupancy masks
 	static Bitboard rookRelOcc[64];
 	static Bitboard bishopRelOcc[64];
@@ -43,6 +44,8 @@ protected:
 	// rook/bishop magic pointers
 	static const Bitboard *rookPtr[64];
 	static const Bitboard *bishopPtr[64];
+	// rook/bishop attack tables (single allocation)
+	static Bitboard *attackTable;
 	// rook/bishop magic multipliers
 	static const Bitboard rookMagic[64];
 	static const Bitboard bishopMagic[64];
@@ -24,6 +24,7 @@ or as public domain (where applicable)
 #include "engine.h"
 #include "protocol.h"
 #include "utils.h"
+#include "iothread.h"
 #include <cstring>
 
 int main( int argc, char **argv )
@@ -31,11 +32,33 @@ int main( int argc, char **argv )
 	// disable I/O buffering
 	cheng4::disableIOBuffering();
 
+	// --startup-bench: report startup timings and quit
+	for (int i=1; i<argc; i++)
+		if (strcmp(argv[i], "--startup-bench") == 0)
+			cheng4::Engine::startupBench = 1;
+
 	// static init
 	cheng4::Engine::init( argc-1, const_cast<const char **>(argv)+1 );
 
 	cheng4::Engine *eng = new cheng4::Engine;
+	cheng4::Engine::startupStep( "Engine" );
 	cheng4::Protocol *proto = new cheng4::Protocol( *eng );
+	cheng4::Engine::startupStep( "Protocol" );
+
+	if ( cheng4::Engine::startupBench )
+	{
+		eng->run();
+		cheng4::Engine::startupStep( "Engine::run" );
+		delete proto;
+		delete eng;
+		cheng4::Engine::done();
+		return 0;
+	}
+
+	// search output goes through writer thread so that search never blocks on stdout
+	cheng4::OutputThread *output = new cheng4::OutputThread;
+	output->run();
+	proto->setOutput( output );
 
 	eng->run();
 
@@ -54,6 +77,9 @@ int main( int argc, char **argv )
 	delete proto;
 	delete eng;
 
+	// write whatever is still pending
+	output->kill();
+
 	cheng4::Engine::done();
 	return 0;
 }
@@ -0,0 +1,139 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "mapfile.h"
+
+#ifdef _WIN32
+#	include <windows.h>
+#	undef min
+#	undef max
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+namespace cheng4
+{
+
+// MappedFile
+
+MappedFile::MappedFile() : mapped(0), mappedSize(0)
+{
+	handles[0] = handles[1] = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open( const char *fname )
+{
+	close();
+
+	void *res = 0;
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA( fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if ( handle == INVALID_HANDLE_VALUE )
+		return 0;
+
+	handles[0] = handle;
+
+	DWORD szhi = 0;
+	DWORD szlo = GetFileSize( handle, &szhi );
+	u64 fsize = (u64)szlo + ((u64)szhi << 32);
+
+	if ( !fsize || fsize != (size_t)fsize )
+	{
+		close();
+		return 0;
+	}
+
+	HANDLE mapping = CreateFileMappingA( handle, NULL, PAGE_READONLY, 0, 0, NULL );
+	handles[1] = mapping;
+
+	if ( mapping )
+		res = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+
+	if ( !res )
+	{
+		close();
+		return 0;
+	}
+
+	mappedSize = (size_t)fsize;
+#else
+	int fd = ::open( fname, O_RDONLY );
+
+	if ( fd < 0 )
+		return 0;
+
+	struct stat st;
+
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+	{
+		res = mmap( 0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+		if ( res == MAP_FAILED )
+			res = 0;
+		else
+			mappedSize = (size_t)st.st_size;
+	}
+
+	// mapping stays valid after close
+	::close( fd );
+
+	if ( !res )
+		return 0;
+#endif
+
+	mapped = static_cast<const u8 *>( res );
+	return 1;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if ( mapped )
+		UnmapViewOfFile( mapped );
+
+	if ( handles[1] )
+		CloseHandle( handles[1] );
+	if ( handles[0] )
+		CloseHandle( handles[0] );
+#else
+	if ( mapped )
+		munmap( const_cast<u8 *>( mapped ), mappedSize );
+#endif
+
+	mapped = 0;
+	mappedSize = 0;
+	handles[0] = handles[1] = 0;
+}
+
+}
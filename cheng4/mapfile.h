@@ -0,0 +1,60 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include "types.h"
+
+namespace cheng4
+{
+
+// read-only memory mapped file
+class MappedFile
+{
+	MappedFile( const MappedFile & );
+	MappedFile &operator =( const MappedFile & );
+protected:
+	const u8 *mapped;
+	size_t mappedSize;
+	void *handles[2];			// OS-specific handles
+public:
+	MappedFile();
+	~MappedFile();
+
+	// returns 1 on success; empty files fail
+	bool open( const char *fname );
+	void close();
+
+	inline const u8 *data() const
+	{
+		return mapped;
+	}
+
+	inline size_t size() const
+	{
+		return mappedSize;
+	}
+};
+
+}
@@ -144,6 +144,7 @@ MoveGen::MoveGen( const Board &b_ )
 	, killer(nullptr)
 	, histCtx(nullptr)
 	, history(nullptr)
+	, attacks(nullptr)
 	, genMoveCount(0)
 	, nextMove(mcNone)
 	, previous(mcNull)
@@ -153,12 +154,14 @@ MoveGen::MoveGen( const Board &b_ )
 	phPtr = board.inCheck() ? phaseEvasLegal : (board.canCastle() ? phaseNormalLegal : phaseNormalNoCastlingLegal );
 }
 
-MoveGen::MoveGen(const Board &b_, const Killer &killer_, const ContextSignature *histCtx_, const History &history_, uint mode_)
+MoveGen::MoveGen(const Board &b_, const Killer &killer_, const ContextSignature *histCtx_, const History &history_, uint mode_,
+	const AttackMap *attacks_)
 	: mode(mode_)
 	, board(b_)
 	, killer(&killer_)
 	, histCtx(histCtx_)
 	, history(&history_)
+	, attacks(attacks_)
 	, genMoveCount(0)
 	, nextMove(mcNone)
 	, previous(history_.previous)
@@ -273,7 +276,7 @@ loop:
 	case mpQHash:
 		res = killer->hashMove;
 		phPtr++;
-		if ( !res || !(board.inCheck() ? board.isLegal<1,0>( res, pins() ) : board.see<1>(res) >= 0 && board.isLegal<0,0>( res, pins() ) ) )
+		if ( !res || !(board.inCheck() ? board.isLegal<1,0>( res, pins() ) : board.seeGE( res, 0, attacks ) && board.isLegal<0,0>( res, pins() ) ) )
 			goto loop;
 
 		genMoves[ genMoveCount++ ] = res;
@@ -347,7 +350,7 @@ loopcap:
 
 			const Piece promo = MovePack::promo(res);
 
-			if ( (promo && promo != ptQueen && promo != ptKnight) || board.see<1>(res) < 0 )
+			if ( (promo && promo != ptQueen && promo != ptKnight) || !board.seeGE( res, 0, attacks ) )
 			{
 				// bad capture detected
 				assert( badCapCount < maxCaptures );
@@ -372,7 +375,7 @@ qloopcap:
 				goto qloopcap;
 
 			// do fast(sign) see
-			if ( board.see<1>( res ) < 0 )
+			if ( !board.seeGE( res, 0, attacks ) )
 				// bad capture detected
 				goto qloopcap;
 		} while( !board.pseudoIsLegal<0>( res, pin ) );
@@ -453,7 +456,7 @@ checksloop:
 				goto checksloop;
 			if ( MovePack::isCastling(res) )
 				break;
-			if ( board.see<1>( res ) < 0 )
+			if ( !board.seeGE( res, 0, attacks ) )
 				goto checksloop;						// skip bad see checks
 		} while ( !board.pseudoIsLegal<0>( res, pin ) );
 		assert( board.isCheck( res, dcMask ) );
@@ -502,12 +505,15 @@ void MoveGen::scoreCaptures()
 
 void MoveGen::scoreEvasions()
 {
+	bool good[ maxMoves ];
+	board.seeGEBatch( moveBuf, (int)count, 0, good, attacks );
+
 	Move *mp = moveBuf;
 	const Move *me = moveBuf + count;
-	for ( ;mp < me; mp++ )
+	for ( const bool *gp = good; mp < me; mp++, gp++ )
 	{
 		assert( !(*mp & mmScore) );
-		if ( board.see<1>(*mp) >= 0 )
+		if ( *gp )
 		{
 			if ( MovePack::isCapture(*mp) )
 			{
@@ -562,6 +568,7 @@ MoveGen::MoveGen( const MoveGen & )
 	, killer(nullptr)
 	, histCtx(nullptr)
 	, history(nullptr)
+	, attacks(nullptr)
 {
 	assert( 0 && "illegal copying of MoveGen class!" );
 }
@@ -633,6 +633,7 @@ protected:
 	const Killer * const killer;	// killer ref (includes hashmove)
 	const ContextSignature * const histCtx;	// history ctx signature
 	const History * const history;	// history ref
+	const AttackMap * const attacks;	// optional attack map (used by see)
 	Bitboard dcMask;				// discovered checkers
 	Bitboard pin;					// pins
 	const uint *phPtr;				// phase ptr
@@ -657,7 +658,8 @@ protected:
 	bool alreadyGenerated( Move m );
 
 public:
-	MoveGen( const Board &b, const Killer &killer, const ContextSignature *histCtx, const History &history, uint mode = mmNormal );
+	MoveGen( const Board &b, const Killer &killer, const ContextSignature *histCtx, const History &history, uint mode = mmNormal,
+		const AttackMap *attacks = nullptr );
 	// legal only version
 	MoveGen( const Board &b );
 
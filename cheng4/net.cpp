@@ -24,9 +24,20 @@ or as public domain (where applicable)
 #include "net.h"
 #include "types.h"
 #include "platform.h"
+#include "mapfile.h"
+#include "utils.h"
 #include <vector>
 #include <fstream>
 #include <algorithm>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#	include <sys/mman.h>
+#endif
 
 #define MLZ_DEC_MINI_IMPLEMENTATION
 #include "nets/mlz/mlz_dec_mini.h"
@@ -34,117 +45,223 @@ or as public domain (where applicable)
 namespace cheng4
 {
 
-static constexpr int MAX_LAYER_SIZE = 768 > topo1in ? 768 : topo1in;
+#include "nets/net_embed.h"
 
-void Network::cache_init(const i32 *nonzero, int nzcount, NetCache &cache)
+void Network::cache_init(const i32 *nonzero, int nzcount, NetCache &cache) const
 {
-	layers[0]->cache_init(nonzero, nzcount, cache);
+	model->cache_init(nonzero, nzcount, cache);
 }
 
-void Network::forward_cache(const NetCache & CHENG_PTR_NOALIAS cache, const NetCache & CHENG_PTR_NOALIAS cacheOpp, fixedp * CHENG_PTR_NOALIAS outp, int outpsize)
+fixedp Network::forward_cache(const NetCache & CHENG_PTR_NOALIAS cache, const NetCache & CHENG_PTR_NOALIAS cacheOpp, int bucket) const
 {
-	assert(outpsize >= layers[layers.size()-1]->getOutputSize());
-	(void)outpsize;
-	assert(outpsize >= layers[layers.size()-1]->getOutputSize());
+	assert(bucket >= 0 && bucket < (int)arch.outputs);
 
-	wfixedp temp[MAX_LAYER_SIZE];
+	return model->forward_cache(cache, cacheOpp, bucket);
+}
 
-	// now manually unpacked
-	layer0.forward_cache(cache, temp);
-	layer0.forward_cache(cacheOpp, temp + topo1);
+void Network::cache_add_index(NetCache &cache, i32 index) const
+{
+	model->cache_add_index(cache, index);
+}
 
-	layer1.forward(temp, outp);
+void Network::cache_sub_index(NetCache &cache, i32 index) const
+{
+	model->cache_sub_index(cache, index);
 }
 
-void Network::cache_add_index(NetCache &cache, i32 index)
+template<int inputs, int outputs>
+static NetModelBase *createModelShape(const NetArch &narch)
 {
-	layer0.cache_add_index(cache, index);
+	// supported shapes: bullet, default, analysis
+	if (!narch.hidden2)
+	{
+		switch(narch.hidden1)
+		{
+		case 256:
+			return new NetModel2<inputs, 256, outputs>;
+		case topo1:
+			return new NetModel2<inputs, topo1, outputs>;
+		case 1024:
+			return new NetModel2<inputs, 1024, outputs>;
+		}
+	}
+	else if (narch.hidden1 == 512 && narch.hidden2 == 32)
+		return new NetModel3<inputs, 512, 32, outputs>;
+
+	return nullptr;
 }
 
-void Network::cache_sub_index(NetCache &cache, i32 index)
+NetModelBase *Network::create_model(const NetArch &narch)
 {
-	layer0.cache_sub_index(cache, index);
+	if (narch.features > nfKingBuckets || narch.inputs != topo0 * narch.kingBuckets() || narch.shift != fixedp_shift)
+		return nullptr;
+
+	const bool buckets = narch.features == nfKingBuckets;
+
+	if (narch.outputs == 1)
+		return buckets ? createModelShape<topo0*nkbCount, 1>(narch) : createModelShape<topo0, 1>(narch);
+
+	if (narch.outputs == nobCount)
+		return buckets ? createModelShape<topo0*nkbCount, nobCount>(narch) : createModelShape<topo0, nobCount>(narch);
+
+	return nullptr;
 }
 
-bool Network::init_topology()
+bool Network::init_topology(const NetArch &narch)
 {
-	const int numLayouts = topoLayers;
-	(void)numLayouts;
+	free_weights();
+	delete model;
 
-	layers.resize(topoLayers);
-	layers[0] = &layer0;
-	layers[1] = &layer1;
+	arch = narch;
+	model = create_model(arch);
 
-	int total = 0;
-	int total_nobias = 0;
+	if (!model)
+		return false;
 
-	for (int i=0; i<topoLayers; i++)
-	{
-		int insize = layers[i]->getInputSize();
-		int outsize = layers[i]->getOutputSize();
-		total += (insize+1) * outsize;
-		total_nobias += insize * outsize;
-	}
+	assert(arch.hidden1 <= topo1Max);
+
+	int total = arch.weightCount();
+	int total_nobias = total - (int)(arch.hidden1 + (arch.hidden2 ? arch.hidden2 : 0) + arch.outputs);
 
 	weight_size = total;
 
 	//"total=%d nobias=%d\n", total, total_nobias;
 	bias_index = total_nobias;
 
-	weights.resize(total + 64/sizeof(wfixedp));
-
-	// align to cacheline
-	auto ptr = (uintptr_t)weights.data();
-	auto aptr = ptr;
-	aptr = (aptr + 63) & ~(uintptr_t)63;
-
-	weight_index = int((aptr - ptr)/sizeof(wfixedp));
+	size_t bytes = total * sizeof(wfixedp);
 
-	//printf("aligned_weight_index = %d\n", weight_index);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	// transparent huge pages need 2M alignment
+	const size_t hugePage = 2*1024*1024;
+	size_t hugeBytes = (bytes + 64 + hugePage-1) & ~(hugePage-1);
 
-	bias_index += weight_index;
+	if (posix_memalign(&weights_mem, hugePage, hugeBytes) == 0)
+		madvise(weights_mem, hugeBytes, MADV_HUGEPAGE);
+	else
+		weights_mem = nullptr;
+#endif
 
-	int widx = weight_index;
-	int bidx = bias_index;
+	if (!weights_mem)
+	{
+		// align to cacheline; extra space is decompression reserve
+		weights_mem = malloc(bytes + 64 + 64);
 
-	assert(topoLayers == numLayouts);
+		if (!weights_mem)
+			return false;
+	}
 
-	for (int i=0; i<topoLayers; i++)
-	{
-		auto *nlayer = layers[i];
+	auto aptr = ((uintptr_t)weights_mem + 63) & ~(uintptr_t)63;
+	weights = (wfixedp *)aptr;
+	memset(weights, 0, bytes);
 
-		nlayer->init(weights.data() + widx, weights.data() + bidx);
+	weight_index = 0;
 
-		widx += nlayer->getInputSize() * nlayer->getOutputSize();
-		bidx += nlayer->getOutputSize();
-	}
+	model->init(weights + weight_index, weights + weight_index + bias_index);
 
 	return true;
 }
 
 void Network::transpose_weights()
 {
-	for (size_t i=0; i<layers.size();
-#if !NET_TRANSPOSE_LAYER0_ONLY
-		i++
-#endif
-	)
-	{
-		auto &it = layers[i];
-		it->transpose_weights();
-#if NET_TRANSPOSE_LAYER0_ONLY
-		break;
-#endif
-	}
+	model->transpose_weights();
+}
+
+// compressed network file: "CHNZ", u32 raw size, u32 FNV-1a hash of payload, mlz payload
+static const u8 netFileMagic[4] = {'C', 'H', 'N', 'Z'};
+static const int netFileHeaderSize = 12;
+
+static u32 readU32(const u8 *ptr)
+{
+	return ptr[0] | ((u32)ptr[1] << 8) | ((u32)ptr[2] << 16) | ((u32)ptr[3] << 24);
 }
 
 bool Network::load(const char *filename)
 {
-	std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+	std::string error;
+	return load(filename, error);
+}
+
+bool Network::load(const char *filename, std::string &error)
+{
+	MappedFile mf;
+
+	if (!mf.open(filename))
+	{
+		error = "cannot open " + std::string(filename);
+		return false;
+	}
+
+	const u8 *data = mf.data();
+	size_t size = mf.size();
+	std::vector<u8> unpacked;
+
+	if (size >= netFileHeaderSize && !memcmp(data, netFileMagic, 4))
+	{
+		// compressed
+		// note: the decoder doesn't check bounds, so validate size and payload hash first
+		size_t rawSize = readU32(data + 4);
+
+		if (!rawSize || rawSize > 256*1024*1024)
+		{
+			error = "invalid raw size";
+			return false;
+		}
+
+		if (size > 0x7fffffff || readU32(data + 8) != fnv1a(data + netFileHeaderSize, size - netFileHeaderSize))
+		{
+			error = "corrupt file (checksum)";
+			return false;
+		}
+
+		// decompression reserve
+		unpacked.resize(rawSize + 64);
+
+		if ((size_t)mlz_decompress_mini(unpacked.data(), data + netFileHeaderSize, (int)(size - netFileHeaderSize)) != rawSize)
+		{
+			error = "decompression failed";
+			return false;
+		}
+
+		data = unpacked.data();
+		size = rawSize;
+	}
+
+	NetArch narch;
+	int hsize = NetArch::parseHeader(data, size, narch);
+
+	if (hsize < 0)
+	{
+		error = "invalid header";
+		return false;
+	}
+
+	if (!init_topology(narch))
+	{
+		error = "unsupported architecture";
+		return false;
+	}
+
+	const size_t weightBytes = weight_size * sizeof(wfixedp);
 
-	ifs.read((char *)(weights.data() + weight_index), weight_size * sizeof(wfixedp));
+	if (size - hsize != weightBytes || !load_buffer(data + hsize, (int)weightBytes))
+	{
+		error = "topology mismatch (expected " + std::to_string(weightBytes) + " bytes of weights)";
+		return false;
+	}
 
-	return !ifs.fail();
+	// quantized weights must stay in range, see fixed_mul
+	for (int i=0; i<weight_size; i++)
+	{
+		int w = weights[weight_index + i];
+
+		if (w > (1 << fixedp_shift) || w < -(1 << fixedp_shift))
+		{
+			error = "weights out of range";
+			return false;
+		}
+	}
+
+	return true;
 }
 
 bool Network::load_buffer(const void *ptr, int size)
@@ -152,18 +269,109 @@ bool Network::load_buffer(const void *ptr, int size)
 	if (size != weight_size * (int)sizeof(wfixedp))
 		return false;
 
-	memcpy(weights.data() + weight_index, ptr, weight_size * sizeof(wfixedp));
+	memcpy(weights + weight_index, ptr, weight_size * sizeof(wfixedp));
 
 	return true;
 }
 
 bool Network::load_buffer_compressed(const void *ptr, int size)
 {
-	int usize = mlz_decompress_mini(weights.data() + weight_index, ptr, size);
+	int usize = mlz_decompress_mini(weights + weight_index, ptr, size);
 
 	return usize == weight_size * (int)sizeof(wfixedp);
 }
 
+Network::~Network()
+{
+	free_weights();
+	delete model;
+}
+
+void Network::free_weights()
+{
+	// both posix_memalign and malloc memory is released with free
+	free(weights_mem);
+	weights_mem = nullptr;
+	weights = nullptr;
+}
+
+const Network &Network::embedded()
+{
+	struct EmbeddedNet
+	{
+		Network net;
+
+		EmbeddedNet()
+		{
+			if (!net.init_topology())
+				assert(0 && "net topo init failed!");
+
+			if (!net.load_buffer_compressed(NET_DATA, NET_DATA_SIZE))
+			{
+				std::cout << "failed to load netfile!" << std::endl;
+				abort();
+			}
+
+			net.transpose_weights();
+		}
+	};
+
+	// thread-safe one-time init
+	static EmbeddedNet instance;
+	return instance.net;
+}
+
+static std::atomic<const Network *> currentNet(nullptr);
+static std::mutex loadedNetMutex;
+// network loaded via setCurrent (owned), null for embedded
+static Network *loadedNet = nullptr;
+static u32 loadedNetSerial = 0;
+
+const Network &Network::current()
+{
+	const Network *res = currentNet.load(std::memory_order_acquire);
+
+	if (res)
+		return *res;
+
+	return embedded();
+}
+
+bool Network::setCurrent(const char *filename, std::string &error)
+{
+	Network *net = nullptr;
+
+	if (*filename && strcmp(filename, "<empty>"))
+	{
+		net = new Network;
+
+		if (!net->load(filename, error))
+		{
+			delete net;
+			return false;
+		}
+
+		net->transpose_weights();
+	}
+
+	Network *old;
+
+	{
+		std::lock_guard<std::mutex> lock(loadedNetMutex);
+
+		if (net)
+			net->serial = ++loadedNetSerial;
+
+		old = loadedNet;
+		loadedNet = net;
+		currentNet.store(net, std::memory_order_release);
+	}
+
+	// no search is running => nobody uses the old network
+	delete old;
+	return true;
+}
+
 int32_t Network::to_centipawns(fixedp w)
 {
 	return (fixed_mul(w, 100*(1 << fixedp_shift)) + ((1 << fixedp_shift)-1)) >> fixedp_shift;
@@ -24,12 +24,15 @@ or as public domain (where applicable)
 #pragma once
 
 #include <vector>
+#include <string>
+#include <string.h>
 #include "types.h"
 #include "platform.h"
 
 namespace cheng4
 {
 
+// default architecture (embedded net)
 enum Topology
 {
 	topo0 = 736,
@@ -38,7 +41,159 @@ enum Topology
 	topo1in = topo1*2,
 	topo2 = 1,
 
-	topoLayers = 2
+	topoLayers = 2,
+
+	// largest supported layer0 output (accumulator) size, see NetArch::supported
+	topo1Max = 1024
+};
+
+// network feature sets
+enum NetFeatures
+{
+	nfPieceSquare	=	0,		// topo0 inputs: Board::netIndex
+	nfKingBuckets	=	1		// topo0 inputs per own king bucket, mirrored horizontally so that own king is on files e-h
+};
+
+// king buckets (nfKingBuckets), own king from perspective's point of view, after horizontal mirroring
+enum NetKingBucket
+{
+	nkbCorner	=	0,			// g1, h1
+	nkbCenter	=	1,			// e1, f1
+	nkbRank2	=	2,
+	nkbActive	=	3,			// rank 3 and above
+
+	nkbCount	=	4
+};
+
+// supported number of output buckets (selected by piece count)
+enum NetOutputBuckets
+{
+	nobCount	=	8
+};
+
+// network architecture, described by net file header:
+// "CHNN", u32 version, u32 features, inputs, hidden1, hidden2, outputs, shift; weights follow
+// weights (torch Linear layout, [out][in] per layer) come first, then all biases
+// files without header use the default architecture
+struct NetArch
+{
+	u32 features;
+	u32 inputs;				// layer0 inputs (per perspective)
+	u32 hidden1;			// layer0 outputs per perspective (accumulator size)
+	u32 hidden2;			// second hidden layer size, 0 = none
+	u32 outputs;
+	u32 shift;				// fixed point shift
+
+	static const u32 version = 1;
+	static const int headerSize = 32;
+
+	static NetArch defaults()
+	{
+		NetArch res;
+		res.features = nfPieceSquare;
+		res.inputs = topo0;
+		res.hidden1 = topo1;
+		res.hidden2 = 0;
+		res.outputs = 1;
+		res.shift = 9;
+		return res;
+	}
+
+	bool operator ==( const NetArch &o ) const
+	{
+		return features == o.features && inputs == o.inputs && hidden1 == o.hidden1 && hidden2 == o.hidden2 &&
+			outputs == o.outputs && shift == o.shift;
+	}
+
+	inline u32 kingBuckets() const
+	{
+		return features == nfKingBuckets ? nkbCount : 1;
+	}
+
+	// feature index transform for perspective with own king on ksq (from perspective's point of view,
+	// i.e. what netIndex returns for own king): index => (index ^ kingXor) + kingBase
+	// note: file is always in the low 3 bits of a topo0 feature index
+	inline i32 kingXor( i32 ksq ) const
+	{
+		return features == nfKingBuckets && (ksq & 7) < 4 ? 7 : 0;
+	}
+
+	inline i32 kingBase( i32 ksq ) const
+	{
+		if (features != nfKingBuckets)
+			return 0;
+
+		// rank 1 = 7
+		int rank = 7 - (ksq >> 3);
+		int bucket = rank >= 2 ? nkbActive : rank == 1 ? nkbRank2 : ((ksq ^ kingXor(ksq)) & 7) >= 6 ? nkbCorner : nkbCenter;
+
+		return bucket * topo0;
+	}
+
+	// output bucket for number of pieces on board (including kings)
+	inline int outputBucket( int pieceCount ) const
+	{
+		if (outputs <= 1)
+			return 0;
+
+		int res = (pieceCount - 1) * (int)outputs / 32;
+		return res < 0 ? 0 : res >= (int)outputs ? (int)outputs-1 : res;
+	}
+
+	// total number of weights including biases
+	int weightCount() const
+	{
+		int res = (int)((inputs + 1) * hidden1);
+
+		if (hidden2)
+			res += (int)((2*hidden1 + 1) * hidden2 + (hidden2 + 1) * outputs);
+		else
+			res += (int)((2*hidden1 + 1) * outputs);
+
+		return res;
+	}
+
+	void writeHeader( u8 *dst ) const
+	{
+		const u32 fields[7] = {version, features, inputs, hidden1, hidden2, outputs, shift};
+		memcpy(dst, "CHNN", 4);
+
+		for (int i=0; i<7; i++)
+			for (int j=0; j<4; j++)
+				dst[4 + i*4 + j] = (u8)(fields[i] >> (8*j));
+	}
+
+	// returns header size (0 if no header), -1 if header is invalid
+	static int parseHeader( const u8 *src, size_t size, NetArch &arch )
+	{
+		if (size < 4 || memcmp(src, "CHNN", 4))
+		{
+			arch = defaults();
+			return 0;
+		}
+
+		if (size < (size_t)headerSize)
+			return -1;
+
+		u32 fields[7];
+
+		for (int i=0; i<7; i++)
+		{
+			const u8 *p = src + 4 + i*4;
+			fields[i] = p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+		}
+
+		if (fields[0] != version)
+			return -1;
+
+		arch.features = fields[1];
+		arch.inputs = fields[2];
+		arch.hidden1 = fields[3];
+		arch.hidden2 = fields[4];
+		arch.outputs = fields[5];
+		arch.shift = fields[6];
+		return headerSize;
+	}
 };
 
 typedef i32 fixedp;
@@ -48,7 +203,12 @@ typedef i16 wfixedp;
 struct NetCache
 {
 	// actual cache for layer 1 output, including biases
-	wfixedp cache[topo1];
+	// only the first Network::cache_size() entries are used
+	wfixedp cache[topo1Max];
+	// king bucket transform this accumulator was built with, see NetArch::kingXor/kingBase
+	// kingBase < 0: own king changed bucket => needs refresh
+	i32 kingXor;
+	i32 kingBase;
 };
 
 struct NetLayerBase
@@ -62,7 +222,7 @@ struct NetLayerBase
 	virtual void init(wfixedp *wvec, wfixedp *bvec)=0;
 	virtual void transpose_weights() = 0;
 
-	virtual void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache)=0;
+	virtual void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache) const = 0;
 
 	virtual int getInputSize() const = 0;
 	virtual int getOutputSize() const = 0;
@@ -109,15 +269,21 @@ struct NetLayer : NetLayerBase
 
 		std::vector<wfixedp> tmp(w*h);
 
-		const wfixedp *fptr = wptr;
+		// blocked to keep both source and destination in cache (runs at startup)
+		const int block = 16;
+
+		for (int y0=0; y0<h; y0+=block)
+			for (int x0=0; x0<w; x0+=block)
+			{
+				const int y1 = y0+block < h ? y0+block : h;
+				const int x1 = x0+block < w ? x0+block : w;
 
-		//printf("wcount=%d\n", w*h);
-		for (int y=0; y<h; y++)
-			for (int x=0; x<w; x++)
-				tmp[x*h+y] = *fptr++;
+				for (int y=y0; y<y1; y++)
+					for (int x=x0; x<x1; x++)
+						tmp[x*h+y] = wptr[y*w+x];
+			}
 
-		for (int i=0; i<w*h; i++)
-			wptr[i] = tmp[i];
+		memcpy(wptr, tmp.data(), w*h*sizeof(wfixedp));
 	}
 
 	// relu/copy
@@ -136,7 +302,7 @@ struct NetLayer : NetLayerBase
 		return outputSize;
 	}
 
-	void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache) override
+	void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache) const override
 	{
 		wfixedp *tmp = cache.cache;
 
@@ -155,7 +321,7 @@ struct NetLayer : NetLayerBase
 		}
 	}
 
-	void cache_add_index(NetCache & CHENG_PTR_NOALIAS cache, i32 index)
+	void cache_add_index(NetCache & CHENG_PTR_NOALIAS cache, i32 index) const
 	{
 		wfixedp *tmp = cache.cache;
 		const wfixedp *w = weights + index*outputSize;
@@ -165,7 +331,7 @@ struct NetLayer : NetLayerBase
 			tmp[j] += w[j];
 	}
 
-	void cache_sub_index(NetCache & CHENG_PTR_NOALIAS cache, i32 index)
+	void cache_sub_index(NetCache & CHENG_PTR_NOALIAS cache, i32 index) const
 	{
 		wfixedp *tmp = cache.cache;
 		const wfixedp *w = weights + index*outputSize;
@@ -176,7 +342,7 @@ struct NetLayer : NetLayerBase
 	}
 
 	// forward, cached
-	void forward_cache(const NetCache & CHENG_PTR_NOALIAS cache, wfixedp * CHENG_PTR_NOALIAS output)
+	void forward_cache(const NetCache & CHENG_PTR_NOALIAS cache, wfixedp * CHENG_PTR_NOALIAS output) const
 	{
 		const wfixedp *tmp = cache.cache;
 
@@ -185,8 +351,26 @@ struct NetLayer : NetLayerBase
 			output[i] = (wfixedp)activate(tmp[i]);
 	}
 
+	// single output (output buckets), last layer
+	fixedp forward_single(const wfixedp * CHENG_PTR_NOALIAS input, int index) const
+	{
+		static_assert(NET_TRANSPOSE_LAYER0_ONLY, "forward_single expects non-transposed weights");
+
+		const wfixedp *w = weights + index*inputSize;
+
+		fixedp_result tmpdot = 0;
+
+		CHENG_AUTO_VECTORIZE_LOOP
+		for (int j=0; j<inputSize; j++)
+			tmpdot += (fixedp_result)input[j] * w[j];
+
+		fixedp_result tmp = ((fixedp_result)bias[index] << fixedp_shift) + tmpdot;
+
+		return activate((fixedp)(tmp >> fixedp_shift));
+	}
+
 	// feedforward
-	void forward(const wfixedp *  CHENG_PTR_NOALIAS input, fixedp * CHENG_PTR_NOALIAS output)
+	void forward(const wfixedp *  CHENG_PTR_NOALIAS input, fixedp * CHENG_PTR_NOALIAS output) const
 	{
 		fixedp_result tmp[outputSize];
 
@@ -229,41 +413,188 @@ struct NetLayer : NetLayerBase
 	}
 };
 
-struct Network
+// inference kernels for one supported shape
+struct NetModelBase
+{
+	virtual ~NetModelBase() {}
+
+	// weights: start of all weights, biases: start of all biases
+	virtual void init(wfixedp *weights, wfixedp *biases) = 0;
+	virtual void transpose_weights() = 0;
+
+	virtual void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache) const = 0;
+	virtual void cache_add_index(NetCache &cache, i32 index) const = 0;
+	virtual void cache_sub_index(NetCache &cache, i32 index) const = 0;
+
+	// bucket: output bucket, see NetArch::outputBucket
+	virtual fixedp forward_cache(const NetCache &cache, const NetCache &cacheOpp, int bucket) const = 0;
+};
+
+// shared input layer (accumulator) part
+template<int inputs, int hidden1>
+struct NetModelInput : NetModelBase
+{
+	NetLayer<inputs, hidden1, false> layer0;
+
+	void transpose_weights() override
+	{
+		// only layer0 is stored transposed, see NET_TRANSPOSE_LAYER0_ONLY
+		layer0.transpose_weights();
+	}
+
+	void cache_init(const i32 *inputIndex, int indexCount, NetCache &cache) const override
+	{
+		layer0.cache_init(inputIndex, indexCount, cache);
+	}
+
+	void cache_add_index(NetCache &cache, i32 index) const override
+	{
+		layer0.cache_add_index(cache, index);
+	}
+
+	void cache_sub_index(NetCache &cache, i32 index) const override
+	{
+		layer0.cache_sub_index(cache, index);
+	}
+
+	// activated accumulators of both perspectives
+	void forward_input(const NetCache & CHENG_PTR_NOALIAS cache, const NetCache & CHENG_PTR_NOALIAS cacheOpp,
+		wfixedp * CHENG_PTR_NOALIAS output) const
+	{
+		layer0.forward_cache(cache, output);
+		layer0.forward_cache(cacheOpp, output + hidden1);
+	}
+};
+
+// input => hidden1 (x2 perspectives) => outputs (buckets)
+template<int inputs, int hidden1, int outputs>
+struct NetModel2 : NetModelInput<inputs, hidden1>
+{
+	NetLayer<hidden1*2, outputs, true> layer1;
+
+	void init(wfixedp *weights, wfixedp *biases) override
+	{
+		this->layer0.init(weights, biases);
+		layer1.init(weights + inputs*hidden1, biases + hidden1);
+	}
+
+	fixedp forward_cache(const NetCache &cache, const NetCache &cacheOpp, int bucket) const override
+	{
+		wfixedp temp[hidden1*2];
+		this->forward_input(cache, cacheOpp, temp);
+
+		return layer1.forward_single(temp, bucket);
+	}
+};
+
+// input => hidden1 (x2 perspectives) => hidden2 => outputs (buckets)
+template<int inputs, int hidden1, int hidden2, int outputs>
+struct NetModel3 : NetModelInput<inputs, hidden1>
 {
-	std::vector<NetLayerBase *> layers;
+	NetLayer<hidden1*2, hidden2, false> layer1;
+	NetLayer<hidden2, outputs, true> layer2;
+
+	void init(wfixedp *weights, wfixedp *biases) override
+	{
+		this->layer0.init(weights, biases);
+		weights += inputs*hidden1;
+		biases += hidden1;
+		layer1.init(weights, biases);
+		layer2.init(weights + hidden1*2*hidden2, biases + hidden2);
+	}
+
+	fixedp forward_cache(const NetCache &cache, const NetCache &cacheOpp, int bucket) const override
+	{
+		wfixedp temp[hidden1*2];
+		this->forward_input(cache, cacheOpp, temp);
+
+		fixedp hidden[hidden2];
+		layer1.forward(temp, hidden);
+
+		// activated outputs fit in 16 bits
+		wfixedp whidden[hidden2];
+
+		for (int i=0; i<hidden2; i++)
+			whidden[i] = (wfixedp)hidden[i];
 
-	// now fixed
-	NetLayer<topo0, topo1, false> layer0;
-	NetLayer<topo1in, 1, true> layer1;
+		return layer2.forward_single(whidden, bucket);
+	}
+};
+
+struct Network
+{
+	NetArch arch;
+	NetModelBase *model = nullptr;
 
 	// all weights, including biases (biases come at the end)
-	std::vector<wfixedp> weights;
+	// cacheline aligned, on huge pages where available
+	wfixedp *weights = nullptr;
 	// this is where aligned weights start
 	int weight_index;
 	// total number of weights
 	int weight_size;
 	// this is where biases start in weights
 	int bias_index;
+	// unique per network loaded via setCurrent (0 = embedded)
+	// Eval compares serials, a freed network's address may be reused
+	u32 serial = 0;
+
+	Network() = default;
+	~Network();
+
+	Network(const Network &) = delete;
+	Network &operator =(const Network &) = delete;
 
+	// load network file (raw or compressed, see net_pak) with optional architecture header
+	// initializes topology; weights still need to be transposed
 	bool load(const char *filename);
+	bool load(const char *filename, std::string &error);
 
+	// raw weights only (no header), call init_topology first
 	bool load_buffer(const void *buf, int size);
 
 	bool load_buffer_compressed(const void *buf, int size);
 
-	bool init_topology();
+	// returns false if architecture isn't supported
+	bool init_topology(const NetArch &narch = NetArch::defaults());
 
-	void forward_cache(const NetCache &cache, const NetCache &cacheOpp, fixedp *outp, int outpsize);
+	// layer0 outputs per perspective
+	inline int cache_size() const
+	{
+		return (int)arch.hidden1;
+	}
 
-	void cache_init(const i32 *nonzero, int nzcount, NetCache &cache);
+	// bucket: output bucket, see NetArch::outputBucket
+	fixedp forward_cache(const NetCache &cache, const NetCache &cacheOpp, int bucket = 0) const;
 
-	void cache_add_index(NetCache &cache, i32 index);
-	void cache_sub_index(NetCache &cache, i32 index);
+	void cache_init(const i32 *nonzero, int nzcount, NetCache &cache) const;
+
+	void cache_add_index(NetCache &cache, i32 index) const;
+	void cache_sub_index(NetCache &cache, i32 index) const;
 
 	void transpose_weights();
 
 	static int32_t to_centipawns(fixedp w);
+
+	// returns kernel for architecture or null if not supported
+	static NetModelBase *create_model(const NetArch &narch);
+
+	// process-wide embedded network: decoded and transposed once on first use,
+	// then shared read-only by all Eval instances
+	static const Network &embedded();
+
+	// network used by Eval (embedded unless replaced via setCurrent)
+	static const Network &current();
+	// load network file and make it current; empty name or "<empty>" restores embedded net
+	// only call between searches; Evals pick up the new net at next root cache update
+	// the replaced network is freed, stale Eval pointers are only refreshed, never dereferenced
+	static bool setCurrent(const char *filename, std::string &error);
+
+private:
+	// raw allocation
+	void *weights_mem = nullptr;
+
+	void free_weights();
 };
 
 }
@@ -47,7 +47,31 @@ size_t compress_buffer(uint8_t *dst, size_t dsz, const uint8_t *src, size_t sz)
 	return res;
 }
 
-int pack_net(const char *filename, const char *outfilename)
+/* compressed network file for EvalFile: "CHNZ", u32 raw size, u32 FNV-1a hash of payload, mlz payload */
+static void write_u32(FILE *f, uint32_t v)
+{
+	uint8_t buf[4];
+	buf[0] = (uint8_t)v;
+	buf[1] = (uint8_t)(v >> 8);
+	buf[2] = (uint8_t)(v >> 16);
+	buf[3] = (uint8_t)(v >> 24);
+	fwrite(buf, 1, 4, f);
+}
+
+static uint32_t payload_hash(const uint8_t *data, size_t size)
+{
+	uint32_t res = 2166136261u;
+
+	for (size_t i=0; i<size; i++)
+	{
+		res ^= data[i];
+		res *= 16777619u;
+	}
+
+	return res;
+}
+
+int pack_net(const char *filename, const char *outfilename, int binary)
 {
 	FILE *f = fopen(filename, "rb");
 
@@ -76,7 +100,7 @@ int pack_net(const char *filename, const char *outfilename)
 
 	fclose(f);
 
-	FILE *f2 = fopen(outfilename, "w");
+	FILE *f2 = fopen(outfilename, binary ? "wb" : "w");
 
 	if (!f2)
 	{
@@ -93,11 +117,24 @@ int pack_net(const char *filename, const char *outfilename)
 	{
 		free(inbuf);
 		free(cmpbuf);
-		free(f2);
+		fclose(f2);
 		fprintf(stderr, "failed to compress input, inbytes=%d\n", (int)fsz);
 		return 4;
 	}
 
+	if (binary)
+	{
+		fwrite("CHNZ", 1, 4, f2);
+		write_u32(f2, (uint32_t)fsz);
+		write_u32(f2, payload_hash(cmpbuf, csz));
+		fwrite(cmpbuf, 1, csz, f2);
+
+		free(cmpbuf);
+		free(inbuf);
+		fclose(f2);
+		return 0;
+	}
+
 	fprintf(f2, "const int NET_DATA_SIZE = %d;\n", (int)csz);
 
 	fprintf(f2, "const uint32_t NET_DATA[] = {\n");
@@ -130,11 +167,15 @@ int pack_net(const char *filename, const char *outfilename)
 
 int main(int argc, char **argv)
 {
+	if (argc == 4 && !strcmp(argv[2], "-bin"))
+		return pack_net(argv[1], argv[3], 1);
+
 	if (argc != 2)
 	{
-		printf("usage: net_pak <infile>\n");
+		printf("usage: net_pak <infile> [-bin <outfile>]\n");
+		printf("without -bin, writes net_embed.h\n");
 		return 0;
 	}
 
-	return pack_net(argv[1], "net_embed.h");
+	return pack_net(argv[1], "net_embed.h", 0);
 }
@@ -32,6 +32,9 @@ or as public domain (where applicable)
 #include "labelfen.h"
 #include "autoplay.h"
 #include "tb.h"
+#include "attacks.h"
+#include "trainfile.h"
+#include "iothread.h"
 #include <deque>
 #include <cctype>
 #include <algorithm>
@@ -252,7 +255,7 @@ static const char *benchFens[] =
 	0
 };
 
-static void bench()
+static void bench( bool attackMap )
 {
 	NodeCount total = 0;
 	Search *s = new Search;
@@ -261,6 +264,8 @@ static void bench()
 	s->setHashTable(tt);
 	// bench must be deterministic with or without tbs
 	s->disableTablebase(true);
+	// attack map doesn't change the node count, only speed
+	s->enableAttackMap(attackMap);
 	Board b;
 	SearchMode sm;
 	sm.reset();
@@ -332,7 +337,7 @@ struct TacPosBenchCbk
 	i32 startTicks;
 };
 
-static std::string uciScore( Score score );
+static void uciScore( TextBuffer &res, Score score );
 
 static void tbcbk(const SearchInfo &si, void *param)
 {
@@ -351,7 +356,10 @@ static void tbcbk(const SearchInfo &si, void *param)
 	skipSpaces(inmov);
 	Move malt = b.fromSAN(inmov);
 
-	std::cout << "depth: " << (int)si.depth << " score: " << uciScore(si.pvScore) << " PV: ";
+	TextBuffer score;
+	uciScore(score, si.pvScore);
+	std::cout << "depth: " << (int)si.depth << " score: ";
+	std::cout.write(score.data(), score.size()) << " PV: ";
 
 	uint pvidx = 0;
 
@@ -491,9 +499,125 @@ static bool pbench()
   return !fails;
 }
 
-static void filterPgn( const char *fname )
+// board microbench: doMove/undoMove and board copy throughput over bench positions
+static void mbench()
+{
+	const uint iterations = 200000;
+
+	NodeCount moveOps = 0;
+	NodeCount copyOps = 0;
+	NodeCount lookupOps = 0;
+	i32 moveTicks = 0;
+	i32 copyTicks = 0;
+	i32 attMoveTicks = 0;
+	i32 lookupTicks = 0;
+	i32 attLookupTicks = 0;
+	Signature check = 0;
+
+	// attack map copy-make stack
+	AttackMap *attStack = new AttackMap[2];
+
+	for ( const char **p = benchFens; *p; p++ )
+	{
+		Board b;
+		b.fromFEN( *p );
+
+		Move moves[ maxMoves ];
+		bool checks[ maxMoves ];
+		uint count = 0;
+
+		MoveGen mg( b );
+		Move m;
+		while ( (m = mg.next()) != mcNone )
+		{
+			checks[ count ] = b.isCheck( m, mg.discovered() );
+			moves[ count++ ] = m;
+		}
+
+		i32 ticks = Timer::getMillisec();
+		for ( uint i=0; i<iterations; i++ )
+		{
+			for ( uint j=0; j<count; j++ )
+			{
+				UndoInfo ui;
+				b.doMove( moves[j], ui, checks[j] );
+				check ^= b.sig();
+				b.undoMove( ui );
+			}
+		}
+		moveTicks += Timer::getMillisec() - ticks;
+		moveOps += (NodeCount)iterations * count;
+
+		// same with incremental attack maps enabled
+		attStack[0].init( b );
+		ticks = Timer::getMillisec();
+		for ( uint i=0; i<iterations; i++ )
+		{
+			for ( uint j=0; j<count; j++ )
+			{
+				UndoInfo ui;
+				attStack[1] = attStack[0];
+				ui.attacks = attStack + 1;
+				b.doMove( moves[j], ui, checks[j] );
+				check ^= b.sig();
+				b.undoMove( ui );
+			}
+		}
+		attMoveTicks += Timer::getMillisec() - ticks;
+
+		// attackers to all squares: computed vs looked up
+		ticks = Timer::getMillisec();
+		for ( uint i=0; i<iterations/8; i++ )
+		{
+			Bitboard occ = b.occupied() ^ i;
+			for ( Square sq = 0; sq < 64; sq++ )
+				check ^= b.allAttacksTo( sq, occ );
+		}
+		lookupTicks += Timer::getMillisec() - ticks;
+
+		ticks = Timer::getMillisec();
+		for ( uint i=0; i<iterations/8; i++ )
+		{
+			const AttackMap &am = attStack[ i & 1 ];
+			for ( Square sq = 0; sq < 64; sq++ )
+				check ^= am.attackersTo( sq ) + i;
+		}
+		attLookupTicks += Timer::getMillisec() - ticks;
+		lookupOps += (NodeCount)iterations/8 * 64;
+
+		Board copies[ 16 ];
+		ticks = Timer::getMillisec();
+		for ( uint i=0; i<iterations*8; i++ )
+		{
+			Board &dst = copies[ i & 15 ];
+			dst = b;
+			check ^= dst.sig() + i;
+		}
+		copyTicks += Timer::getMillisec() - ticks;
+		copyOps += (NodeCount)iterations * 8;
+	}
+
+	std::cout << "sizeof(Board) = " << sizeof(Board) << std::endl;
+	std::cout << "doMove+undoMove: " << moveOps << " in " << moveTicks << " msec ("
+		<< (double)moveTicks * 1e6 / (double)std::max<NodeCount>( 1, moveOps ) << " ns/op)" << std::endl;
+	std::cout << "copy: " << copyOps << " in " << copyTicks << " msec ("
+		<< (double)copyTicks * 1e6 / (double)std::max<NodeCount>( 1, copyOps ) << " ns/op)" << std::endl;
+	std::cout << "doMove+undoMove with attack maps: " << moveOps << " in " << attMoveTicks << " msec ("
+		<< (double)attMoveTicks * 1e6 / (double)std::max<NodeCount>( 1, moveOps ) << " ns/op)" << std::endl;
+	std::cout << "allAttacksTo: " << lookupOps << " in " << lookupTicks << " msec ("
+		<< (double)lookupTicks * 1e6 / (double)std::max<NodeCount>( 1, lookupOps ) << " ns/op)" << std::endl;
+	std::cout << "attack map lookup: " << lookupOps << " in " << attLookupTicks << " msec ("
+		<< (double)attLookupTicks * 1e6 / (double)std::max<NodeCount>( 1, lookupOps ) << " ns/op)" << std::endl;
+	std::cout << "checksum " << check << std::endl;
+
+	delete[] attStack;
+}
+
+static void filterPgn( const char *fname, int threads, size_t dedupMB )
 {
 	FilterPgn *fp = new FilterPgn;
+	fp->threads = threads;
+	fp->dedupMB = dedupMB;
 
 	if (!fp->parse(fname))
 		std::cout << "failed to parse " << fname << std::endl;
@@ -505,9 +629,11 @@ static void filterPgn( const char *fname )
 	delete fp;
 }
 
-static void extractLinesPgn( const char *fname )
+static void extractLinesPgn( const char *fname, int threads, size_t dedupMB )
 {
 	FilterPgn *fp = new FilterPgn;
+	fp->threads = threads;
+	fp->dedupMB = dedupMB;
 
 	if (!fp->parse(fname, /*extractlines*/true))
 		std::cout << "failed to parse " << fname << std::endl;
@@ -519,26 +645,54 @@ static void extractLinesPgn( const char *fname )
 	delete fp;
 }
 
-static void autoplay()
+static void autoplay( AutoPlay &ap, const std::string &outname, int64_t posLimit )
+{
+	if ( ap.go( outname.c_str(), posLimit ) )
+		std::cout << "all ok" << std::endl;
+	else
+		std::cout << "failed to write " << outname << std::endl;
+}
+
+static void labelFen( LabelFEN &lf, const std::string &fname, const std::string &outname )
 {
-	AutoPlay ap;
-	// try 400M positions
-	ap.go("autoplay.bin", U64C(400000000));
-	std::cout << "all ok" << std::endl;
+	if ( !lf.process( fname.c_str(), outname.c_str() ) )
+		std::cout << "failed to label " << fname << " to " << outname << std::endl;
+	else
+		std::cout << "all ok" << std::endl;
 }
 
-static void labelFen( const char *fname )
+// convert training data container to raw records (for tools that can't read containers)
+static void unpackTrain( const std::string &inname, const std::string &outname )
 {
-	LabelFEN lf;
-	if (!lf.load(fname))
+	if ( inname.empty() || outname.empty() )
 	{
-		std::cout << "failed to parse " << fname << std::endl;
+		std::cout << "usage: unpacktrain <infile> <outfile>" << std::endl;
 		return;
 	}
-	if (!lf.process("labelFEN_out.bin"))
-		std::cout << "failed to write labelFEN_out.bin" << std::endl;
-	else
-		std::cout << "all ok" << std::endl;
+
+	TrainReader tr;
+
+	if ( !tr.open( inname.c_str() ) )
+	{
+		std::cout << "failed to open " << inname << std::endl;
+		return;
+	}
+
+	TrainWriter fo;
+
+	if ( !fo.openRaw( outname.c_str() ) )
+	{
+		std::cout << "failed to create " << outname << std::endl;
+		return;
+	}
+
+	if ( !fo.appendChunks( tr ) || !fo.close() )
+	{
+		std::cout << "failed to unpack " << inname << std::endl;
+		return;
+	}
+
+	std::cout << tr.records() << " records in " << tr.chunks() << " chunks unpacked" << std::endl;
 }
 
 // Protocol
@@ -557,7 +711,7 @@ static void protoCallback( const SearchInfo &si, void *param )
 	static_cast<Protocol *>(param)->searchCallback( si );
 }
 
-Protocol::Protocol( Engine &eng ) : multiPV(1), protover(1), analyze(0), force(0), clocksRunning(0), engineColor(ctBlack),
+Protocol::Protocol( Engine &eng ) : output(0), multiPV(1), protover(1), analyze(0), force(0), clocksRunning(0), engineColor(ctBlack),
 	invalidState(0), frc(0), edit(0), post(1), fixedTime(0), maxCores(64), adjudicated(0), type( ptNative ),
 	engine(eng), moveOverheadMs(100), quitFlag(0)
 {
@@ -618,7 +772,7 @@ bool Protocol::shouldQuit() const
 void Protocol::sendStart( uint flags )
 {
 	mutex.lock();
-	sendStr.str( std::string() );
+	sendStr.clear();
 	switch( type )
 	{
 	case ptUCI:
@@ -635,21 +789,42 @@ void Protocol::sendStart( uint flags )
 // start sending (reset buffer)
 void Protocol::sendEnd()
 {
-	// coding around rdbuf()->in_avail() which doesn't always work!
-	std::string strg = sendStr.str();
-	if ( !strg.empty() )
+	if ( !sendStr.empty() )
 	{
-		std::cout << strg << std::endl;
-		std::cout.flush();		  // FIXME: this is necessary under Linux to work properly under xboard
+		if ( output )
+			output->push( sendStr.data(), sendStr.size() );
+		else
+		{
+			// whole line in a single write
+			sendStr << '\n';
+			std::cout.write( sendStr.data(), sendStr.size() );
+			std::cout.flush();		  // FIXME: this is necessary under Linux to work properly under xboard
+		}
 	}
 	mutex.unlock();
 }
 
+void Protocol::setOutput( OutputThread *out )
+{
+	MutexLock _( mutex );
+	if ( output )
+		output->flush();
+	output = out;
+}
+
 // called from search
 void Protocol::searchCallback( const SearchInfo &si )
 {
 	sendStart( si.flags );
+	formatInfo( si );
+	sendEnd();
+
+	if ( si.flags & sifBestMove )
+		finishBest();
+}
 
+void Protocol::formatInfo( const SearchInfo &si )
+{
 	if ( si.flags & sifDepth )
 		sendDepth( si.depth );
 	if ( si.flags & sifSelDepth )
@@ -675,11 +850,72 @@ void Protocol::searchCallback( const SearchInfo &si )
 	}
 	if ( si.flags & sifBestMove )
 		sendBest( si.bestMove, (si.flags & sifPonderMove) ? si.ponderMove : mcNone );
+}
 
-	sendEnd();
+// info line microbench: formatting throughput of MultiPV lines from current position
+void Protocol::ibench()
+{
+	const uint iterations = 200000;
+	const uint pvLength = 24;
 
-	if ( si.flags & sifBestMove )
-		finishBest();
+	Move pv[ pvLength ];
+	uint pvCount = 0;
+
+	// deterministic pseudo-PV, needs to be legal
+	Board b( engine.board() );
+	while ( pvCount < pvLength )
+	{
+		Move moves[ maxMoves ];
+		uint count = 0;
+
+		MoveGen mg( b );
+		Move m;
+		while ( (m = mg.next()) != mcNone )
+			moves[ count++ ] = m;
+
+		if ( !count )
+			break;
+
+		m = moves[ (pvCount * 7) % count ];
+		pv[ pvCount++ ] = m;
+		UndoInfo ui;
+		b.doMove( m, ui, b.isCheck( m, b.discovered() ) );
+	}
+
+	SearchInfo si;
+	si.reset();
+	si.flags = sifDepth | sifSelDepth | sifTime | sifNodes | sifNPS | sifTB | sifHashFull | sifPV;
+	si.depth = 31;
+	si.selDepth = 47;
+	si.time = 123456;
+	si.nodes = 1987654321;
+	si.nps = 1610000;
+	si.tbHits = 12345;
+	si.hashFull = 999;
+	si.pv = pv;
+	si.pvCount = pvCount;
+	si.pvBound = btExact;
+
+	size_t bytes = 0;
+	i32 ticks = Timer::getMillisec();
+
+	for ( uint i=0; i<iterations; i++ )
+	{
+		si.pvIndex = i % 50;
+		si.pvScore = (Score)((int)(i % 601) - 300);
+
+		sendStart( si.flags );
+		formatInfo( si );
+		bytes += sendStr.size();
+		// like sendEnd, minus the write
+		mutex.unlock();
+	}
+
+	ticks = Timer::getMillisec() - ticks;
+
+	std::cout.write( sendStr.data(), sendStr.size() ) << std::endl;
+	std::cout << iterations << " info lines (" << bytes << " bytes) in " << ticks << " msec ("
+		<< (double)ticks * 1e6 / (double)iterations << " ns/line)" << std::endl;
 }
 
 // send current depth
@@ -800,7 +1036,8 @@ void Protocol::sendCurMove( Move move )
 	switch( type )
 	{
 	case ptUCI:
-		sendStr << " currmove " << engine.board().toUCI(move);
+		sendStr << " currmove ";
+		sendStr.commit( engine.board().toUCI( sendStr.reserve(16), move ) );
 		break;
 	case ptCECP:
 	case ptNative:
@@ -808,17 +1045,15 @@ void Protocol::sendCurMove( Move move )
 	}
 }
 
-static std::string uciScore( Score score )
+static void uciScore( TextBuffer &res, Score score )
 {
-	std::stringstream res;
 	if ( ScorePack::isMate( score ) )
 	{
 		int msc = score >= 0 ? (scInfinity - score)/2 + 1 : (-scInfinity - score + 1)/2 - 1;
 		assert( msc );
 		assert( (msc >= 0 && score >= 0) || (msc < 0 && score < 0) );
 		res << "mate " << msc;
-	} else res << "cp " << score;
-	return res.str();
+	} else res << "cp " << (int)score;
 }
 
 // index: k-best(multipv) zero-based index
@@ -828,7 +1063,8 @@ void Protocol::sendPV( const SearchInfo &si, uint index, Score score, enum Bound
 	switch( type )
 	{
 	case ptUCI:
-		sendStr << " multipv " << (1+index) << " score " << uciScore( score );
+		sendStr << " multipv " << (1+index) << " score ";
+		uciScore( sendStr, score );
 
 		if ( bound == btLower )
 			sendStr << " lowerbound";
@@ -844,7 +1080,8 @@ void Protocol::sendPV( const SearchInfo &si, uint index, Score score, enum Bound
 			for (size_t i=0; i<pvCount; i++)
 			{
 				assert(b.isLegalMove(pv[i]));
-				sendStr << " " << b.toUCI( pv[i] );
+				sendStr << ' ';
+				sendStr.commit( b.toUCI( sendStr.reserve(16), pv[i] ) );
 				UndoInfo ui;
 				b.doMove( pv[i], ui, b.isCheck( pv[i], b.discovered() ) );
 			}
@@ -864,18 +1101,16 @@ void Protocol::sendPV( const SearchInfo &si, uint index, Score score, enum Bound
 			if ( si.flags & sifNodes )
 				n = si.nodes;
 
-			sendStr.width(3);
-			sendStr << (int)d;
+			sendStr.appendInt( d, 3 );
 			bound = btExact;		// FIXME: WinBoard seems to have problems with additional + or - => disabled
 			sendStr << (bound == btUpper ? '-' : bound == btLower ? '+' : ' ');
-			sendStr << " ";
-			sendStr.width(5);
+			sendStr << ' ';
 			// TODO: convert score to pseudo-standard mate scores
-			sendStr << score << " ";
-			sendStr.width(8);
-			sendStr << (t/10) << " ";
-			sendStr.width(12);
-			sendStr << n;
+			sendStr.appendInt( score, 5 );
+			sendStr << ' ';
+			sendStr.appendInt( t/10, 8 );
+			sendStr << ' ';
+			sendStr.appendUInt( n, 12 );
 			Board b( engine.board() );
 
 			Move ponder = mcNone;
@@ -883,20 +1118,26 @@ void Protocol::sendPV( const SearchInfo &si, uint index, Score score, enum Bound
 				ponder = engine.getPonderMove();
 
 			if ( ponder != mcNone )
-				sendStr << " (" << engine.ponderBoard().toSAN( ponder ) << ')';
+			{
+				sendStr << " (";
+				sendStr.commit( engine.ponderBoard().toSAN( sendStr.reserve(32), ponder ) );
+				sendStr << ')';
+			}
 
 			for (size_t i=0; i<pvCount; i++)
 			{
 				assert(b.isLegalMove(pv[i]));
-				sendStr << " " << b.toSAN( pv[i] );
+				sendStr << ' ';
+				sendStr.commit( b.toSAN( sendStr.reserve(32), pv[i] ) );
 				UndoInfo ui;
 				b.doMove( pv[i], ui, b.isCheck( pv[i], b.discovered() ) );
 			}
-			sendStr.width(1);
-
 			// report mates at the end of the PV as text
 			if (ScorePack::isMate(score))
-				sendStr << " ;" << uciScore(score);
+			{
+				sendStr << " ;";
+				uciScore(sendStr, score);
+			}
 		}
 		break;
 	case ptNative:
@@ -910,7 +1151,8 @@ void Protocol::sendBest( Move best, Move ponder )
 	switch( type )
 	{
 	case ptUCI:
-		sendStr << "bestmove " << engine.board().toUCI( best );
+		sendStr << "bestmove ";
+		sendStr.commit( engine.board().toUCI( sendStr.reserve(16), best ) );
 
 		if ( ponder != mcNone )
 		{
@@ -919,13 +1161,15 @@ void Protocol::sendBest( Move best, Move ponder )
 			UndoInfo ui;
 			b.doMove( best, ui, b.isCheck( best, b.discovered() ) );
 
-			sendStr << " ponder " << b.toUCI( ponder );
+			sendStr << " ponder ";
+			sendStr.commit( b.toUCI( sendStr.reserve(16), ponder ) );
 		}
 		break;
 	case ptCECP:
 		if ( !analyze )
 		{
-			sendStr << "move " << engine.board().toUCI( best );
+			sendStr << "move ";
+			sendStr.commit( engine.board().toUCI( sendStr.reserve(16), best ) );
 			engine.doMoveInternal( best, 1 );
 			engine.setPonderMove( ponder );
 		}
@@ -957,7 +1201,7 @@ void Protocol::sendRaw( const std::string &msg )
 // send raw EOL
 void Protocol::sendEOL()
 {
-	sendStr << std::endl;
+	sendStr << '\n';
 }
 
 // send custom info message
@@ -1302,11 +1546,13 @@ bool Protocol::parseUCI( const std::string &line )
 		sendRaw( "option name UCI_LimitStrength type check default false" ); sendEOL();
 		sendRaw( "option name UCI_Elo type spin min 800 max 2700 default 2700" ); sendEOL();
 		sendRaw( "option name NullMove type check default true" ); sendEOL();
+		sendRaw( "option name AttackMap type check default false" ); sendEOL();
 		sendRaw( "option name Contempt type spin min -100 max 100 default 0" ); sendEOL();
 		sendRaw( "option name MoveOverheadMsec type spin min 0 max 10000 default 100" ); sendEOL();
 		sendRaw( "option name SyzygyPath type string default <empty>" ); sendEOL();
 		sendRaw( "option name SyzygyEnable type check default true" ); sendEOL();
 		sendRaw( "option name UseHCE type check default false" ); sendEOL();
+		sendRaw( "option name EvalFile type string default <empty>" ); sendEOL();
 #ifdef USE_TUNING
 		for ( size_t i=0; i<TunableParams::paramCount(); i++ )
 		{
@@ -1413,6 +1659,10 @@ bool Protocol::parseUCIOptions( const std::string &line, size_t &pos )
 		engine.useHCE( value != "false" );
 		return 1;
 	}
+	if ( uciCompareOptionName(key, "EvalFile") )
+	{
+		return engine.setEvalFile(value.c_str(), "info string");
+	}
 	if ( uciCompareOptionName(key, "Ponder") )
 	{
 		engine.setPonder( value == "true" );
@@ -1467,6 +1717,11 @@ bool Protocol::parseUCIOptions( const std::string &line, size_t &pos )
 		engine.setNullMove( value != "false" );
 		return 1;
 	}
+	if ( uciCompareOptionName(key, "AttackMap") )
+	{
+		engine.setAttackMap( value == "true" );
+		return 1;
+	}
 #ifdef USE_TUNING
 	if ( TunableParams::setParam(key.c_str(), value.c_str()) )
 	{
@@ -1880,7 +2135,8 @@ bool Protocol::parseCECPInternal( const std::string &line )
 			"option=\"OwnBook -check 1\" option=\"LimitStrength -check 0\" option=\"Elo -spin 2700 800 2700\" "
 			"option=\"MoveOverheadMsec -spin 100 0 10000\" "
 			"option=\"SyzygyPath -string <empty>\" option=\"SyzygyEnable -check 1\" option=\"UseHCE -check 0\" "
-			"option=\"MultiPV -spin 1 1 256\" option=\"NullMove -check 1\" option=\"Contempt -spin 0 -100 100\" myname=\""
+			"option=\"EvalFile -string <empty>\" "
+			"option=\"MultiPV -spin 1 1 256\" option=\"NullMove -check 1\" option=\"AttackMap -check 0\" option=\"Contempt -spin 0 -100 100\" myname=\""
 		);
 		sendRaw( Version::version() );
 		sendRaw( "\" "
@@ -1993,6 +2249,10 @@ bool Protocol::parseCECPInternal( const std::string &line )
 			engine.useHCE( flag != 0 );
 			return 1;
 		}
+		if ( token == "EvalFile" )
+		{
+			return engine.setEvalFile(line.c_str() + pos, "#");
+		}
 		if ( token == "Threads" )
 		{
 			long thr = strtol( line.c_str() + pos, 0, 10 );
@@ -2018,6 +2278,12 @@ bool Protocol::parseCECPInternal( const std::string &line )
 			engine.setNullMove( nm != 0 );
 			return 1;
 		}
+		if ( token == "AttackMap" )
+		{
+			long am = strtol( line.c_str() + pos, 0, 10 );
+			engine.setAttackMap( am != 0 );
+			return 1;
+		}
 		if ( token == "LimitStrength" )
 		{
 			long lst = strtol( line.c_str() + pos, 0, 10 );
@@ -2323,6 +2589,16 @@ bool Protocol::adjudicate()
 
 // parse special (nonstd) command
 bool Protocol::parseSpecial( const std::string &token, const std::string &line, size_t &pos )
+{
+	// special commands write to stdout directly, so keep output synchronous until done
+	OutputThread *out = output;
+	setOutput( 0 );
+	bool res = parseSpecialInternal( token, line, pos );
+	setOutput( out );
+	return res;
+}
+
+bool Protocol::parseSpecialInternal( const std::string &token, const std::string &line, size_t &pos )
 {
 	if ( token == "dump" )
 	{
@@ -2400,7 +2676,7 @@ bool Protocol::parseSpecial( const std::string &token, const std::string &line,
 	if ( token == "bench" )
 	{
 		engine.abortSearch();
-		bench();
+		bench( (engine.mainThread->search.searchFlags & sfAttackMap) != 0 );
 		return 1;
 	}
 	if ( token == "pbench" )
@@ -2415,6 +2691,18 @@ bool Protocol::parseSpecial( const std::string &token, const std::string &line,
 		tbench();
 		return 1;
 	}
+	if ( token == "mbench" )
+	{
+		engine.abortSearch();
+		mbench();
+		return 1;
+	}
+	if ( token == "ibench" )
+	{
+		engine.abortSearch();
+		ibench();
+		return 1;
+	}
 	if ( token == "perft" )
 	{
 		std::string t = nextToken( line, pos );
@@ -2480,11 +2768,20 @@ bool Protocol::parseSpecial( const std::string &token, const std::string &line,
 		while ( (m = mg.next()) != mcNone )
 		{
 			std::cout << b.toSAN( m ) << ' ';
-			std::cout << b.see<false>(m) << " good " << (b.see<true>(m) >= 0) << std::endl;
+			std::cout << b.see<false>(m) << " good " << (b.see<true>(m) >= 0) << " ge0 " << b.seeGE(m, 0) << " ge1 " << b.seeGE(m, 1) << std::endl;
 		}
 
 		return 1;
 	}
+	if ( token == "smpstat" )
+	{
+		// helper thread sync cost of last search
+		engine.abortSearch();
+		const Search &s = engine.mainThread->search;
+		std::cout << "helpers " << s.smpThreads.size() << " syncs " << s.smpSyncCount
+			<< " sync time " << s.smpSyncMicros << " us" << std::endl;
+		return 1;
+	}
 	if ( token == "book" )
 	{
 		// special book debug
@@ -2514,28 +2811,153 @@ bool Protocol::parseSpecial( const std::string &token, const std::string &line,
 		}
 		return 1;
 	}
-	if ( token == "filterpgn" )
+	if ( token == "filterpgn" || token == "extractlinespgn" )
 	{
-		// filter pgn
-		filterPgn( line.c_str() + pos );
+		// filterpgn [threads n] [dedup mb] <file>
+		// extractlinespgn [threads n] [dedup mb] <file>
+		// threads default to Threads option
+		int threads = (int)engine.getThreads();
+		size_t dedupMB = 1024;
+
+		for (;;)
+		{
+			size_t tpos = pos;
+			std::string param = nextToken( line, tpos );
+
+			if ( param == "threads" )
+				threads = atoi( nextToken( line, tpos ).c_str() );
+			else if ( param == "dedup" )
+				dedupMB = (size_t)atoi( nextToken( line, tpos ).c_str() );
+			else
+				break;
+
+			pos = tpos;
+		}
+
+		if ( token == "filterpgn" )
+			filterPgn( line.c_str() + pos, threads, dedupMB );
+		else
+			extractLinesPgn( line.c_str() + pos, threads, dedupMB );
 		return 1;
 	}
-	if ( token == "extractlinespgn" )
+	if ( token == "labelfen" )
 	{
-		// extract lines from pgn
-		extractLinesPgn( line.c_str() + pos );
+		// labelfen [raw] [threads n] [depth n] [nodes n] [hash mb] [window n] [dedup mb] [dedupfile file] [out file] <file>
+		// threads default to Threads option
+		LabelFEN lf;
+		lf.threads = (int)engine.getThreads();
+		std::string fname;
+		std::string outname = "labelFEN_out.bin";
+
+		for (;;)
+		{
+			std::string param = nextToken( line, pos );
+
+			if ( param.empty() )
+				break;
+
+			if ( param == "raw" )
+			{
+				lf.rawOutput = 1;
+				continue;
+			}
+
+			if ( param != "threads" && param != "depth" && param != "nodes" && param != "hash" &&
+				param != "window" && param != "dedup" && param != "dedupfile" && param != "out" )
+			{
+				fname = param;
+				continue;
+			}
+
+			std::string value = nextToken( line, pos );
+
+			if ( param == "threads" )
+				lf.threads = atoi( value.c_str() );
+			else if ( param == "depth" )
+				lf.depth = (Depth)atoi( value.c_str() );
+			else if ( param == "nodes" )
+				lf.nodes = (NodeCount)strtoll( value.c_str(), 0, 10 );
+			else if ( param == "hash" )
+				lf.hashMB = (uint)atoi( value.c_str() );
+			else if ( param == "window" )
+				lf.window = (size_t)strtoll( value.c_str(), 0, 10 );
+			else if ( param == "dedup" )
+				lf.dedupMB = (size_t)atoi( value.c_str() );
+			else if ( param == "dedupfile" )
+				lf.dedupFile = value;
+			else
+				outname = value;
+		}
+
+		labelFen( lf, fname, outname );
 		return 1;
 	}
-	if ( token == "labelfen" )
+	if ( token == "unpacktrain" )
 	{
-		// label fen
-		labelFen( line.c_str() + pos );
+		std::string inname = nextToken( line, pos );
+		std::string outname = nextToken( line, pos );
+		unpackTrain( inname, outname );
 		return 1;
 	}
 	if ( token == "autoplay" )
 	{
-		// autoplay
-		autoplay();
+		// autoplay [games] [bloom] [raw] [threads n] [nodes n] [depth n] [plies n] [frc ratio] [dedup mb] [dedupfile file]
+		//     [positions n] [out file]
+		AutoPlay ap;
+		std::string outname = "autoplay.bin";
+		// try 400M positions
+		int64_t posLimit = U64C(400000000);
+
+		for (;;)
+		{
+			std::string param = nextToken( line, pos );
+
+			if ( param.empty() )
+				break;
+
+			if ( param == "games" )
+			{
+				ap.storeGames = 1;
+				continue;
+			}
+
+			if ( param == "bloom" )
+			{
+				ap.dedupBloom = 1;
+				continue;
+			}
+
+			if ( param == "raw" )
+			{
+				ap.rawOutput = 1;
+				continue;
+			}
+
+			std::string value = nextToken( line, pos );
+
+			if ( param == "threads" )
+				ap.threads = atoi( value.c_str() );
+			else if ( param == "nodes" )
+				ap.nodes = (NodeCount)strtoll( value.c_str(), 0, 10 );
+			else if ( param == "depth" )
+				ap.depth = (Depth)atoi( value.c_str() );
+			else if ( param == "plies" )
+				ap.randomPlies = atoi( value.c_str() );
+			else if ( param == "frc" )
+				ap.frcRatio = atof( value.c_str() );
+			else if ( param == "dedup" )
+				ap.dedupMB = atoi( value.c_str() );
+			else if ( param == "dedupfile" )
+				ap.dedupFile = value;
+			else if ( param == "positions" )
+				posLimit = strtoll( value.c_str(), 0, 10 );
+			else if ( param == "out" )
+				outname = value;
+			else
+				std::cout << "unknown autoplay parameter " << param << std::endl;
+		}
+
+		autoplay( ap, outname, posLimit );
 		return 1;
 	}
 	if ( token == "loadepd" )
@@ -2577,6 +2999,52 @@ bool Protocol::parseSpecial( const std::string &token, const std::string &line,
 		std::cout.flush();
 		return 1;
 	}
+	if ( token == "tune" || token == "tunecheck" )
+	{
+		// tune [threads n] [iterations n] [k x] [out file] <file>
+		// tunecheck [threads n] [k x] <file>: only check that psq/material tables affect error
+		// file: one "outcome fen" per line (see labelfen)
+		engine.abortSearch();
+		EvalTuner tuner;
+		tuner.threads = (int)engine.getThreads();
+		std::string fname;
+		std::string outname = "tune_out.txt";
+
+		for (;;)
+		{
+			std::string param = nextToken( line, pos );
+
+			if ( param.empty() )
+				break;
+
+			if ( param != "threads" && param != "iterations" && param != "k" && param != "out" )
+			{
+				fname = param;
+				continue;
+			}
+
+			std::string value = nextToken( line, pos );
+
+			if ( param == "threads" )
+				tuner.threads = atoi( value.c_str() );
+			else if ( param == "iterations" )
+				tuner.iterations = atoi( value.c_str() );
+			else if ( param == "k" )
+				tuner.k = atof( value.c_str() );
+			else
+				outname = value;
+		}
+
+		if ( !tuner.load( fname.c_str() ) )
+			std::cout << "failed to load " << fname << std::endl;
+		else if ( token == "tunecheck" )
+			std::cout << (tuner.checkPsq() ? "all ok" : "psq/material tables don't affect error") << std::endl;
+		else if ( !tuner.tune( outname.c_str() ) )
+			std::cout << "failed to write " << outname << std::endl;
+		else
+			std::cout << "all ok" << std::endl;
+		return 1;
+	}
 #endif
 	return 0;
 }
@@ -40,6 +40,7 @@ enum ProtoType
 };
 
 class Engine;
+class OutputThread;
 struct SearchInfo;
 
 class Protocol
@@ -49,9 +50,10 @@ class Protocol
 	// or 50 msec, whichever is higher
 	static const int fixedTimeMargin = 50;
 
-	std::stringstream sendStr;				// send string
+	TextBuffer sendStr;						// send buffer (reused)
 	Mutex mutex;							// send mutex
 	Mutex parseMutex;						// parse mutex
+	OutputThread *output;					// asynchronous output (0 = write directly)
 
 	// CECP specific stuff
 	struct Level
@@ -121,6 +123,12 @@ class Protocol
 	bool parseCECPEdit( const std::string &line );
 	// parse special (nonstd) command
 	bool parseSpecial( const std::string &token, const std::string &line, size_t &pos );
+	bool parseSpecialInternal( const std::string &token, const std::string &line, size_t &pos );
+
+	// format search info into send buffer
+	void formatInfo( const SearchInfo &si );
+	// info line formatting microbench
+	void ibench();
 
 	// allocate think time based on TC
 	void allocTime( i32 mytime, i32 myinc, i32 optime, i32 opinc, i32 movestogo, SearchMode &sm );
@@ -138,6 +146,10 @@ public:
 	// called from search
 	void searchCallback( const SearchInfo &si );
 
+	// route output through writer thread (0 = write directly)
+	// flushes pending output before switching
+	void setOutput( OutputThread *out );
+
 	// start sending (reset buffer)
 	void sendStart( uint flags );
 	// start sending
@@ -0,0 +1,149 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "repetition.h"
+#include "board.h"
+
+namespace cheng4
+{
+
+// Cuckoo
+
+Signature Cuckoo::keys[ Cuckoo::size ];
+u8 Cuckoo::from[ Cuckoo::size ];
+u8 Cuckoo::to[ Cuckoo::size ];
+
+void Cuckoo::init()
+{
+	memset( keys, 0, sizeof(keys) );
+	memset( from, 0, sizeof(from) );
+	memset( to, 0, sizeof(to) );
+
+	uint count = 0;
+
+	for ( Color c = ctWhite; c <= ctBlack; c++ )
+	{
+		for ( Piece p = ptKnight; p <= ptKing; p++ )
+		{
+			for ( Square s1 = 0; s1 < 64; s1++ )
+			{
+				Bitboard targets;
+				switch( p )
+				{
+				case ptKnight:
+					targets = Tables::knightAttm[ s1 ];
+					break;
+				case ptBishop:
+					targets = Tables::diagAttm[ s1 ];
+					break;
+				case ptRook:
+					targets = Tables::orthoAttm[ s1 ];
+					break;
+				case ptQueen:
+					targets = Tables::diagAttm[ s1 ] | Tables::orthoAttm[ s1 ];
+					break;
+				default:
+					targets = Tables::kingAttm[ s1 ];
+				}
+
+				// only store each move once (from < to)
+				targets &= ~((BitOp::oneShl( s1 ) << 1) - 1);
+
+				while ( targets )
+				{
+					Square s2 = BitOp::popBit( targets );
+					count++;
+
+					Signature key = Zobrist::piece[ c ][ p ][ s1 ] ^ Zobrist::piece[ c ][ p ][ s2 ] ^ Zobrist::turn;
+					u8 kfrom = s1;
+					u8 kto = s2;
+
+					// insert, kicking out existing entries
+					uint i = hash1( key );
+					for (;;)
+					{
+						std::swap( keys[i], key );
+						std::swap( from[i], kfrom );
+						std::swap( to[i], kto );
+						if ( !key )
+							break;
+						i = i == hash1( key ) ? hash2( key ) : hash1( key );
+					}
+				}
+			}
+		}
+	}
+
+	// total number of reversible non-pawn moves for both colors
+	assert( count == 3668 );
+	(void)count;
+}
+
+// RepHash
+
+bool RepHash::hasUpcomingRep( const Board &b ) const
+{
+	assert( ptr > 0 && rep[ (ptr-1) & ringMask ] == b.sig() );
+
+	int top = (int)ptr-1;
+	int end = top - (int)first();
+	if ( end < 3 )
+		return 0;
+
+	Signature cur = rep[ top & ringMask ];
+	// accumulates opponent's moves; zero means they all cancel out
+	Signature other = cur ^ rep[ (top-1) & ringMask ] ^ Zobrist::turn;
+
+	for ( int i = 3; i <= end; i += 2 )
+	{
+		other ^= rep[ (top-i+1) & ringMask ] ^ rep[ (top-i) & ringMask ] ^ Zobrist::turn;
+		if ( other )
+			continue;
+
+		Signature moveKey = cur ^ rep[ (top-i) & ringMask ];
+		uint j = Cuckoo::hash1( moveKey );
+		if ( Cuckoo::keys[j] != moveKey )
+		{
+			j = Cuckoo::hash2( moveKey );
+			if ( Cuckoo::keys[j] != moveKey )
+				continue;
+		}
+
+		Square s1 = Cuckoo::from[j];
+		Square s2 = Cuckoo::to[j];
+		Bitboard ends = BitOp::oneShl( s1 ) | BitOp::oneShl( s2 );
+
+		// path must be clear
+		if ( Tables::between[ s1 ][ s2 ] & ~ends & b.occupied() )
+			continue;
+
+		// and the piece must be ours
+		Piece p = b.piece( b.isVacated( s1 ) ? s2 : s1 );
+		if ( PiecePack::color( p ) == b.turn() )
+			return 1;
+	}
+	return 0;
+}
+
+}
@@ -21,24 +21,58 @@ or as public domain (where applicable)
   3. This notice may not be removed or altered from any source distribution.
 */
 
+
 #pragma once
 
 #include "chtypes.h"
 #include <cassert>
 #include <memory.h>
+#include <algorithm>
 
 namespace cheng4
 {
 
-typedef u16 repIndex;
+class Board;
+
+typedef uint repIndex;
+
+// cuckoo tables of reversible moves, keyed by zobrist difference (upcoming repetition detection)
+struct Cuckoo
+{
+	// must be a power of 2
+	static const uint size = 8192;
+
+	static Signature keys[ size ];		// move keys (0 = empty)
+	static u8 from[ size ];				// move from square
+	static u8 to[ size ];				// move to square
+
+	static inline uint hash1( Signature key )
+	{
+		return (uint)key & (size-1);
+	}
+
+	static inline uint hash2( Signature key )
+	{
+		return (uint)(key >> 16) & (size-1);
+	}
+
+	// static init, needs Tables and Zobrist
+	static void init();
+};
 
-// FIXME: rethink completely
 // repetition stack
+// signatures are kept in a ring (only positions since last irreversible move matter),
+// a small counting filter of pushed signatures rejects most lookups without scanning
 struct RepHash
 {
+	static const repIndex ringMask = repHashMax-1;
+	// must be a power of 2
+	static const uint filterSize = 512;
+
 	Signature rep[ repHashMax ];		// repetition signatures
 	u8 res[ repHashMax ];				// fifty counter reset flag (1=just captured/moved a pawn)
 	repIndex start[ repHashMax ];		// starting pointers
+	u16 filter[ filterSize ];			// number of pushed signatures per bucket
 	repIndex ptr;						// stack ptr
 	repIndex sptr;						// starting stack ptr
 
@@ -54,9 +88,10 @@ struct RepHash
 	{
 		ptr = o.ptr;
 		sptr = o.sptr;
-		memcpy( start, o.start, sptr*sizeof(repIndex) );
-		memcpy( res, o.res, ptr*sizeof(u8) );
-		memcpy( rep, o.rep, ptr*sizeof(Signature) );
+		memcpy( start, o.start, std::min<repIndex>( sptr, repHashMax )*sizeof(repIndex) );
+		memcpy( res, o.res, std::min<repIndex>( ptr, repHashMax )*sizeof(u8) );
+		memcpy( rep, o.rep, std::min<repIndex>( ptr, repHashMax )*sizeof(Signature) );
+		memcpy( filter, o.filter, sizeof(filter) );
 	}
 
 	// clear rep hash
@@ -64,36 +99,64 @@ struct RepHash
 	{
 		assert( this );
 		sptr = ptr = 0;
+		memset( filter, 0, sizeof(filter) );
+	}
+
+	// index of first position after last irreversible move
+	inline repIndex first() const
+	{
+		repIndex idx = sptr > 0 ? start[ (sptr - 1) & ringMask ] : 0;
+		// can't look beyond ring capacity
+		if ( ptr > repHashMax && idx < ptr - repHashMax )
+			idx = ptr - repHashMax;
+		return idx;
 	}
 
 	// is repetition?
 	inline bool isRep( Signature h ) const
 	{
+		// h itself is usually on top of the stack so we need at least one more hit
+		uint needed = 1 + (ptr > 0 && rep[ (ptr-1) & ringMask ] == h);
+		if ( filter[ (uint)h & (filterSize-1) ] < needed )
+			return 0;
+
 		// the position below first resulted from a pawn move/capture
 		int i;
-		repIndex first = sptr > 0 ? start[ sptr - 1 ] : 0;
+		int first = (int)this->first();
 		for (i = (int)ptr-3; i >= first; i -= 2 )
 		{
-			if ( rep[i] == h )
+			if ( rep[ i & ringMask ] == h )
 				break;
 		}
 		return i >= first;
 	}
+
+	// returns 1 if stm can repeat a position since last irreversible move with a single reversible move
+	// (so it can force a draw one ply earlier than isRep would detect it)
+	// assumes current position is on top of the stack
+	bool hasUpcomingRep( const Board &b ) const;
+
 	inline void push( Signature h, bool reset )
 	{
 		if ( reset )
+			start[ sptr++ & ringMask ] = ptr;
+		if ( ptr >= repHashMax )
 		{
-			assert( sptr < repHashMax-1 );
-			start[ sptr++ ] = ptr;
+			// overwriting oldest entry in the ring
+			Signature old = rep[ ptr & ringMask ];
+			assert( filter[ (uint)old & (filterSize-1) ] > 0 );
+			filter[ (uint)old & (filterSize-1) ]--;
 		}
-		res[ ptr ] = reset ? 1 : 0;
-		assert( ptr < repHashMax-1 );
-		rep[ ptr++ ] = h;
+		res[ ptr & ringMask ] = reset ? 1 : 0;
+		filter[ (uint)h & (filterSize-1) ]++;
+		rep[ ptr++ & ringMask ] = h;
 	}
 	inline void pop()
 	{
 		assert( ptr > 0 );
-		if ( res[ --ptr ] )
+		--ptr;
+		filter[ (uint)rep[ ptr & ringMask ] & (filterSize-1) ]--;
+		if ( res[ ptr & ringMask ] )
 		{
 			assert( sptr > 0 );
 			sptr--;
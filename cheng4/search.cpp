@@ -64,16 +64,28 @@ void SearchInfo::reset()
 // Search::RootMoves
 
 Search::RootMoves &Search::RootMoves::operator =( const RootMoves &o )
+{
+	copyMoves( o );
+	bestMove = o.bestMove;
+	bestScore = o.bestScore;
+	return *this;
+}
+
+void Search::RootMoves::copyMoves( const RootMoves &o )
 {
 	discovered = o.discovered;
 	count = o.count;
 	for ( size_t i=0; i<count; i++ ) {
-		moves[i] = o.moves[i];
+		RootMove &dst = moves[i];
+		const RootMove &src = o.moves[i];
+		dst.move = src.move;
+		dst.score = src.score;
+		dst.nodes = src.nodes;
+		dst.pvCount = src.pvCount;
+		// only copy valid part of pv (including terminator)
+		memcpy( dst.pv, src.pv, std::min<size_t>( src.pvCount+1, maxPV ) * sizeof(Move) );
 		sorted[i] = moves + (o.sorted[i] - o.moves);
 	}
-	bestMove = o.bestMove;
-	bestScore = o.bestScore;
-	return *this;
 }
 
 // Search
@@ -286,7 +298,7 @@ template< bool pv, bool incheck > Score Search::qsearch( Ply ply, Depth depth, S
 
 	history->previous = ply > 0 ? stack[ply-1].current : mcNull;
 	initHistoryCtx(ply);
-	MoveGen mg( board, stack[ply].killers, stack[ply].ctx, *history, qchecks ? mmQCapsChecks : mmQCaps );
+	MoveGen mg( board, stack[ply].killers, stack[ply].ctx, *history, qchecks ? mmQCapsChecks : mmQCaps, attacks(ply) );
 	Move m;
 	Move bestMove = mcNone;
 
@@ -311,6 +323,7 @@ template< bool pv, bool incheck > Score Search::qsearch( Ply ply, Depth depth, S
 
 		UndoInfo ui;
 		eval.netInitUndo(ui, cacheStack[ply+1].cache);
+		attacksInitUndo(ui, ply);
 		board.doMove( m, ui, ischeck );
 		rep.push( board.sig(), !board.fifty() );
 
@@ -406,6 +419,14 @@ template< bool pv, bool incheck, bool donull >
 	if ( isDraw() )
 		return scDraw;
 
+	// stm can force a repetition with a single reversible move
+	if ( alpha < scDraw && rep.hasUpcomingRep( board ) )
+	{
+		alpha = scDraw;
+		if ( alpha >= beta )
+			return alpha;
+	}
+
 	// maximum ply reached?
 	if ( ply >= maxPly )
 		return scDraw;
@@ -524,6 +545,7 @@ template< bool pv, bool incheck, bool donull >
 
 		UndoInfo ui;
 		eval.netInitUndo(ui, cacheStack[ply+1].cache);
+		attacksInitUndo(ui, ply);
 		board.doNullMove( ui );
 		stack[ ply ].current = mcNull;
 
@@ -564,7 +586,7 @@ template< bool pv, bool incheck, bool donull >
 
 	history->previous = ply > 0 ? stack[ply-1].current : mcNull;
 	initHistoryCtx(ply);
-	MoveGen mg( board, stack[ply].killers, stack[ply].ctx, *history, mmNormal );
+	MoveGen mg( board, stack[ply].killers, stack[ply].ctx, *history, mmNormal, attacks(ply) );
 	Move m;
 	Move bestMove = mcNone;
 	size_t count = 0;			// move count
@@ -635,7 +657,7 @@ template< bool pv, bool incheck, bool donull >
 				continue;
 
 			// SEE pruning
-			if (!MovePack::isSpecial(m) && board.see<1>(m) < 0)
+			if (!MovePack::isSpecial(m) && !board.seeGE(m, 0, attacks(ply)))
 				continue;
 		}
 
@@ -645,6 +667,7 @@ template< bool pv, bool incheck, bool donull >
 
 		UndoInfo ui;
 		eval.netInitUndo(ui, cacheStack[ply+1].cache);
+		attacksInitUndo(ui, ply);
 		board.doMove( m, ui, ischeck );
 		rep.push( board.sig(), !board.fifty() );
 
@@ -758,11 +781,12 @@ template< bool pv, bool incheck, bool donull >
 	return best;
 }
 
-Search::Search( size_t evalKilo, size_t pawnKilo, size_t matKilo ) : startTicks(0), nodeTicks(0),
+Search::Search( size_t evalKilo, size_t pawnKilo, size_t matKilo ) : useAttacks(0), startTicks(0), nodeTicks(0),
 	timeOutCounter(0), triPV(0), newMultiPV(0), selDepth(0), tt(0), nodes(0), age(0), callback(0),
 	callbackParam(0), canStop(0), abortRequest(0), aborting(0), abortingSmp(0),
 	outputBest(1), ponderHit(0), maxThreads(511), eloLimit(0), maxElo(2700), contemptFactor(scDraw),
-	minQsDepth(-maxDepth), verbose(1), verboseFixed(1), searchFlags(0), startSearch(0), master(0)
+	minQsDepth(-maxDepth), verbose(1), verboseFixed(1), searchFlags(0), smpShared(0), smpSyncId(0),
+	smpSyncMicros(0), smpSyncCount(0), startSearch(0), master(0)
 {
 	cacheStack.resize(maxStack);
 	history = new History;
@@ -983,6 +1007,7 @@ Score Search::root( Depth depth, Score alpha, Score beta )
 
 		UndoInfo ui;
 		eval.netInitUndo(ui, cacheStack[1].cache);
+		attacksInitUndo(ui, 0);
 
 		board.doMove( rm.move, ui, isCheck );
 		rep.push( board.sig(), !board.fifty() );
@@ -1222,6 +1247,7 @@ Score Search::iterate( const Board &b, const SearchMode &sm, bool nosendbest )
 
 	board = b;
 	eval.updateNetCache(board, cacheStack[0].cache);
+	initAttacks();
 	mode = sm;
 
 	Killer killers(0);
@@ -1656,6 +1682,13 @@ void Search::setThreads( size_t nt )
 	for ( size_t i=0; i < smpThreads.size(); i++)
 		smpThreads[i]->kill();
 	smpThreads.clear();
+	delete smpShared;
+	smpShared = 0;
+	if ( nt )
+	{
+		smpShared = new SmpShared;
+		smpShared->syncId = 0;
+	}
 	for ( size_t i=0; i < nt; i++)
 	{
 		LazySMPThread *smpt = new LazySMPThread;
@@ -1720,11 +1753,41 @@ void Search::enableNullMove( bool enable )
 		searchFlags &= ~sfNoNullMove;
 }
 
+// enable attack map
+void Search::enableAttackMap( bool enable )
+{
+	if ( enable )
+		searchFlags |= sfAttackMap;
+	else
+		searchFlags &= ~sfAttackMap;
+}
+
+void Search::initAttacks()
+{
+	useAttacks = (searchFlags & sfAttackMap) != 0;
+
+	if ( !useAttacks )
+		return;
+
+	if ( attStack.empty() )
+		attStack.resize( maxStack );
+
+	attStack[0].init( board );
+}
+
 void Search::smpStart( Depth depth, Score alpha, Score beta )
 {
 	abortingSmp = 0;
+	if ( smpThreads.empty() )
+		return;
+
+	u64 t0 = Timer::getMicrosec();
+	// single copy; helpers pull it themselves
+	smpShared->rootMoves.copyMoves( rootMoves );
 	for ( size_t i=0; i<smpThreads.size(); i++ )
 		smpThreads[i]->start( depth + (Depth)((i&1)^1), alpha, beta, *this );
+	smpSyncMicros += Timer::getMicrosec() - t0;
+	smpSyncCount++;
 }
 
 void Search::smpStop()
@@ -1733,24 +1796,49 @@ void Search::smpStop()
 		smpThreads[i]->abort();
 }
 
-void Search::smpSync() const
+void Search::smpSync()
+{
+	smpSyncMicros = 0;
+	smpSyncCount = 0;
+	if ( smpThreads.empty() )
+		return;
+
+	u64 t0 = Timer::getMicrosec();
+	// publish snapshot once, independent of number of helpers
+	SmpShared &sh = *smpShared;
+	sh.board = board;
+	sh.rep.copyFrom( rep );
+	sh.history = *history;
+	sh.age = age;
+	// never use timeout for smp helper threads!
+	sh.searchFlags = searchFlags | sfNoTimeout;
+	sh.syncId++;
+	smpSyncMicros += Timer::getMicrosec() - t0;
+	smpSyncCount++;
+}
+
+void Search::smpPrepare( const SmpShared &sh )
+{
+	// reset counters before master continues
+	if ( smpSyncId != sh.syncId )
+		initIteration();
+}
+
+void Search::smpPull( const SmpShared &sh )
 {
-	for ( size_t i=0; i<smpThreads.size(); i++)
+	if ( smpSyncId != sh.syncId )
 	{
-		// synchronize smp threads
-		assert( !smpThreads[i]->searching );
-		Search &s = smpThreads[i]->search;
-		s.initIteration();
-		s.age = age;
-		s.board = board;
-		s.eval.updateNetCache(board, s.cacheStack[0].cache);
-		// FIXME: better?
-		s.rep.copyFrom(rep);
-		*s.history = *history;
-		s.rootMoves = rootMoves;
-		// never use timeout for smp helper threads!
-		s.searchFlags = searchFlags | sfNoTimeout;
+		// new search: pull position, repetition stack and history
+		smpSyncId = sh.syncId;
+		age = sh.age;
+		board = sh.board;
+		eval.updateNetCache( board, cacheStack[0].cache );
+		rep.copyFrom( sh.rep );
+		*history = sh.history;
+		searchFlags = sh.searchFlags;
+		initAttacks();
 	}
+	rootMoves.copyMoves( sh.rootMoves );
 }
 
 // static init
@@ -1813,13 +1901,16 @@ void LazySMPThread::work()
 		alpha = c.alpha;
 		beta = c.beta;
 		search.mode.multiPV = c.multiPV;
-		search.rootMoves = c.rootMoves;
+		const Search::SmpShared &shared = *c.shared;
+		search.smpPrepare( shared );
 		search.abortRequest = 0;
 		search.aborting = 0;
 		search.rootMoves.bestMove = mcNone;
 		searching = 1;
+		// master doesn't touch the snapshot until we're done so we can let it go now
 		startedSearch.signal();
 
+		search.smpPull( shared );
 		assert( search.searchFlags & sfNoTimeout );
 		search.root( depth, alpha, beta );
 
@@ -1841,7 +1932,7 @@ void LazySMPThread::start( Depth depth, Score alpha, Score beta, const Search &m
 	cd.depth = depth;
 	cd.alpha = alpha;
 	cd.beta = beta;
-	cd.rootMoves = master.rootMoves;
+	cd.shared = master.smpShared;
 	cd.multiPV = master.mode.multiPV;
 
 	commandEvent.signal();
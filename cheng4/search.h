@@ -30,6 +30,7 @@ or as public domain (where applicable)
 #include "eval.h"
 #include "repetition.h"
 #include "thread.h"
+#include "attacks.h"
 #include <vector>
 
 namespace cheng4
@@ -57,7 +58,8 @@ enum SearchFlags
 {
 	sfNoTimeout		=	1,
 	sfNoNullMove	=	2,
-	sfNoTablebase	=	4
+	sfNoTablebase	=	4,
+	sfAttackMap		=	8
 };
 
 enum SearchInfoFlags
@@ -134,6 +136,8 @@ struct Search
 
 	Stack stack[ maxStack ];		// search stack
 	std::vector<NetCacheStack> cacheStack;
+	std::vector<AttackMap> attStack;	// attack map stack (copy-make, only allocated if enabled)
+	bool useAttacks;				// attack map used by current search (latched at root)
 
 	RepHash rep;					// repetition stack
 	i32 startTicks;					// start ticks
@@ -211,11 +215,31 @@ struct Search
 		inline RootMoves() {}
 		inline RootMoves( const RootMoves &o ) { *this = o; }
 		RootMoves &operator =( const RootMoves &o );
+		// copy moves only (leaves bestMove/bestScore alone)
+		void copyMoves( const RootMoves &o );
 	};
 
 	RootMoves rootMoves;
 	RootMovePtrPred rootPred;
 
+	// read-only root snapshot published by master for helper threads
+	// helpers pull from it in their own thread so sync cost doesn't depend on thread count
+	struct SmpShared
+	{
+		Board board;
+		RepHash rep;
+		History history;
+		RootMoves rootMoves;
+		Age age;
+		u8 searchFlags;
+		uint syncId;					// incremented on each smpSync
+	};
+
+	SmpShared *smpShared;				// master only: shared snapshot (null = no helpers)
+	uint smpSyncId;						// helper only: last pulled snapshot id
+	u64 smpSyncMicros;					// master only: time spent syncing helpers during last search
+	uint smpSyncCount;					// master only: number of syncs during last search
+
 	Event startSearch;					// start search event (signaled when it's safe to set abort flag!)
 										// note: manual reset event
 
@@ -264,6 +288,24 @@ struct Search
 	// copy underlying PV
 	void copyPV( Ply ply );
 
+	// init root attack map if enabled (board must be set)
+	void initAttacks();
+
+	// attack map for ply (null if not used)
+	inline const AttackMap *attacks( Ply ply ) const
+	{
+		return useAttacks ? &attStack[ply] : nullptr;
+	}
+
+	// copy attack map to next ply before doMove
+	inline void attacksInitUndo( UndoInfo &ui, Ply ply )
+	{
+		if ( !useAttacks )
+			return;
+		attStack[ply+1] = attStack[ply];
+		ui.attacks = &attStack[ply+1];
+	}
+
 	inline void initHistoryCtx(Ply ply)
 	{
 		for (int hi=0; hi<Zobrist::contextMoveMax; hi++)
@@ -387,6 +429,9 @@ struct Search
 	// enable nullmove flag
 	void enableNullMove( bool enable );
 
+	// enable attack map (used by see)
+	void enableAttackMap( bool enable );
+
 	// disable tablebase flag
 	void disableTablebase( bool flag );
 
@@ -395,7 +440,11 @@ struct Search
 	// stop root smp search
 	void smpStop();
 	// sync smp threads (before iteration starts)
-	void smpSync() const;
+	void smpSync();
+	// prepare helper for search (before master is released)
+	void smpPrepare( const SmpShared &sh );
+	// pull shared snapshot (helper thread)
+	void smpPull( const SmpShared &sh );
 
 	// return number of nodes searched
 	inline NodeCount smpNodes() const;
@@ -423,7 +472,7 @@ public:
 		Depth depth;
 		Score alpha;
 		Score beta;
-		Search::RootMoves rootMoves;
+		const Search::SmpShared *shared;
 		uint multiPV;
 	} commandData;
 
@@ -22,6 +22,7 @@ or as public domain (where applicable)
 */
 
 #include "board.h"
+#include "attacks.h"
 #include <algorithm>
 
 namespace cheng4
@@ -145,4 +146,148 @@ namespace cheng4
 	template int Board::see<0>( Move m ) const;
 	template int Board::see<1>( Move m ) const;
 
+	// threshold see core: occ excludes from, attk holds all attackers to 'to' using occ
+	bool Board::seeGEFrom( Square from, Square to, int threshold, Bitboard occ, Bitboard attk,
+		Bitboard diagSliders, Bitboard orthoSliders ) const
+	{
+		Piece pieceFrom = piece( from );
+		Piece pto = from == to ? (Piece)ptNone : PiecePack::type( piece( to ) );
+
+		// balance from the point of view of the side which is about to recapture
+		int swap = Tables::seeValue[ pto ] - threshold;
+		if ( swap < 0 )
+			return 0;
+		swap = Tables::seeValue[ PiecePack::type( pieceFrom ) ] - swap;
+		if ( swap <= 0 )
+			return 1;
+
+		Bitboard allSliders = diagSliders | orthoSliders;
+		Color stm = PiecePack::color( pieceFrom );
+		// result if stm stops capturing now
+		int res = 1;
+
+		for (;;)
+		{
+			stm = flip( stm );
+			Bitboard stmAttk = attk & pieces( stm );
+			if ( !stmAttk )
+				break;
+
+			res ^= 1;
+
+			Piece p;
+			Bitboard tmp = 0;
+			for ( p = ptPawn; p <= ptQueen; p++ )
+				if ( (tmp = stmAttk & pieces( stm, p )) != 0 )
+					break;
+
+			if ( p == ptKing )
+				// king can only capture if opponent has no attackers left
+				return (attk & pieces( flip(stm) )) ? !res : res != 0;
+
+			swap = Tables::seeValue[ p ] - swap;
+			if ( swap < res )
+				break;
+
+			Bitboard attacker = (tmp & ((Bitboard)0-tmp));		// isolate LSBit of attacker
+			attk ^= attacker;
+			occ ^= attacker;
+
+			// add hidden attackers
+			switch(p)
+			{
+			case ptPawn:
+			case ptBishop:
+				attk |= Magic::bishopAttm( to, occ ) & diagSliders & occ;
+				break;
+			case ptRook:
+				attk |= Magic::rookAttm( to, occ ) & orthoSliders & occ;
+				break;
+			case ptQueen:
+				attk |= Magic::queenAttm( to, occ ) & allSliders & occ;
+				break;
+			}
+		}
+
+		return res != 0;
+	}
+
+	bool Board::seeGE( Move m, int threshold, const AttackMap *am ) const
+	{
+		if ( MovePack::isCastling( m ) || MovePack::isEpCapture( m ) )
+			return 0 >= threshold;
+
+		Square from = MovePack::from( m );
+		Square to = MovePack::to( m );
+
+		Bitboard occ = occupied() & BitOp::noneShl( from );
+		Bitboard attk;
+
+		if ( am )
+		{
+			attk = am->attackersTo( to ) & occ;
+
+			// moving piece may uncover a slider on the same line
+			if ( Tables::diagAttm[ to ] & BitOp::oneShl( from ) )
+				attk |= Magic::bishopAttm( to, occ ) & diagSliders() & occ;
+			else if ( Tables::orthoAttm[ to ] & BitOp::oneShl( from ) )
+				attk |= Magic::rookAttm( to, occ ) & orthoSliders() & occ;
+
+			assert( attk == allAttacksTo( to, occ ) );
+		}
+		else
+			attk = allAttacksTo( to, occ );
+
+		bool res = seeGEFrom( from, to, threshold, occ, attk, diagSliders(), orthoSliders() );
+		assert( res == (see<0>( m ) >= threshold) );
+		return res;
+	}
+
+	void Board::seeGEBatch( const Move *moves, int count, int threshold, bool *res, const AttackMap *am ) const
+	{
+		Bitboard occ = occupied();
+		Bitboard diagSliders = this->diagSliders();
+		Bitboard orthoSliders = this->orthoSliders();
+
+		// attackers to target squares (full occupancy), computed on demand
+		Bitboard targetAttk[64];
+		Bitboard targets = 0;
+
+		for ( int i=0; i<count; i++ )
+		{
+			Move m = moves[i];
+			if ( MovePack::isCastling( m ) || MovePack::isEpCapture( m ) )
+			{
+				res[i] = 0 >= threshold;
+				continue;
+			}
+
+			Square from = MovePack::from( m );
+			Square to = MovePack::to( m );
+			Bitboard frommask = BitOp::oneShl( from );
+			Bitboard tomask = BitOp::oneShl( to );
+
+			if ( !(targets & tomask) )
+			{
+				targets |= tomask;
+				targetAttk[ to ] = am ? am->attackersTo( to ) : allAttacksTo( to, occ );
+				assert( targetAttk[ to ] == allAttacksTo( to, occ ) );
+			}
+
+			Bitboard tocc = occ ^ frommask;
+			Bitboard attk = targetAttk[ to ] & tocc;
+
+			// moving piece may uncover a slider on the same line
+			if ( Tables::diagAttm[ to ] & frommask )
+				attk |= Magic::bishopAttm( to, tocc ) & diagSliders & tocc;
+			else if ( Tables::orthoAttm[ to ] & frommask )
+				attk |= Magic::rookAttm( to, tocc ) & orthoSliders & tocc;
+
+			assert( attk == allAttacksTo( to, tocc ) );
+
+			res[i] = seeGEFrom( from, to, threshold, tocc, attk, diagSliders, orthoSliders );
+			assert( res[i] == (see<0>( m ) >= threshold) );
+		}
+	}
+
 }
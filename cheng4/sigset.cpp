@@ -0,0 +1,315 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "sigset.h"
+#include <new>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+namespace cheng4
+{
+
+// SigSet
+
+SigSet::SigSet() : data(0), size(0), setMode(ssExact), baseCount(0), numInserted(0), numDups(0), numOverflows(0)
+{
+}
+
+SigSet::~SigSet()
+{
+	release();
+}
+
+void SigSet::release()
+{
+	delete[] data;
+	data = 0;
+	size = 0;
+}
+
+bool SigSet::init( size_t sizeBytes, Mode mode )
+{
+	release();
+	setMode = mode;
+
+	size_t words = sizeBytes / sizeof(u64);
+
+	if ( !words )
+	{
+		clear();
+		return 1;
+	}
+
+	// round down to power of two
+	size_t pow2 = 1;
+
+	while ( pow2*2 <= words )
+		pow2 *= 2;
+
+	data = new(std::nothrow) std::atomic<u64>[ pow2 ];
+
+	if ( !data )
+	{
+		clear();
+		return 0;
+	}
+
+	size = pow2;
+	clear();
+	return 1;
+}
+
+bool SigSet::initFor( u64 count, size_t maxBytes, Mode mode )
+{
+	// exact: load factor below 1/2
+	u64 words = 1024;
+
+	while ( words < 2*count )
+		words *= 2;
+
+	if ( mode == ssExact && words * sizeof(u64) <= maxBytes )
+		return init( (size_t)(words * sizeof(u64)), ssExact );
+
+	// bloom: ~16 bits per signature keeps false duplicates well below 1%
+	u64 bytes = 1 << 20;
+
+	while ( bytes < 2*count && bytes < maxBytes )
+		bytes *= 2;
+
+	return init( (size_t)std::min< u64 >( bytes, std::max< size_t >( maxBytes, 1 << 20 ) ), ssBloom );
+}
+
+void SigSet::clear()
+{
+	for ( size_t i=0; i<size; i++ )
+		data[i].store( 0, std::memory_order_relaxed );
+
+	baseCount = 0;
+	numInserted = 0;
+	numDups = 0;
+	numOverflows = 0;
+}
+
+static const char sigSetMagic[4] = { 'C', 'H', 'S', 'S' };
+// words per file block
+static const size_t sigSetBlock = 65536;
+
+bool SigSet::save( const char *fname ) const
+{
+	FILE *f = fopen( fname, "wb" );
+
+	if ( !f )
+		return 0;
+
+	// note: native byte order
+	u32 mode = (u32)setMode;
+	u64 words = size;
+	u64 cnt = count();
+
+	bool res = fwrite( sigSetMagic, 1, 4, f ) == 4 && fwrite( &mode, sizeof(mode), 1, f ) == 1 &&
+		fwrite( &words, sizeof(words), 1, f ) == 1 && fwrite( &cnt, sizeof(cnt), 1, f ) == 1;
+
+	std::vector< u64 > buf;
+
+	for ( size_t i=0; res && i<size; i += sigSetBlock )
+	{
+		size_t n = std::min( sigSetBlock, size - i );
+		buf.resize( n );
+
+		for ( size_t j=0; j<n; j++ )
+			buf[j] = data[i+j].load( std::memory_order_relaxed );
+
+		res = fwrite( buf.data(), sizeof(u64), n, f ) == n;
+	}
+
+	res &= fclose( f ) == 0;
+	return res;
+}
+
+bool SigSet::load( const char *fname )
+{
+	FILE *f = fopen( fname, "rb" );
+
+	if ( !f )
+		return 0;
+
+	char magic[4];
+	u32 mode = 0;
+	u64 words = 0;
+	u64 cnt = 0;
+
+	bool res = fread( magic, 1, 4, f ) == 4 && !memcmp( magic, sigSetMagic, 4 ) &&
+		fread( &mode, sizeof(mode), 1, f ) == 1 && fread( &words, sizeof(words), 1, f ) == 1 &&
+		fread( &cnt, sizeof(cnt), 1, f ) == 1 && mode <= ssBloom && words && !(words & (words-1)) &&
+		words <= ((u64)1 << 40) / sizeof(u64);
+
+	res = res && init( (size_t)words * sizeof(u64), (Mode)mode ) && size == words;
+
+	std::vector< u64 > buf;
+
+	for ( size_t i=0; res && i<size; i += sigSetBlock )
+	{
+		size_t n = std::min( sigSetBlock, size - i );
+		buf.resize( n );
+		res = fread( buf.data(), sizeof(u64), n, f ) == n;
+
+		for ( size_t j=0; res && j<n; j++ )
+			data[i+j].store( buf[j], std::memory_order_relaxed );
+	}
+
+	fclose( f );
+
+	if ( !res )
+	{
+		release();
+		clear();
+		return 0;
+	}
+
+	baseCount = cnt;
+	return 1;
+}
+
+void SigSet::swap( SigSet &o )
+{
+	std::swap( data, o.data );
+	std::swap( size, o.size );
+	std::swap( setMode, o.setMode );
+	std::swap( baseCount, o.baseCount );
+}
+
+bool SigSet::grow( u64 cnt, size_t maxBytes )
+{
+	// exact: load factor below 1/2
+	const u64 total = count() + cnt;
+
+	if ( setMode == ssBloom || 2*total <= size )
+		return 1;
+
+	SigSet tmp;
+
+	if ( !tmp.initFor( total, std::max( maxBytes, sizeBytes() ), ssExact ) )
+		return 0;
+
+	for ( size_t i=0; i<size; i++ )
+	{
+		u64 sig = data[i].load( std::memory_order_relaxed );
+
+		if ( sig )
+			tmp.insert( sig );
+	}
+
+	tmp.baseCount = count();
+	swap( tmp );
+
+	numInserted = 0;
+	numDups = 0;
+	numOverflows = 0;
+	return 1;
+}
+
+bool SigSet::insert( Signature sig )
+{
+	if ( !size )
+	{
+		numOverflows.fetch_add( 1, std::memory_order_relaxed );
+		return 1;
+	}
+
+	bool res = setMode == ssBloom ? insertBloom( sig ) : insertExact( sig );
+
+	if ( res )
+		numInserted.fetch_add( 1, std::memory_order_relaxed );
+	else
+		numDups.fetch_add( 1, std::memory_order_relaxed );
+
+	return res;
+}
+
+bool SigSet::insertExact( Signature sig )
+{
+	// 0 marks an empty slot
+	if ( !sig )
+		sig = 1;
+
+	size_t mask = size-1;
+	size_t idx = (size_t)sig & mask;
+
+	for ( uint i=0; i<maxProbe; i++ )
+	{
+		u64 cur = data[idx].load( std::memory_order_relaxed );
+
+		if ( !cur )
+		{
+			if ( data[idx].compare_exchange_strong( cur, sig, std::memory_order_relaxed ) )
+				return 1;
+			// someone else grabbed the slot, cur now holds its value
+		}
+
+		if ( cur == sig )
+			return 0;
+
+		idx = (idx + 1) & mask;
+	}
+
+	// full around this slot: don't filter
+	numOverflows.fetch_add( 1, std::memory_order_relaxed );
+	return 1;
+}
+
+bool SigSet::insertBloom( Signature sig )
+{
+	// blocked bloom filter: all k bits live in one word, so a single fetch_or
+	// decides whether this thread inserted the signature
+	// word index from the low bits, bit indices from the top 24 bits
+	std::atomic<u64> &w = data[ (size_t)sig & (size-1) ];
+	u64 m = 0;
+
+	for ( uint i=0; i<bloomHashes; i++ )
+		m |= (u64)1 << ((sig >> (64 - 6*(i+1))) & 63);
+
+	if ( (w.load( std::memory_order_relaxed ) & m) == m )
+		return 0;
+
+	return (w.fetch_or( m, std::memory_order_relaxed ) & m) != m;
+}
+
+void SigSet::report( const char *prefix ) const
+{
+	std::cout << prefix << inserted() << " unique, " << duplicates() << " duplicates filtered";
+
+	if ( overflows() )
+		std::cout << ", " << overflows() << " unfiltered (set full)";
+
+	std::cout << " (" << (setMode == ssBloom ? "bloom, " : "exact, ") << (sizeBytes() >> 20) << " MB)" << std::endl;
+
+	if ( overflows() )
+		std::cout << "warning: dedup set was full, duplicates were not filtered; use a larger set or bloom mode"
+			<< std::endl;
+}
+
+}
@@ -0,0 +1,105 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include "chtypes.h"
+#include <atomic>
+
+namespace cheng4
+{
+
+// concurrent fixed-memory set of position signatures (used for dedup)
+// exact mode: lock-free open addressing (linear probing), 0 marks an empty slot
+// bloom mode: k hashed bits per signature (in one word), may report false duplicates
+// insert may be called from any number of threads
+class SigSet
+{
+public:
+	enum Mode
+	{
+		ssExact,
+		ssBloom
+	};
+
+	SigSet();
+	~SigSet();
+
+	// allocate (size rounded down to a power of two), clears set and stats
+	// returns 1 on success
+	bool init( size_t sizeBytes, Mode mode = ssExact );
+	// allocate for count signatures using at most maxBytes:
+	// exact mode if it fits (and was asked for), bloom filter otherwise
+	bool initFor( u64 count, size_t maxBytes, Mode mode = ssExact );
+	void release();
+
+	void clear();
+
+	// save/load set (dedup across runs); file: "CHSS", u32 mode, u64 words, u64 count, words
+	// load replaces the current set (mode and size come from the file)
+	bool save( const char *fname ) const;
+	bool load( const char *fname );
+	// make room for count more signatures using at most maxBytes
+	// exact sets are rehashed into a larger exact set or a bloom filter; bloom filters can't grow
+	bool grow( u64 count, size_t maxBytes );
+
+	// returns 1 if signature wasn't in set (and inserts it), 0 for a duplicate
+	// if the set is full (probe limit reached), it reports new and counts an overflow
+	bool insert( Signature sig );
+
+	inline Mode mode() const { return setMode; }
+	inline size_t sizeBytes() const { return size * sizeof(u64); }
+
+	// stats
+	inline u64 inserted() const { return numInserted.load( std::memory_order_relaxed ); }
+	inline u64 duplicates() const { return numDups.load( std::memory_order_relaxed ); }
+	inline u64 overflows() const { return numOverflows.load( std::memory_order_relaxed ); }
+	// signatures stored including previous runs
+	inline u64 count() const { return baseCount + inserted(); }
+
+	// print stats to stdout using prefix
+	void report( const char *prefix ) const;
+
+private:
+	static const uint maxProbe = 64;
+	static const uint bloomHashes = 4;
+
+	std::atomic<u64> *data;
+	size_t size;				// in u64 words; power of two
+	Mode setMode;
+	u64 baseCount;				// signatures stored before this run (loaded)
+
+	std::atomic<u64> numInserted;
+	std::atomic<u64> numDups;
+	std::atomic<u64> numOverflows;
+
+	SigSet( const SigSet & );
+	SigSet &operator =( const SigSet & );
+
+	bool insertExact( Signature sig );
+	bool insertBloom( Signature sig );
+	void swap( SigSet &o );
+};
+
+}
@@ -78,31 +78,17 @@ Score Tables::gainCap[ ptMax ] = { 100, 100, 325, 325, 500, 975, 0};	// capture
 void Tables::init()
 {
 	// bitcount/lsbit/msbit tables
-	for (u32 i=0; i<65536; i++)
+	// built incrementally from i >> 1 (already computed)
+	popCount16[0] = 0;
+	lsBit16[0] = msBit16[0] = 255;
+	for (u32 i=1; i<65536; i++)
 	{
-		uint bc = 0;
-		for (uint j=0; j<16; j++)
-			if ( i & (1 << j) )
-				bc++;
-
-		popCount16[ i ] = (u8)bc;
-		if ( i < 256 )
-			popCount8[ i ] = (u8)bc;
-
-		lsBit16[i] = msBit16[i] = 255;
-		for (uint j=0; j<16; j++)
-			if ( i & (1<<j) )
-			{
-				lsBit16[i] = (u8)j;
-				break;
-			}
-		for (uint j=0; j<16; j++)
-			if ( i & (1<<(15-j)) )
-			{
-				msBit16[i] = (u8)(15-j);
-				break;
-			}
+		const u32 half = i >> 1;
+		popCount16[ i ] = (u8)(popCount16[ half ] + (i & 1));
+		lsBit16[ i ] = (u8)((i & 1) ? 0 : lsBit16[ half ] + 1);
+		msBit16[ i ] = (u8)(half ? msBit16[ half ] + 1 : 0);
 	}
+	memcpy( popCount8, popCount16, sizeof(popCount8) );
 
 	memset( noneShlTab, 255, sizeof(noneShlTab) );
 
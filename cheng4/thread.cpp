@@ -395,4 +395,22 @@ i32 Timer::getMillisec()
 #endif
 }
 
+u64 Timer::getMicrosec()
+{
+#ifndef _WIN32
+	struct timeval tp;
+	struct timezone tzp;
+
+	gettimeofday( &tp, &tzp );
+
+	return (u64)tp.tv_sec * 1000000 + (u64)tp.tv_usec;
+#else
+	LARGE_INTEGER cnt, freq;
+	QueryPerformanceCounter( &cnt );
+	QueryPerformanceFrequency( &freq );
+	return (u64)cnt.QuadPart / (u64)freq.QuadPart * 1000000 +
+		(u64)cnt.QuadPart % (u64)freq.QuadPart * 1000000 / (u64)freq.QuadPart;
+#endif
+}
+
 }
@@ -130,6 +130,8 @@ struct Timer
 	static void done();
 	// get millisecond counter
 	static i32 getMillisec();
+	// get microsecond counter (for profiling)
+	static u64 getMicrosec();
 };
 
 }
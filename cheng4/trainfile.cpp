@@ -0,0 +1,731 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "trainfile.h"
+#include "movegen.h"
+#include "utils.h"
+#include <string.h>
+#include <thread>
+#include <atomic>
+
+#include "nets/mlz/mlz_enc.c"
+#include "nets/mlz/mlz_dec_mini.h"
+
+namespace cheng4
+{
+
+static const u8 trainMagic[4] = { 'C', 'H', 'T', 'D' };
+static const u8 trainIndexMagic[4] = { 'C', 'H', 'T', 'I' };
+// version 2: chunk header carries FNV-1a of header fields and stored payload
+static const u16 trainVersion = 2;
+
+static const size_t trainHeaderSize = 16;
+static const size_t trainChunkHeaderSize = 20;
+// upper bound for raw and stored chunk size
+static const u32 trainMaxChunkSize = 256*1024*1024;
+// mlz match copies may write up to 8 bytes past the end
+static const size_t trainDecodeReserve = 64;
+static const size_t trainIndexEntrySize = 16;
+static const size_t trainFooterSize = 24;
+
+// header flags
+enum
+{
+	tfCompressed = 1,
+	tfGames = 2
+};
+
+static inline void putU16( u8 *dst, u16 v )
+{
+	dst[0] = (u8)v;
+	dst[1] = (u8)(v >> 8);
+}
+
+static inline void putU32( u8 *dst, u32 v )
+{
+	for ( int i=0; i<4; i++ )
+		dst[i] = (u8)(v >> 8*i);
+}
+
+static inline void putU64( u8 *dst, u64 v )
+{
+	for ( int i=0; i<8; i++ )
+		dst[i] = (u8)(v >> 8*i);
+}
+
+static inline u16 getU16( const u8 *src )
+{
+	return (u16)(src[0] | (src[1] << 8));
+}
+
+static inline u32 getU32( const u8 *src )
+{
+	u32 res = 0;
+	for ( int i=0; i<4; i++ )
+		res |= (u32)src[i] << 8*i;
+	return res;
+}
+
+static inline u64 getU64( const u8 *src )
+{
+	u64 res = 0;
+	for ( int i=0; i<8; i++ )
+		res |= (u64)src[i] << 8*i;
+	return res;
+}
+
+// TrainRecord
+
+void TrainRecord::pack( u8 *dst, Score label, float outcome, const Board &b )
+{
+	putU16( dst, (u16)(i16)label );
+	dst[2] = (u8)(i8)(outcome*2);
+	dst[3] = b.turn() == ctBlack ? 1 : 0;
+
+	uint8_t buf[16];
+	u64 occ = b.compressPiecesOccupancy( buf );
+	memcpy( dst + 4, &occ, 8 );
+	memcpy( dst + 12, buf, 16 );
+}
+
+// TrainGame
+
+// 15-bit move: from, to, promo; castling (never a promotion) uses promo 7 so that
+// FRC castling can't be confused with a king move to the same square
+static inline u16 packGameMove( Move m )
+{
+	u16 res = (u16)(m & ((1 << msPromo)-1));
+	res |= (u16)((MovePack::isCastling( m ) ? 7 : MovePack::promo( m )) << msPromo);
+	return res;
+}
+
+void TrainGame::begin( const Board &b )
+{
+	fen = b.toFEN();
+	plies.clear();
+	labeled = 0;
+}
+
+void TrainGame::add( Move m, Score score, bool labeled_ )
+{
+	u8 tmp[4];
+	putU16( tmp, (u16)(packGameMove( m ) | (labeled_ ? 0x8000 : 0)) );
+	score = std::max<Score>( -32767, std::min<Score>( 32767, score ) );
+	putU16( tmp + 2, (u16)(i16)score );
+	plies.insert( plies.end(), tmp, tmp + 4 );
+	labeled += labeled_;
+}
+
+uint TrainGame::finish( float outcome, std::vector< u8 > &dst )
+{
+	assert( fen.size() < 256 && plies.size()/4 < 65536 );
+
+	u8 hdr[2];
+	hdr[0] = (u8)(i8)(outcome*2);
+	hdr[1] = (u8)fen.size();
+	dst.insert( dst.end(), hdr, hdr + 2 );
+	dst.insert( dst.end(), fen.begin(), fen.end() );
+
+	u8 count[2];
+	putU16( count, (u16)(plies.size()/4) );
+	dst.insert( dst.end(), count, count + 2 );
+	dst.insert( dst.end(), plies.begin(), plies.end() );
+
+	uint res = labeled;
+	plies.clear();
+	labeled = 0;
+	return res;
+}
+
+bool TrainGame::decode( const u8 *&src, const u8 *end, std::vector< u8 > &records )
+{
+	if ( end - src < 2 )
+		return 0;
+
+	const float outcome = src[0] * 0.5f;
+	const size_t fenLen = src[1];
+	src += 2;
+
+	if ( (size_t)(end - src) < fenLen + 2 )
+		return 0;
+
+	std::string fen( (const char *)src, fenLen );
+	src += fenLen;
+
+	const uint count = getU16( src );
+	src += 2;
+
+	if ( (size_t)(end - src) < (size_t)count * 4 )
+		return 0;
+
+	Board b;
+
+	if ( !b.fromFEN( fen.c_str() ) )
+		return 0;
+
+	for ( uint i=0; i<count; i++, src += 4 )
+	{
+		const u16 packed = getU16( src );
+		const Score score = (i16)getU16( src + 2 );
+
+		if ( packed & 0x8000 )
+		{
+			u8 rec[ TrainRecord::size ];
+			TrainRecord::pack( rec, score, outcome, b );
+			records.insert( records.end(), rec, rec + TrainRecord::size );
+		}
+
+		// find full move
+		MoveGen mg( b );
+		Move m;
+
+		while ( (m = mg.next()) != mcNone )
+			if ( packGameMove( m ) == (packed & 0x7fff) )
+				break;
+
+		if ( m == mcNone )
+			return 0;
+
+		UndoInfo ui;
+		b.doMove( m, ui, b.isCheck( m, b.discovered() ) );
+	}
+
+	return 1;
+}
+
+// TrainWriter
+
+TrainWriter::TrainWriter() : file(0), compress(0), games(0), raw(0), chunkRecords(0), pendingRecords(0), offset(0),
+	totalRecords(0), matcher(0)
+{
+}
+
+TrainWriter::~TrainWriter()
+{
+	close();
+}
+
+bool TrainWriter::write( const void *buf, size_t size )
+{
+	if ( fwrite( buf, 1, size, file ) != size )
+		return 0;
+	offset += size;
+	return 1;
+}
+
+bool TrainWriter::open( const char *fname, bool compress_, uint chunkRecords_, bool games_ )
+{
+	close();
+
+	file = fopen( fname, "wb" );
+
+	if ( !file )
+		return 0;
+
+	compress = compress_;
+	games = games_;
+	raw = 0;
+	chunkRecords = chunkRecords_ ? chunkRecords_ : 1;
+	// leave room for a game that overshoots the byte budget
+	chunkRecords = std::min< uint >( chunkRecords, trainMaxChunkSize / 2 / TrainRecord::size );
+	pendingRecords = 0;
+	offset = totalRecords = 0;
+	index.clear();
+	pending.clear();
+	pending.reserve( (size_t)chunkRecords * TrainRecord::size );
+
+	if ( compress && !mlz_matcher_init( &matcher ) )
+		matcher = 0;
+
+	u8 hdr[ trainHeaderSize ];
+	memcpy( hdr, trainMagic, 4 );
+	putU16( hdr + 4, trainVersion );
+	putU16( hdr + 6, (u16)TrainRecord::size );
+	putU32( hdr + 8, (compress ? tfCompressed : 0) | (games ? tfGames : 0) );
+	putU32( hdr + 12, chunkRecords );
+
+	return write( hdr, sizeof(hdr) );
+}
+
+bool TrainWriter::openRaw( const char *fname )
+{
+	close();
+
+	file = fopen( fname, "wb" );
+
+	if ( !file )
+		return 0;
+
+	compress = games = 0;
+	raw = 1;
+	chunkRecords = 65536;
+	pendingRecords = 0;
+	offset = totalRecords = 0;
+	index.clear();
+	pending.clear();
+	pending.reserve( (size_t)chunkRecords * TrainRecord::size );
+
+	return 1;
+}
+
+bool TrainWriter::add( const u8 *record )
+{
+	if ( !file || games )
+		return 0;
+
+	pending.insert( pending.end(), record, record + TrainRecord::size );
+	pendingRecords++;
+
+	if ( pending.size() >= (size_t)chunkRecords * TrainRecord::size )
+		return flush();
+
+	return 1;
+}
+
+bool TrainWriter::add( Score label, float outcome, const Board &b )
+{
+	u8 rec[ TrainRecord::size ];
+	TrainRecord::pack( rec, label, outcome, b );
+	return add( rec );
+}
+
+bool TrainWriter::addGames( const u8 *data, size_t size, uint positions )
+{
+	if ( !file || !games )
+		return 0;
+
+	pending.insert( pending.end(), data, data + size );
+	pendingRecords += positions;
+
+	// same byte budget per chunk as plain records
+	if ( pending.size() >= (size_t)chunkRecords * TrainRecord::size )
+		return flush();
+
+	return 1;
+}
+
+bool TrainWriter::appendChunks( const TrainReader &src )
+{
+	if ( !file || (!raw && src.isGames() != games) || src.recordSize() != TrainRecord::size || !flush() )
+		return 0;
+
+	if ( raw )
+	{
+		// decode batches of chunks in parallel (game chunks need to replay moves)
+		const uint threads = std::max( 1u, std::thread::hardware_concurrency() );
+		std::vector< std::vector< u8 > > records;
+
+		for ( size_t i=0; i<src.chunks(); i += 2*threads )
+		{
+			size_t count = std::min<size_t>( 2*threads, src.chunks() - i );
+
+			if ( !src.readChunks( i, count, records, threads ) )
+				return 0;
+
+			for ( size_t j=0; j<count; j++ )
+			{
+				if ( !write( records[j].data(), records[j].size() ) )
+					return 0;
+
+				totalRecords += src.chunk( i+j ).records;
+			}
+		}
+
+		return 1;
+	}
+
+	std::vector< u8 > data;
+
+	for ( size_t i=0; i<src.chunks(); i++ )
+	{
+		if ( !src.readStoredChunk( i, data ) )
+			return 0;
+
+		TrainChunkInfo ci = src.chunk( i );
+		ci.offset = offset;
+
+		if ( !write( data.data(), data.size() ) )
+			return 0;
+
+		index.push_back( ci );
+		totalRecords += ci.records;
+	}
+
+	return 1;
+}
+
+bool TrainWriter::flush()
+{
+	if ( !file )
+		return 0;
+
+	if ( pending.empty() )
+		return 1;
+
+	if ( raw )
+	{
+		if ( !write( pending.data(), pending.size() ) )
+			return 0;
+
+		totalRecords += pendingRecords;
+		pending.clear();
+		pendingRecords = 0;
+		return 1;
+	}
+
+	const u32 rawSize = (u32)pending.size();
+	const u8 *data = pending.data();
+	u32 storedSize = rawSize;
+	u32 codec = tcRaw;
+
+	if ( matcher )
+	{
+		packed.resize( rawSize + rawSize/8 + 256 );
+		size_t csize = mlz_compress( matcher, packed.data(), packed.size(), data, rawSize, 0, MLZ_LEVEL_FASTEST );
+
+		// only keep if it actually helps
+		if ( csize > 0 && csize < rawSize )
+		{
+			data = packed.data();
+			storedSize = (u32)csize;
+			codec = tcMlz;
+		}
+	}
+
+	TrainChunkInfo ci;
+	ci.offset = offset;
+	ci.records = pendingRecords;
+	ci.storedSize = storedSize;
+
+	u8 hdr[ trainChunkHeaderSize ];
+	putU32( hdr, ci.records );
+	putU32( hdr + 4, storedSize );
+	putU32( hdr + 8, rawSize );
+	putU32( hdr + 12, codec );
+	putU32( hdr + 16, fnv1a( data, storedSize, fnv1a( hdr, 16 ) ) );
+
+	if ( !write( hdr, sizeof(hdr) ) || !write( data, storedSize ) )
+		return 0;
+
+	index.push_back( ci );
+	totalRecords += ci.records;
+	pending.clear();
+	pendingRecords = 0;
+
+	// make sure complete chunks hit the disk (index can be rebuilt from them)
+	fflush( file );
+
+	return 1;
+}
+
+bool TrainWriter::close()
+{
+	if ( !file )
+		return 1;
+
+	bool res = flush();
+
+	if ( raw )
+	{
+		res &= fclose( file ) == 0;
+		file = 0;
+		return res;
+	}
+
+	const u64 indexOffset = offset;
+
+	std::vector< u8 > buf( index.size() * trainIndexEntrySize + trainFooterSize );
+	u8 *dst = buf.data();
+
+	for ( size_t i=0; i<index.size(); i++, dst += trainIndexEntrySize )
+	{
+		putU64( dst, index[i].offset );
+		putU32( dst + 8, index[i].records );
+		putU32( dst + 12, index[i].storedSize );
+	}
+
+	putU64( dst, indexOffset );
+	putU64( dst + 8, totalRecords );
+	putU32( dst + 16, (u32)index.size() );
+	memcpy( dst + 20, trainIndexMagic, 4 );
+
+	res &= write( buf.data(), buf.size() );
+	res &= fclose( file ) == 0;
+	file = 0;
+
+	if ( matcher )
+	{
+		mlz_matcher_free( matcher );
+		matcher = 0;
+	}
+
+	return res;
+}
+
+// TrainReader
+
+TrainReader::TrainReader() : recSize(TrainRecord::size), games(0), totalRecords(0)
+{
+}
+
+TrainReader::~TrainReader()
+{
+	close();
+}
+
+void TrainReader::close()
+{
+	file.close();
+	index.clear();
+	totalRecords = 0;
+}
+
+bool TrainReader::open( const char *fname )
+{
+	close();
+
+	if ( !file.open( fname ) )
+		return 0;
+
+	const u8 *hdr = file.data();
+	const u64 size = file.size();
+
+	// note: version 1 chunks had no checksum => not supported
+	if ( size < trainHeaderSize || memcmp( hdr, trainMagic, 4 ) || getU16( hdr + 4 ) != trainVersion )
+	{
+		close();
+		return 0;
+	}
+
+	recSize = getU16( hdr + 6 );
+	games = (getU32( hdr + 8 ) & tfGames) != 0;
+
+	if ( !recSize || (games && recSize != TrainRecord::size) )
+	{
+		close();
+		return 0;
+	}
+
+	const u8 *footer = size >= trainHeaderSize + trainFooterSize ? file.data() + size - trainFooterSize : 0;
+
+	if ( footer && !memcmp( footer + 20, trainIndexMagic, 4 ) )
+	{
+		const u64 indexOffset = getU64( footer );
+		const u32 count = getU32( footer + 16 );
+		const u64 indexSize = (u64)count * trainIndexEntrySize;
+
+		if ( indexOffset <= size - trainFooterSize && indexSize == size - indexOffset - trainFooterSize )
+		{
+			index.resize( count );
+
+			bool valid = 1;
+
+			for ( u32 i=0; i<count && valid; i++ )
+			{
+				const u8 *src = file.data() + indexOffset + (size_t)i * trainIndexEntrySize;
+				TrainChunkInfo &ci = index[i];
+				ci.offset = getU64( src );
+				ci.records = getU32( src + 8 );
+				ci.storedSize = getU32( src + 12 );
+				totalRecords += ci.records;
+
+				valid = ci.storedSize <= trainMaxChunkSize && ci.offset >= trainHeaderSize &&
+					ci.offset + trainChunkHeaderSize + ci.storedSize <= indexOffset;
+			}
+
+			if ( valid )
+				return 1;
+		}
+	}
+
+	// no valid index (unfinished file)
+	if ( !rebuildIndex() )
+	{
+		close();
+		return 0;
+	}
+
+	return 1;
+}
+
+bool TrainReader::validChunkHeader( const u8 *hdr ) const
+{
+	const u32 records = getU32( hdr );
+	const u32 storedSize = getU32( hdr + 4 );
+	const u32 rawSize = getU32( hdr + 8 );
+	const u32 codec = getU32( hdr + 12 );
+
+	if ( !records || !rawSize || rawSize > trainMaxChunkSize || storedSize > rawSize )
+		return 0;
+
+	// games: each labeled position takes at least one 4-byte ply entry
+	if ( games ? (u64)records * 4 > rawSize : (u64)records * recSize != rawSize )
+		return 0;
+
+	// mlz chunks are only kept when smaller
+	return codec == tcRaw ? storedSize == rawSize : codec == tcMlz && storedSize < rawSize;
+}
+
+bool TrainReader::rebuildIndex()
+{
+	index.clear();
+	totalRecords = 0;
+
+	const u64 size = file.size();
+	u64 ofs = trainHeaderSize;
+
+	while ( ofs + trainChunkHeaderSize <= size )
+	{
+		const u8 *hdr = file.data() + ofs;
+
+		TrainChunkInfo ci;
+		ci.offset = ofs;
+		ci.records = getU32( hdr );
+		ci.storedSize = getU32( hdr + 4 );
+
+		// truncated chunk or garbage
+		if ( !validChunkHeader( hdr ) || ofs + trainChunkHeaderSize + ci.storedSize > size )
+			break;
+
+		index.push_back( ci );
+		totalRecords += ci.records;
+		ofs += trainChunkHeaderSize + ci.storedSize;
+	}
+
+	return !index.empty() || ofs == size;
+}
+
+bool TrainReader::readChunk( size_t i, std::vector< u8 > &records ) const
+{
+	if ( !file.data() || i >= index.size() )
+		return 0;
+
+	// index entries were checked against file size in open
+	const TrainChunkInfo &ci = index[i];
+	const u8 *hdr = file.data() + ci.offset;
+	const u8 *stored = hdr + trainChunkHeaderSize;
+
+	const u32 rawSize = getU32( hdr + 8 );
+	const u32 codec = getU32( hdr + 12 );
+
+	// the decoder doesn't check bounds => only feed it verified payloads
+	if ( !validChunkHeader( hdr ) || getU32( hdr ) != ci.records || getU32( hdr + 4 ) != ci.storedSize ||
+		getU32( hdr + 16 ) != fnv1a( stored, ci.storedSize, fnv1a( hdr, 16 ) ) )
+		return 0;
+
+	// games are decoded from a temporary buffer
+	std::vector< u8 > payload;
+	std::vector< u8 > &dst = games ? payload : records;
+
+	size_t base = dst.size();
+	dst.resize( base + rawSize + trainDecodeReserve );
+
+	switch( codec )
+	{
+	case tcRaw:
+		memcpy( dst.data() + base, stored, rawSize );
+		break;
+
+	case tcMlz:
+		if ( mlz_decompress_mini( dst.data() + base, stored, (int)ci.storedSize ) != (int)rawSize )
+		{
+			dst.resize( base );
+			return 0;
+		}
+		break;
+
+	default:
+		dst.resize( base );
+		return 0;
+	}
+
+	dst.resize( base + rawSize );
+
+	if ( !games )
+		return 1;
+
+	const size_t recBase = records.size();
+	records.reserve( recBase + (size_t)ci.records * TrainRecord::size );
+
+	const u8 *src = payload.data();
+	const u8 *end = src + payload.size();
+
+	while ( src < end )
+		if ( !TrainGame::decode( src, end, records ) )
+			return 0;
+
+	return records.size() - recBase == (size_t)ci.records * TrainRecord::size;
+}
+
+bool TrainReader::readStoredChunk( size_t i, std::vector< u8 > &data ) const
+{
+	if ( !file.data() || i >= index.size() )
+		return 0;
+
+	const TrainChunkInfo &ci = index[i];
+	const u8 *src = file.data() + ci.offset;
+	data.assign( src, src + trainChunkHeaderSize + ci.storedSize );
+	return 1;
+}
+
+bool TrainReader::readChunks( size_t first, size_t count, std::vector< std::vector< u8 > > &out, uint threads ) const
+{
+	out.resize( count );
+
+	for ( size_t i=0; i<count; i++ )
+		out[i].clear();
+
+	threads = std::max( 1u, std::min<uint>( threads, (uint)count ) );
+
+	std::atomic< size_t > next( 0 );
+	std::atomic< bool > ok( 1 );
+
+	auto work = [&]()
+	{
+		for (;;)
+		{
+			size_t i = next++;
+
+			if ( i >= count )
+				break;
+
+			if ( !readChunk( first + i, out[i] ) )
+				ok = 0;
+		}
+	};
+
+	std::vector< std::thread > workers;
+
+	for ( uint i=1; i<threads; i++ )
+		workers.push_back( std::thread( work ) );
+
+	work();
+
+	for ( size_t i=0; i<workers.size(); i++ )
+		workers[i].join();
+
+	return ok;
+}
+
+}
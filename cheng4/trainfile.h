@@ -0,0 +1,170 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include "board.h"
+#include "mapfile.h"
+#include <vector>
+#include <stdio.h>
+
+struct mlz_matcher;
+
+namespace cheng4
+{
+
+// training data container:
+// header | chunk... | chunk index | footer
+// each chunk holds a batch of packed records, optionally mlz-compressed
+// the trailing index allows random (parallel) access to chunks
+
+// packed labeled position (28 bytes):
+// i16 label (centipawns), i8 outcome (0=loss, 1=draw, 2=win, white POV), i8 turn (1=black)
+// u64 occupancy, u8 x 16 nibble-packed pieces
+struct TrainRecord
+{
+	static const uint size = 28;
+
+	static void pack( u8 *dst, Score label, float outcome, const Board &b );
+};
+
+// game sequence (delta) encoding: start position once, then one 4-byte entry per move
+// u8 outcome (0=loss, 1=draw, 2=win, white POV), u8 fen length, fen, u16 plies
+// per ply: u16 move (from, to, promo/castling; bit 15 = labeled), i16 score (stm POV)
+// labeled plies decode to the record of the position before the move
+struct TrainGame
+{
+	// start new game
+	void begin( const Board &b );
+	// add move played from current position
+	void add( Move m, Score score, bool labeled );
+	// finish game and append encoding to dst; returns number of labeled positions
+	uint finish( float outcome, std::vector< u8 > &dst );
+
+	// decode one game, appending packed records; returns 0 on error
+	static bool decode( const u8 *&src, const u8 *end, std::vector< u8 > &records );
+
+private:
+	std::string fen;
+	std::vector< u8 > plies;
+	uint labeled;
+};
+
+enum TrainCodec
+{
+	tcRaw,
+	tcMlz
+};
+
+struct TrainChunkInfo
+{
+	u64 offset;				// file offset of chunk header
+	u32 records;			// number of records
+	u32 storedSize;			// bytes stored (excluding chunk header)
+};
+
+class TrainReader;
+
+class TrainWriter
+{
+public:
+	TrainWriter();
+	~TrainWriter();
+
+	// compress: use mlz for chunks
+	// games: chunks hold TrainGame encodings instead of packed records
+	bool open( const char *fname, bool compress = 1, uint chunkRecords = 65536, bool games = 0 );
+	// plain packed records only (no header, chunks or index), for tools that can't read containers
+	// games must be added through appendChunks (decoded)
+	bool openRaw( const char *fname );
+	// add packed record
+	bool add( const u8 *record );
+	bool add( Score label, float outcome, const Board &b );
+	// add encoded games (games mode only)
+	bool addGames( const u8 *data, size_t size, uint positions );
+	// append all chunks of another container as-is (must be of the same kind)
+	// raw output: chunks are decoded
+	bool appendChunks( const TrainReader &src );
+	// flush pending chunk
+	bool flush();
+	// flush and write index
+	bool close();
+
+	inline u64 records() const { return totalRecords; }
+	inline u64 bytesWritten() const { return offset; }
+
+private:
+	FILE *file;
+	bool compress;
+	bool games;
+	bool raw;
+	uint chunkRecords;
+	uint pendingRecords;
+	u64 offset;
+	u64 totalRecords;
+	std::vector< u8 > pending;
+	std::vector< u8 > packed;
+	std::vector< TrainChunkInfo > index;
+	mlz_matcher *matcher;
+
+	bool write( const void *buf, size_t size );
+};
+
+class TrainReader
+{
+public:
+	TrainReader();
+	~TrainReader();
+
+	// reads header and index (rebuilds index by walking chunks if the file wasn't closed properly)
+	bool open( const char *fname );
+	void close();
+
+	inline u64 records() const { return totalRecords; }
+	inline size_t chunks() const { return index.size(); }
+	inline const TrainChunkInfo &chunk( size_t i ) const { return index[i]; }
+	inline uint recordSize() const { return recSize; }
+
+	// read and decode chunk i into records (appends); can be called from multiple threads
+	// (the file is memory mapped => no shared stream, no locking)
+	bool readChunk( size_t i, std::vector< u8 > &records ) const;
+	// read chunk i as stored (chunk header + payload)
+	bool readStoredChunk( size_t i, std::vector< u8 > &data ) const;
+	inline bool isGames() const { return games; }
+
+	// read and decode count chunks starting at first into out[0..count) using multiple threads
+	bool readChunks( size_t first, size_t count, std::vector< std::vector< u8 > > &out, uint threads ) const;
+
+private:
+	MappedFile file;
+	uint recSize;
+	bool games;
+	u64 totalRecords;
+	std::vector< TrainChunkInfo > index;
+
+	bool validChunkHeader( const u8 *hdr ) const;
+	bool rebuildIndex();
+};
+
+}
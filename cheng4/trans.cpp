@@ -26,6 +26,7 @@ or as public domain (where applicable)
 #include "move.h"
 #include <memory.h>
 #include <new>
+#include <stdlib.h>
 
 namespace cheng4
 {
@@ -62,7 +63,7 @@ void TransTable::dealloc()
 {
 	if ( allocEntries )
 	{
-		delete[] allocEntries;
+		free( allocEntries );
 		allocEntries = 0;
 	}
 }
@@ -88,10 +89,15 @@ bool TransTable::resize( size_t sizeBytes )
 	if ( !roundPow2( sizeEntries, 1 ) )
 		return 0;					// bad size
 	if ( size == sizeEntries )
+	{
+		clear();
 		return 1;
+	}
 	// realloc!
+	// note: calloc'd memory is already zeroed (and for big blocks the OS maps zero pages lazily),
+	// so there's no need to touch the whole table here which is slow
 	dealloc();
-	allocEntries = new(std::nothrow) TransEntry[ sizeEntries + alignSize/sizeof(TransEntry) ];
+	allocEntries = static_cast<TransEntry *>(calloc( sizeEntries + alignSize/sizeof(TransEntry), sizeof(TransEntry) ));
 	if ( !allocEntries )
 	{
 		dummyAlloc();
@@ -100,6 +106,7 @@ bool TransTable::resize( size_t sizeBytes )
 	// align entries
 	entries = static_cast<TransEntry *>(alignPtr( allocEntries, alignSize ));
 	size = sizeEntries;
+	clearHashFull();
 	return 1;
 }
 
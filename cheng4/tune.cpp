@@ -24,16 +24,20 @@ or as public domain (where applicable)
 #include "tune.h"
 #include "eval.h"
 
-#include <iostream>
-#include <fstream>
-#include <algorithm>
+#ifdef USE_TUNING
+#	include "thread.h"
+#	include "utils.h"
+#	include <iostream>
+#	include <fstream>
+#	include <algorithm>
+#	include <math.h>
+#	include <stdlib.h>
+#	include <string.h>
+#endif
 
 namespace cheng4
 {
 
-std::vector<Feature> features;
-std::vector<i16> featureVector;
-
 static const i16 optimizedFeatureVector[] = {
 	-15, -24, -41, -45, -19, -24, 3,
 	35, 49, 94, 174, 257, 428, 544, 644,
@@ -168,6 +172,155 @@ static const i16 optimizedFeatureVector[] = {
 	-48
 };
 
+struct FeatureDesc
+{
+	const char *name;
+	i16 *table;
+	int size;
+};
+
+#define SINGLE_FEATURE(x) { #x, &x, 1 }
+
+// eval parameter layout, order matches optimizedFeatureVector
+static const FeatureDesc featureLayout[] =
+{
+	{ "kingCheckPotential", kingCheckPotential, 28 },
+
+	SINGLE_FEATURE(progressBasePly),
+	SINGLE_FEATURE(progressScale),
+
+	SINGLE_FEATURE(disconnectedPawn),
+	SINGLE_FEATURE(disconnectedPawnEg),
+
+	{ "connectedPasserOpening", connectedPasserOpening+1, 6 },
+	{ "connectedPasserEndgame", connectedPasserEndgame+1, 6 },
+
+	{ "kingOpenFile", kingOpenFile+1, 3 },
+	{ "kingOpenFileEndgame", kingOpenFileEg+1, 3 },
+
+	SINGLE_FEATURE(rookBehindPasserOpening),
+	SINGLE_FEATURE(rookBehindPasserEndgame),
+
+	{ "materialOpening", PSq::materialTables[phOpening]+1, 5 },
+	{ "materialEndgame", PSq::materialTables[phEndgame]+1, 5 },
+
+	{ "safetyScale", safetyScale+1, 5 },
+	{ "safetyScaleEg", safetyScaleEg+1, 5 },
+
+	SINGLE_FEATURE(shelterFront1),
+	SINGLE_FEATURE(shelterFront2),
+
+	SINGLE_FEATURE(bishopPairOpening),
+	SINGLE_FEATURE(bishopPairEndgame),
+
+	SINGLE_FEATURE(trappedBishopOpening),
+	SINGLE_FEATURE(trappedBishopEndgame),
+
+	SINGLE_FEATURE(unstoppablePasser),
+
+	SINGLE_FEATURE(doubledPawnOpening),
+	SINGLE_FEATURE(doubledPawnEndgame),
+
+	SINGLE_FEATURE(isolatedPawnOpening),
+	SINGLE_FEATURE(isolatedPawnEndgame),
+
+	SINGLE_FEATURE(knightHangingOpening),
+	SINGLE_FEATURE(knightHangingEndgame),
+
+	SINGLE_FEATURE(bishopHangingOpening),
+	SINGLE_FEATURE(bishopHangingEndgame),
+
+	SINGLE_FEATURE(rookHangingOpening),
+	SINGLE_FEATURE(rookHangingEndgame),
+
+	SINGLE_FEATURE(rookOnOpenOpening),
+	SINGLE_FEATURE(rookOnOpenEndgame),
+
+	SINGLE_FEATURE(queenHangingOpening),
+	SINGLE_FEATURE(queenHangingEndgame),
+
+	SINGLE_FEATURE(kingPasserSupportBase),
+	SINGLE_FEATURE(kingPasserSupportScale),
+
+	{ "outpostBonusFile", outpostBonusFile, 8 },
+	{ "outpostBonusRank", outpostBonusRank, 8 },
+
+	SINGLE_FEATURE(pawnRaceAdvantageEndgame),
+
+	{ "passerScaleImbalance", passerScaleImbalance, 1 },
+	{ "passerScaleBlocked", passerScaleBlocked, 1 },
+
+	{ "candPasserOpening", candPasserOpening+1, 6 },
+	{ "candPasserEndgame", candPasserEndgame+1, 6 },
+
+	{ "passerOpening", passerOpening+1, 6 },
+	{ "passerEndgame", passerEndgame+1, 6 },
+
+	{ "knightMobilityOpening", knightMobility[phOpening], 9 },
+	{ "knightMobilityEndgame", knightMobility[phEndgame], 9 },
+
+	{ "bishopMobilityOpening", bishopMobility[phOpening], 14 },
+	{ "bishopMobilityEndgame", bishopMobility[phEndgame], 14 },
+
+	{ "rookMobilityOpening", rookMobility[phOpening], 15 },
+	{ "rookMobilityEndgame", rookMobility[phEndgame], 15 },
+
+	{ "queenMobilityOpening", queenMobility[phOpening], 28 },
+	{ "queenMobilityEndgame", queenMobility[phEndgame], 28 },
+
+	{ "goodBishopOpening", goodBishopOpening, 17 },
+	{ "goodBishopEndgame", goodBishopEndgame, 17 },
+
+	// and finally piece-square tables
+
+	{ "pawnPsqOpening", PSq::pawnTables[phOpening] + 8, 64-2*8 },
+	{ "pawnPsqEndgame", PSq::pawnTables[phEndgame] + 8, 64-2*8 },
+
+	{ "knightPsqOpening", PSq::knightTables[phOpening], 64 },
+	{ "knightPsqEndgame", PSq::knightTables[phEndgame], 64 },
+
+	{ "bishopPsqOpening", PSq::bishopTables[phOpening], 64 },
+	{ "bishopPsqEndgame", PSq::bishopTables[phEndgame], 64 },
+
+	{ "rookPsqOpening", PSq::rookTables[phOpening], 64 },
+	{ "rookPsqEndgame", PSq::rookTables[phEndgame], 64 },
+
+	{ "queenPsqOpening", PSq::queenTables[phOpening], 64 },
+	{ "queenPsqEndgame", PSq::queenTables[phEndgame], 64 },
+
+	{ "kingPsqOpening", PSq::kingTables[phOpening], 64 },
+	{ "kingPsqEndgame", PSq::kingTables[phEndgame], 64 },
+};
+
+#undef SINGLE_FEATURE
+
+void initFeatures()
+{
+	const i16 *src = optimizedFeatureVector;
+	const i16 *end = src + sizeof(optimizedFeatureVector) / sizeof(i16);
+
+	for (size_t i=0; i<sizeof(featureLayout) / sizeof(featureLayout[0]); i++)
+	{
+		const FeatureDesc &fd = featureLayout[i];
+
+		for (int j=0; j<fd.size && src < end; j++)
+			fd.table[j] = *src++;
+	}
+
+	// re-init psq to bake material into them
+	PSq::init();
+}
+
+}
+
+#ifdef USE_TUNING
+
+namespace cheng4
+{
+
+std::vector<Feature> features;
+std::vector<i16> featureVector;
+
 void addFeature(const char *name, i16 *ptr, int count)
 {
 	Feature feat;
@@ -206,8 +359,6 @@ bool saveFeatures(const char *filename)
 	return 1;
 }
 
-#define ADD_SINGLE_FEATURE(x) addFeature(#x, &x)
-
 void freeFeatures()
 {
 	std::vector<Feature> nfeatures;
@@ -219,144 +370,319 @@ void freeFeatures()
 
 void extractFeatures()
 {
-	addFeature("kingCheckPotential", kingCheckPotential, 28);
+	if (!features.empty())
+		return;
+
+	for (size_t i=0; i<sizeof(featureLayout) / sizeof(featureLayout[0]); i++)
+	{
+		const FeatureDesc &fd = featureLayout[i];
+		addFeature(fd.name, fd.table, fd.size);
+	}
+}
+
+void applyFeatures()
+{
+	for (size_t i=0; i<features.size(); i++)
+	{
+		const Feature &ft = features[i];
+
+		for (int j=0; j<ft.size; j++)
+			ft.table[j] = featureVector[ft.start + j];
+	}
+
+	PSq::init();
+}
+
+// EvalTuner
+
+// sums squared error over a slice of positions
+// persistent: started once per tuner, runs one pass per command
+class EvalTuneWorker : public Thread
+{
+public:
+	Board *boards = nullptr;
+	const float *outcomes = nullptr;
+	size_t count = 0;
+	double k = 1.0;
+	double sum = 0;
+
+	Eval eval;
+	Event commandEvent;			// set when a pass is pending
+	Event doneEvent;			// set when done with pass
+	volatile bool shouldQuit = 0;
+
+	void destroy() override
+	{
+		shouldQuit = 1;
+		commandEvent.signal();
+	}
 
-	ADD_SINGLE_FEATURE(progressBasePly);
-	ADD_SINGLE_FEATURE(progressScale);
+	void work() override
+	{
+		for (;;)
+		{
+			commandEvent.wait();
 
-	ADD_SINGLE_FEATURE(disconnectedPawn);
-	ADD_SINGLE_FEATURE(disconnectedPawnEg);
+			if (shouldQuit)
+				break;
 
-	addFeature("connectedPasserOpening", connectedPasserOpening+1, 6);
-	addFeature("connectedPasserEndgame", connectedPasserEndgame+1, 6);
+			pass();
+			doneEvent.signal();
+		}
+	}
 
-	addFeature("kingOpenFile", kingOpenFile+1, 3);
-	addFeature("kingOpenFileEndgame", kingOpenFileEg+1, 3);
+private:
+	void pass()
+	{
+		// parameters changed since last pass => cached scores are stale
+		eval.clear();
 
-	ADD_SINGLE_FEATURE(rookBehindPasserOpening);
-	ADD_SINGLE_FEATURE(rookBehindPasserEndgame);
+		double res = 0;
 
-	addFeature("materialOpening", PSq::materialTables[phOpening]+1, 5);
-	addFeature("materialEndgame", PSq::materialTables[phEndgame]+1, 5);
+		for (size_t i=0; i<count; i++)
+		{
+			Board &b = boards[i];
+			// psq/material may have changed => refresh incremental material
+			b.updateDeltaMaterial();
+			Score sc = eval.eval(b);
 
-	addFeature("safetyScale", safetyScale+1, 5);
-	addFeature("safetyScaleEg", safetyScaleEg+1, 5);
+			if (b.turn() == ctBlack)
+				sc = -sc;
 
-	ADD_SINGLE_FEATURE(shelterFront1);
-	ADD_SINGLE_FEATURE(shelterFront2);
+			double p = 1.0 / (1.0 + pow(10.0, -k * sc / 400.0));
+			double d = outcomes[i] - p;
+			res += d*d;
+		}
 
-	ADD_SINGLE_FEATURE(bishopPairOpening);
-	ADD_SINGLE_FEATURE(bishopPairEndgame);
+		sum = res;
+	}
+};
 
-	ADD_SINGLE_FEATURE(trappedBishopOpening);
-	ADD_SINGLE_FEATURE(trappedBishopEndgame);
+struct EvalTuner::Data
+{
+	std::vector<Board> boards;
+	std::vector<float> outcomes;
+	std::vector<EvalTuneWorker *> workers;
 
-	ADD_SINGLE_FEATURE(unstoppablePasser);
+	void stopWorkers()
+	{
+		for (auto *it : workers)
+			it->kill();
 
-	ADD_SINGLE_FEATURE(doubledPawnOpening);
-	ADD_SINGLE_FEATURE(doubledPawnEndgame);
+		workers.clear();
+	}
+};
 
-	ADD_SINGLE_FEATURE(isolatedPawnOpening);
-	ADD_SINGLE_FEATURE(isolatedPawnEndgame);
+EvalTuner::EvalTuner() : data(new Data)
+{
+}
 
-	ADD_SINGLE_FEATURE(knightHangingOpening);
-	ADD_SINGLE_FEATURE(knightHangingEndgame);
+EvalTuner::~EvalTuner()
+{
+	data->stopWorkers();
+	delete data;
+}
 
-	ADD_SINGLE_FEATURE(bishopHangingOpening);
-	ADD_SINGLE_FEATURE(bishopHangingEndgame);
+bool EvalTuner::load(const char *filename)
+{
+	std::ifstream ifs( filename, std::ios::in );
 
-	ADD_SINGLE_FEATURE(rookHangingOpening);
-	ADD_SINGLE_FEATURE(rookHangingEndgame);
+	if (!ifs.is_open())
+		return false;
 
-	ADD_SINGLE_FEATURE(rookOnOpenOpening);
-	ADD_SINGLE_FEATURE(rookOnOpenEndgame);
+	std::string line;
+	Board b;
 
-	ADD_SINGLE_FEATURE(queenHangingOpening);
-	ADD_SINGLE_FEATURE(queenHangingEndgame);
+	while (std::getline(ifs, line))
+	{
+		const char *ptr = line.c_str();
+		skipSpaces(ptr);
 
-	ADD_SINGLE_FEATURE(kingPasserSupportBase);
-	ADD_SINGLE_FEATURE(kingPasserSupportScale);
+		if (!*ptr)
+			continue;
 
-	addFeature("outpostBonusFile", outpostBonusFile, 8);
-	addFeature("outpostBonusRank", outpostBonusRank, 8);
+		// "outcome fen", outcome from white's point of view
+		char *end = (char *)ptr;
+		double outcome = strtod(ptr, &end);
+		ptr = end;
 
-	ADD_SINGLE_FEATURE(pawnRaceAdvantageEndgame);
+		skipSpaces(ptr);
 
-	addFeature("passerScaleImbalance", passerScaleImbalance, 1);
-	addFeature("passerScaleBlocked", passerScaleBlocked, 1);
+		if (!b.fromFEN(ptr))
+		{
+			std::cout << "invalid fen: " << line << std::endl;
+			return false;
+		}
 
-	addFeature("candPasserOpening", candPasserOpening+1, 6);
-	addFeature("candPasserEndgame", candPasserEndgame+1, 6);
+		// eval isn't meant to be called in check
+		if (b.inCheck())
+			continue;
 
-	addFeature("passerOpening", passerOpening+1, 6);
-	addFeature("passerEndgame", passerEndgame+1, 6);
+		data->boards.push_back(b);
+		data->outcomes.push_back((float)outcome);
+	}
 
-	addFeature("knightMobilityOpening", knightMobility[phOpening], 9);
-	addFeature("knightMobilityEndgame", knightMobility[phEndgame], 9);
+	std::cout << data->boards.size() << " positions loaded" << std::endl;
+	return true;
+}
 
-	addFeature("bishopMobilityOpening", bishopMobility[phOpening], 14);
-	addFeature("bishopMobilityEndgame", bishopMobility[phEndgame], 14);
+double EvalTuner::error()
+{
+	const size_t n = data->boards.size();
 
-	addFeature("rookMobilityOpening", rookMobility[phOpening], 15);
-	addFeature("rookMobilityEndgame", rookMobility[phEndgame], 15);
+	if (!n)
+		return 0;
 
-	addFeature("queenMobilityOpening", queenMobility[phOpening], 28);
-	addFeature("queenMobilityEndgame", queenMobility[phEndgame], 28);
+	const size_t numThreads = (size_t)std::max(1, threads);
 
-	addFeature("goodBishopOpening", goodBishopOpening, 17);
-	addFeature("goodBishopEndgame", goodBishopEndgame, 17);
+	if (data->workers.size() != numThreads)
+	{
+		data->stopWorkers();
 
-	// and finally piece-square tables
+		for (size_t i=0; i<numThreads; i++)
+		{
+			auto *tw = new EvalTuneWorker;
+			tw->run();
+			data->workers.push_back(tw);
+		}
+	}
 
-	addFeature("pawnPsqOpening", PSq::pawnTables[phOpening] + 8, 64-2*8);
-	addFeature("pawnPsqEndgame", PSq::pawnTables[phEndgame] + 8, 64-2*8);
+	// tuning targets the handcrafted eval
+	bool oldHCE = Eval::useHCE;
+	Eval::useHCE = 1;
 
-	addFeature("knightPsqOpening", PSq::knightTables[phOpening], 64);
-	addFeature("knightPsqEndgame", PSq::knightTables[phEndgame], 64);
+	const size_t chunk = (n + numThreads - 1) / numThreads;
 
-	addFeature("bishopPsqOpening", PSq::bishopTables[phOpening], 64);
-	addFeature("bishopPsqEndgame", PSq::bishopTables[phEndgame], 64);
+	for (size_t i=0; i<numThreads; i++)
+	{
+		size_t start = std::min(n, i*chunk);
+
+		auto *tw = data->workers[i];
+		tw->boards = data->boards.data() + start;
+		tw->outcomes = data->outcomes.data() + start;
+		tw->count = std::min(n, start + chunk) - start;
+		tw->k = k;
+		tw->commandEvent.signal();
+	}
 
-	addFeature("rookPsqOpening", PSq::rookTables[phOpening], 64);
-	addFeature("rookPsqEndgame", PSq::rookTables[phEndgame], 64);
+	double total = 0;
 
-	addFeature("queenPsqOpening", PSq::queenTables[phOpening], 64);
-	addFeature("queenPsqEndgame", PSq::queenTables[phEndgame], 64);
+	for (auto *it : data->workers)
+	{
+		it->doneEvent.wait();
+		total += it->sum;
+	}
+
+	Eval::useHCE = oldHCE;
 
-	addFeature("kingPsqOpening", PSq::kingTables[phOpening], 64);
-	addFeature("kingPsqEndgame", PSq::kingTables[phEndgame], 64);
+	return total / (double)n;
+}
 
-	// load actual optimized values
+void EvalTuner::gradient(std::vector<double> &grad)
+{
+	extractFeatures();
 
-	size_t optsz = sizeof(optimizedFeatureVector) / sizeof(i16);
+	grad.assign(featureVector.size(), 0.0);
 
-	optsz = std::min(optsz, featureVector.size());
+	for (size_t i=0; i<featureVector.size(); i++)
+	{
+		const i16 orig = featureVector[i];
 
-	for (size_t i=0; i<optsz; i++)
-		featureVector[i] = optimizedFeatureVector[i];
+		featureVector[i] = (i16)(orig + 1);
+		applyFeatures();
+		double ep = error();
+
+		featureVector[i] = (i16)(orig - 1);
+		applyFeatures();
+		double em = error();
+
+		featureVector[i] = orig;
+		grad[i] = (ep - em) * 0.5;
+	}
+
+	applyFeatures();
+}
+
+bool EvalTuner::checkPsq()
+{
+	extractFeatures();
+
+	double base = error();
+	bool ok = false;
 
 	for (size_t i=0; i<features.size(); i++)
 	{
 		const Feature &ft = features[i];
 
+		if (strstr(ft.name, "Psq") == nullptr && strstr(ft.name, "material") == nullptr)
+			continue;
+
+		// ramp so that white and black contributions don't cancel out
+		std::vector<i16> saved = featureVector;
+
 		for (int j=0; j<ft.size; j++)
-			ft.table[j] = featureVector[ft.start + j];
+			featureVector[ft.start + j] = (i16)(featureVector[ft.start + j] + 8 + j);
+
+		applyFeatures();
+		double err = error();
+
+		featureVector.swap(saved);
+
+		if (err != base)
+			ok = true;
+		else
+			std::cout << "warning: " << ft.name << " doesn't affect error" << std::endl;
 	}
 
-	// re-init psq to bake material into them
-	PSq::init();
+	applyFeatures();
+	return ok;
 }
 
-#undef ADD_SINGLE_FEATURE
+bool EvalTuner::tune(const char *outname)
+{
+	extractFeatures();
 
-}
+	double best = error();
+	std::cout << "tuning " << featureVector.size() << " parameters, " << threads << " threads, initial error "
+		<< best << std::endl;
 
-#ifdef USE_TUNING
+	std::vector<double> grad;
+
+	for (int iter=0; iter<iterations; iter++)
+	{
+		gradient(grad);
 
-#include <iostream>
+		std::vector<i16> saved = featureVector;
 
-namespace cheng4
-{
+		for (size_t i=0; i<featureVector.size(); i++)
+		{
+			if (grad[i] > 0)
+				featureVector[i]--;
+			else if (grad[i] < 0)
+				featureVector[i]++;
+		}
+
+		applyFeatures();
+		double err = error();
+
+		std::cout << "iteration " << iter+1 << " error " << err << std::endl;
+
+		if (err >= best)
+		{
+			// no improvement => done
+			featureVector.swap(saved);
+			applyFeatures();
+			break;
+		}
+
+		best = err;
+
+		if (!saveFeatures(outname))
+			return false;
+	}
+
+	return true;
+}
 
 // TunableParams
 
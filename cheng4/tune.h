@@ -29,6 +29,12 @@ or as public domain (where applicable)
 namespace cheng4
 {
 
+// load optimized eval parameters into eval tables
+// cheap: no allocations, only copies the values
+void initFeatures();
+
+#ifdef USE_TUNING
+
 struct Feature
 {
 	const char *name;
@@ -43,8 +49,46 @@ extern std::vector<i16> featureVector;
 
 void addFeature(const char *name, i16 *ptr, int count = 1);
 bool saveFeatures(const char *filename);
+// build features/featureVector from current eval tables (only done once)
 void extractFeatures();
 void freeFeatures();
+// copy featureVector back into eval tables
+void applyFeatures();
+
+// texel-style tuner for handcrafted eval parameters
+struct EvalTuner
+{
+	int threads = 4;
+	int iterations = 100;
+	// sigmoid scale
+	double k = 1.0;
+
+	EvalTuner();
+	~EvalTuner();
+
+	// load positions, one "outcome fen" per line (see LabelFEN)
+	bool load(const char *filename);
+
+	// mean squared error of sigmoid(eval) vs outcome
+	// (worker threads are started on first call and kept until the tuner is destroyed)
+	double error();
+
+	// sanity check: tweaking psq/material tables must change error (tunecheck command)
+	bool checkPsq();
+
+	// central difference gradient of error for each entry in featureVector
+	void gradient(std::vector<double> &grad);
+
+	// descend along gradient sign, saving featureVector to outname after each improvement
+	bool tune(const char *outname);
+
+private:
+	// positions and worker threads (board.h can't be included here)
+	struct Data;
+	Data *data;
+};
+
+#endif
 
 }
 
@@ -28,6 +28,7 @@ or as public domain (where applicable)
 #endif
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
 
 #ifdef _WIN32
 #	include <Windows.h>
@@ -147,4 +148,124 @@ void getline(std::string &line)
 #endif
 }
 
+unsigned fnv1a( const void *data, size_t size, unsigned seed )
+{
+	const unsigned char *ptr = static_cast< const unsigned char * >( data );
+	unsigned res = seed;
+
+	for ( size_t i=0; i<size; i++ )
+	{
+		res ^= ptr[i];
+		res *= 16777619u;
+	}
+
+	return res;
+}
+
+// two digits at a time
+static const char decimalPairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+char *formatDecimal( char *bufEnd, unsigned long long value )
+{
+	char *p = bufEnd;
+
+	while ( value >= 100 )
+	{
+		const char *pair = decimalPairs + 2*(value % 100);
+		value /= 100;
+		*--p = pair[1];
+		*--p = pair[0];
+	}
+
+	if ( value >= 10 )
+	{
+		const char *pair = decimalPairs + 2*value;
+		*--p = pair[1];
+		*--p = pair[0];
+	}
+	else
+		*--p = (char)('0' + value);
+
+	return p;
+}
+
+// TextBuffer
+
+TextBuffer::TextBuffer( size_t initialCapacity ) : buf(0), used(0), capacity(0)
+{
+	grow( initialCapacity );
+}
+
+TextBuffer::~TextBuffer()
+{
+	free( buf );
+}
+
+void TextBuffer::grow( size_t minCapacity )
+{
+	size_t ncap = capacity ? capacity : 64;
+	while ( ncap < minCapacity )
+		ncap *= 2;
+
+	char *nbuf = static_cast<char *>(realloc( buf, ncap ));
+	if ( !nbuf )
+		abort();
+
+	buf = nbuf;
+	capacity = ncap;
+}
+
+void TextBuffer::append( const char *str, size_t len )
+{
+	memcpy( reserve( len ), str, len );
+	used += len;
+}
+
+void TextBuffer::appendPadded( const char *str, int len, int width )
+{
+	char *dst = reserve( (size_t)(len > width ? len : width) );
+
+	for ( ; width > len; width-- )
+		*dst++ = ' ';
+
+	memcpy( dst, str, len );
+	commit( dst + len );
+}
+
+void TextBuffer::appendUInt( unsigned long long value, int width )
+{
+	char tmp[24];
+	char *end = tmp + sizeof(tmp);
+	char *start = formatDecimal( end, value );
+
+	appendPadded( start, (int)(end - start), width );
+}
+
+void TextBuffer::appendInt( long long value, int width )
+{
+	char tmp[24];
+	char *end = tmp + sizeof(tmp);
+	char *start;
+
+	if ( value < 0 )
+	{
+		start = formatDecimal( end, 0ull - (unsigned long long)value );
+		*--start = '-';
+	}
+	else
+		start = formatDecimal( end, (unsigned long long)value );
+
+	appendPadded( start, (int)(end - start), width );
+}
+
 }
@@ -25,6 +25,7 @@ or as public domain (where applicable)
 
 #include <cstddef>
 #include <string>
+#include <cstring>
 
 // various utility functions that didn't fit elsewhere
 
@@ -54,4 +55,64 @@ inline T clamp(T val, T minv, T maxv)
 
 void getline(std::string &line);
 
+// 32-bit FNV-1a hash (file checksums), pass previous result as seed to continue
+unsigned fnv1a( const void *data, size_t size, unsigned seed = 2166136261u );
+
+// formats unsigned decimal backwards, returns pointer to the first digit
+// buf must hold at least 20 chars and point past the end
+char *formatDecimal( char *bufEnd, unsigned long long value );
+
+// reusable text buffer for protocol output
+// replaces iostreams where speed matters: no locale, no temporaries,
+// memory only gets reallocated when the buffer grows
+class TextBuffer
+{
+	TextBuffer( const TextBuffer & );
+	TextBuffer &operator =( const TextBuffer & );
+
+	char *buf;
+	size_t used;
+	size_t capacity;
+
+	void grow( size_t minCapacity );
+	void appendPadded( const char *str, int len, int width );
+public:
+	explicit TextBuffer( size_t initialCapacity = 1024 );
+	~TextBuffer();
+
+	inline void clear() { used = 0; }
+	inline bool empty() const { return !used; }
+	inline size_t size() const { return used; }
+	// note: not null-terminated
+	inline const char *data() const { return buf; }
+
+	// returns write pointer with at least n bytes available; finish with commit()
+	inline char *reserve( size_t n )
+	{
+		if ( used + n > capacity )
+			grow( used + n );
+		return buf + used;
+	}
+	inline void commit( const char *end )
+	{
+		used = end - buf;
+	}
+
+	void append( const char *str, size_t len );
+
+	// right-aligned, padded with spaces to width
+	void appendInt( long long value, int width = 0 );
+	void appendUInt( unsigned long long value, int width = 0 );
+
+	inline TextBuffer &operator <<( const char *str ) { append( str, strlen(str) ); return *this; }
+	inline TextBuffer &operator <<( const std::string &str ) { append( str.data(), str.size() ); return *this; }
+	inline TextBuffer &operator <<( char ch ) { *reserve(1) = ch; used++; return *this; }
+	inline TextBuffer &operator <<( int value ) { appendInt( value ); return *this; }
+	inline TextBuffer &operator <<( long value ) { appendInt( value ); return *this; }
+	inline TextBuffer &operator <<( long long value ) { appendInt( value ); return *this; }
+	inline TextBuffer &operator <<( unsigned value ) { appendUInt( value ); return *this; }
+	inline TextBuffer &operator <<( unsigned long value ) { appendUInt( value ); return *this; }
+	inline TextBuffer &operator <<( unsigned long long value ) { appendUInt( value ); return *this; }
+};
+
 }
@@ -25,11 +25,16 @@ or as public domain (where applicable)
 #include "../cheng4/engine.h"
 #include "../cheng4/book.h"
 #include "../cheng4/movegen.h"
+#include "../cheng4/thread.h"
+#include "../cheng4/mapfile.h"
 #include <stdio.h>
 #include "pgzobrist.h"
 #include <string>
 #include <set>
+#include <vector>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 //#define USE_SEARCH
 
@@ -524,10 +529,803 @@ void convertBookLines( const char *fnm, const char *ofnm )
 	fclose(f2);
 }
 
+// parallel book builder
+// games are replayed on worker threads into per-thread entry buffers,
+// full buffers are sorted, combined and spilled to disk as runs
+// runs are k-way merged into polyglot and cheng book in a single pass
+
+struct BuildEntry
+{
+	u64 key;
+	u32 count;			// weight: 2 per win, 1 per draw, 0 per loss from mover's point of view (2 if result unknown)
+	u32 n;				// number of games
+	u32 sum;			// score points (2 win, 1 draw, 1 if result unknown)
+	u16 move;			// polyglot move
+
+	inline bool operator <( const BuildEntry &o ) const
+	{
+		if ( key != o.key )
+			return key < o.key;
+		return move < o.move;
+	}
+
+	inline bool sameMove( const BuildEntry &o ) const
+	{
+		return key == o.key && move == o.move;
+	}
+
+	inline void add( const BuildEntry &o )
+	{
+		count += o.count;
+		n += o.n;
+		sum += o.sum;
+	}
+};
+
+// sorts and combines duplicate moves in place
+static void combineEntries( std::vector< BuildEntry > &ents )
+{
+	std::sort( ents.begin(), ents.end() );
+
+	size_t res = 0;
+	for ( size_t i=0; i<ents.size(); i++ )
+	{
+		if ( res && ents[res-1].sameMove( ents[i] ) )
+			ents[res-1].add( ents[i] );
+		else
+			ents[res++] = ents[i];
+	}
+	ents.resize( res );
+}
+
+// buffered sequential reader of a sorted run
+struct BuildRunReader
+{
+	FILE *f;
+	std::vector< BuildEntry > buf;
+	size_t pos;
+
+	BuildRunReader() : f(0), pos(0) {}
+
+	~BuildRunReader()
+	{
+		if ( f )
+			fclose( f );
+	}
+
+	bool open( const std::string &fnm )
+	{
+		f = fopen( fnm.c_str(), "rb" );
+		return f != 0 && fill();
+	}
+
+	bool fill()
+	{
+		buf.resize( 4096 );
+		size_t rd = fread( buf.data(), sizeof(BuildEntry), buf.size(), f );
+		buf.resize( rd );
+		pos = 0;
+		return rd > 0;
+	}
+
+	inline const BuildEntry &top() const
+	{
+		return buf[pos];
+	}
+
+	// returns 0 at end of run
+	inline bool next()
+	{
+		return ++pos < buf.size() || fill();
+	}
+};
+
+class BookBuilder;
+
+class BookBuildWorker : public Thread
+{
+public:
+	BookBuilder *builder;
+	std::vector< BuildEntry > entries;
+	std::vector< std::string > runs;
+	u64 games;
+	u64 moves;
+	bool ok;
+
+	BookBuildWorker() : builder(0), games(0), moves(0), ok(1) {}
+
+	void work();
+
+private:
+	struct GameMove
+	{
+		u64 key;
+		u16 move;
+		Color stm;
+	};
+
+	Board board;
+	std::vector< GameMove > gameMoves;
+	int tagResult, textResult;		// white score points (2/1/0), -1 = unknown
+	bool replaying;
+
+	void parse( const char *ptr, const char *end );
+	void parseTag( const char *ptr, const char *end );
+	void beginGame();
+	void finishGame();
+	void playToken( const char *tok, size_t len );
+	void add( const BuildEntry &e );
+	bool spill();
+};
+
+class BookBuilder
+{
+	friend class BookBuildWorker;
+
+	MappedFile input;
+	// chunk boundaries, cut at game starts
+	std::vector< size_t > chunks;
+	std::atomic<int> nextChunk;
+	std::atomic<int> nextRun;
+	size_t bufferEntries;
+	std::string runPrefix;
+
+	bool findChunks( size_t chunkSize );
+	std::string runName();
+	// merge runs into a single run until they fit into maxWays
+	bool reduceRuns( std::vector< std::string > &runs );
+	bool mergeRuns( const std::vector< std::string > &runs, const char *outname );
+	bool writePosition( std::vector< BuildEntry > &pos, FILE *fpg, FILE *fcb, pgimport::BookBits &bits, u32 &nent, u32 &npos );
+public:
+	int threads;
+	int maxPlies;			// only the first maxPlies plies of each game are used, 0 = all
+	size_t memoryMB;		// entry buffers (all threads)
+	u32 minGames;			// drop moves played in fewer games
+	int maxWays;			// max runs merged at once
+
+	BookBuilder() : bufferEntries(0), threads(1), maxPlies(40), memoryMB(1024), minGames(1), maxWays(256)
+	{
+		nextChunk = 0;
+		nextRun = 0;
+	}
+
+	// infnm: PGN or one game per line (SAN moves)
+	// writes outname.bin (polyglot) and outname.cb (cheng)
+	bool build( const char *infnm, const char *outname );
+};
+
+void BookBuildWorker::work()
+{
+	const char *data = (const char *)builder->input.data();
+
+	for (;;)
+	{
+		int idx = builder->nextChunk++;
+		if ( idx+1 >= (int)builder->chunks.size() )
+			break;
+		parse( data + builder->chunks[idx], data + builder->chunks[idx+1] );
+	}
+
+	if ( !entries.empty() && !spill() )
+		ok = 0;
+}
+
+void BookBuildWorker::beginGame()
+{
+	board.reset();
+	gameMoves.clear();
+	tagResult = textResult = -1;
+	replaying = 1;
+}
+
+void BookBuildWorker::finishGame()
+{
+	int result = tagResult >= 0 ? tagResult : textResult;
+
+	for ( size_t i=0; i<gameMoves.size(); i++ )
+	{
+		const GameMove &gm = gameMoves[i];
+		BuildEntry e;
+		e.key = gm.key;
+		e.move = gm.move;
+		e.n = 1;
+
+		if ( result < 0 )
+		{
+			e.count = 2;
+			e.sum = 1;
+		}
+		else
+			e.count = e.sum = (u32)(gm.stm == ctWhite ? result : 2 - result);
+
+		add( e );
+	}
+
+	if ( !gameMoves.empty() )
+		games++;
+
+	beginGame();
+}
+
+static int parseResult( const char *tok, size_t len )
+{
+	if ( len == 3 && !memcmp( tok, "1-0", 3 ) )
+		return 2;
+	if ( len == 3 && !memcmp( tok, "0-1", 3 ) )
+		return 0;
+	if ( len == 7 && !memcmp( tok, "1/2-1/2", 7 ) )
+		return 1;
+	return -1;
+}
+
+void BookBuildWorker::playToken( const char *tok, size_t len )
+{
+	int res = parseResult( tok, len );
+	if ( res >= 0 )
+	{
+		textResult = res;
+		return;
+	}
+
+	// move number (possibly glued to move: 12.e4)
+	while ( len && (isdigit((u8)*tok) || *tok == '.') )
+	{
+		tok++;
+		len--;
+	}
+
+	// annotations
+	while ( len && (tok[len-1] == '!' || tok[len-1] == '?') )
+		len--;
+
+	if ( !len || *tok == '*' || *tok == '$' || !replaying )
+		return;
+
+	if ( builder->maxPlies > 0 && (int)gameMoves.size() >= builder->maxPlies )
+	{
+		replaying = 0;
+		return;
+	}
+
+	// fromSAN needs zero-terminated input
+	char buf[16];
+	if ( len >= sizeof(buf) )
+	{
+		replaying = 0;
+		return;
+	}
+	memcpy( buf, tok, len );
+	buf[len] = 0;
+
+	const char *ptr = buf;
+	Move m = board.fromSAN( ptr );
+
+	if ( m == mcNone )
+	{
+		// illegal move => use the game up to here
+		replaying = 0;
+		return;
+	}
+
+	GameMove gm;
+	gm.key = PGHash( board );
+	gm.move = toPGMove( m, board );
+	gm.stm = board.turn();
+	gameMoves.push_back( gm );
+	moves++;
+
+	UndoInfo ui;
+	bool isCheck = board.isCheck( m, board.discovered() );
+	board.doMove( m, ui, isCheck );
+}
+
+void BookBuildWorker::parseTag( const char *ptr, const char *end )
+{
+	static const char tag[] = "[Result \"";
+	const size_t tagLen = sizeof(tag)-1;
+
+	if ( (size_t)(end - ptr) <= tagLen || memcmp( ptr, tag, tagLen ) )
+		return;
+
+	ptr += tagLen;
+	const char *q = ptr;
+	while ( q < end && *q != '"' )
+		q++;
+
+	tagResult = parseResult( ptr, (size_t)(q - ptr) );
+}
+
+static inline bool isTokenChar( char c )
+{
+	return c && !isspace((u8)c) && c != '{' && c != '}' && c != '(' && c != ')' && c != ';';
+}
+
+void BookBuildWorker::parse( const char *ptr, const char *end )
+{
+	beginGame();
+
+	bool headers = 0;			// game has tag section => movetext ends at blank line or next tag section
+	bool movetext = 0;
+	bool lineStart = 1;
+	bool comment = 0;
+	int variation = 0;
+
+	while ( ptr < end )
+	{
+		char c = *ptr;
+
+		if ( lineStart && !comment && !variation )
+		{
+			lineStart = 0;
+
+			if ( c == '[' )
+			{
+				if ( movetext )
+				{
+					finishGame();
+					movetext = 0;
+				}
+				headers = 1;
+				const char *eol = (const char *)memchr( ptr, '\n', (size_t)(end - ptr) );
+				if ( !eol )
+					eol = end;
+				parseTag( ptr, eol );
+				ptr = eol;
+				continue;
+			}
+
+			const char *p = ptr;
+			while ( p < end && (*p == ' ' || *p == '\t' || *p == '\r') )
+				p++;
+
+			if ( p == end || *p == '\n' )
+			{
+				// blank line
+				if ( movetext && headers )
+				{
+					finishGame();
+					movetext = headers = 0;
+				}
+				ptr = p;
+				continue;
+			}
+		}
+
+		if ( c == '\n' )
+		{
+			lineStart = 1;
+			ptr++;
+			// one game per line without tag section
+			if ( movetext && !headers && !comment && !variation )
+			{
+				finishGame();
+				movetext = 0;
+			}
+			continue;
+		}
+
+		if ( comment )
+		{
+			comment = c != '}';
+			ptr++;
+			continue;
+		}
+
+		switch( c )
+		{
+		case '{':
+			comment = 1;
+			ptr++;
+			continue;
+		case ';':
+			while ( ptr < end && *ptr != '\n' )
+				ptr++;
+			continue;
+		case '(':
+			variation++;
+			ptr++;
+			continue;
+		case ')':
+			if ( variation )
+				variation--;
+			ptr++;
+			continue;
+		}
+
+		if ( variation || !isTokenChar(c) )
+		{
+			ptr++;
+			continue;
+		}
+
+		const char *tok = ptr;
+		while ( ptr < end && isTokenChar(*ptr) )
+			ptr++;
+
+		movetext = 1;
+		playToken( tok, (size_t)(ptr - tok) );
+	}
+
+	if ( movetext )
+		finishGame();
+}
+
+void BookBuildWorker::add( const BuildEntry &e )
+{
+	entries.push_back( e );
+
+	if ( entries.size() < builder->bufferEntries )
+		return;
+
+	// openings repeat a lot => combining usually frees most of the buffer
+	combineEntries( entries );
+
+	if ( entries.size() > builder->bufferEntries/2 && !spill() )
+		ok = 0;
+}
+
+bool BookBuildWorker::spill()
+{
+	combineEntries( entries );
+
+	std::string fnm = builder->runName();
+	FILE *f = fopen( fnm.c_str(), "wb" );
+	if ( !f )
+		return 0;
+	bool res = fwrite( entries.data(), sizeof(BuildEntry), entries.size(), f ) == entries.size();
+	res = (fclose( f ) == 0) && res;
+
+	runs.push_back( fnm );
+	entries.clear();
+	return res;
+}
+
+std::string BookBuilder::runName()
+{
+	char buf[32];
+	sprintf( buf, ".run%d.tmp", (int)nextRun++ );
+	return runPrefix + buf;
+}
+
+bool BookBuilder::findChunks( size_t chunkSize )
+{
+	const char *data = (const char *)input.data();
+	size_t size = input.size();
+
+	// PGN with tag sections: cut before [Event, otherwise after any newline
+	size_t first = 0;
+	while ( first < size && isspace((u8)data[first]) )
+		first++;
+	bool tags = first < size && data[first] == '[';
+
+	static const char eventTag[] = "\n[Event ";
+	const size_t eventLen = sizeof(eventTag)-1;
+
+	chunks.clear();
+	chunks.push_back( 0 );
+
+	size_t pos = chunkSize;
+	while ( pos < size )
+	{
+		const char *p = data + pos;
+		const char *pend = data + size;
+
+		for (;;)
+		{
+			p = (const char *)memchr( p, '\n', (size_t)(pend - p) );
+			if ( !p || !tags || ((size_t)(pend - p) > eventLen && !memcmp( p, eventTag, eventLen )) )
+				break;
+			p++;
+		}
+
+		if ( !p )
+			break;
+
+		size_t cut = (size_t)(p - data) + 1;
+		chunks.push_back( cut );
+		pos = cut + chunkSize;
+	}
+
+	if ( chunks.back() != size )
+		chunks.push_back( size );
+
+	return chunks.size() > 1;
+}
+
+// k-way merge of sorted runs, emit is called for each combined move in order
+template< typename F > static bool mergeRunFiles( const std::vector< std::string > &runs, F emit )
+{
+	std::vector< BuildRunReader * > readers;
+	std::vector< int > heap;
+	bool res = 1;
+
+	for ( size_t i=0; i<runs.size(); i++ )
+	{
+		readers.push_back( new BuildRunReader );
+		if ( readers.back()->open( runs[i] ) )
+			heap.push_back( (int)i );
+		else
+			res = 0;
+	}
+
+	// min-heap over current run heads
+	auto cmp = [&readers]( int a, int b )
+	{
+		return readers[b]->top() < readers[a]->top();
+	};
+
+	std::make_heap( heap.begin(), heap.end(), cmp );
+
+	BuildEntry cur;
+	bool have = 0;
+
+	while ( res && !heap.empty() )
+	{
+		std::pop_heap( heap.begin(), heap.end(), cmp );
+		int i = heap.back();
+		const BuildEntry &e = readers[i]->top();
+
+		if ( have && cur.sameMove( e ) )
+			cur.add( e );
+		else
+		{
+			if ( have )
+				res = emit( cur );
+			cur = e;
+			have = 1;
+		}
+
+		if ( readers[i]->next() )
+			std::push_heap( heap.begin(), heap.end(), cmp );
+		else
+			heap.pop_back();
+	}
+
+	if ( res && have )
+		res = emit( cur );
+
+	for ( size_t i=0; i<readers.size(); i++ )
+		delete readers[i];
+
+	return res;
+}
+
+bool BookBuilder::reduceRuns( std::vector< std::string > &runs )
+{
+	while ( (int)runs.size() > maxWays )
+	{
+		std::vector< std::string > group( runs.begin(), runs.begin() + maxWays );
+		runs.erase( runs.begin(), runs.begin() + maxWays );
+
+		std::string fnm = runName();
+		FILE *f = fopen( fnm.c_str(), "wb" );
+		if ( !f )
+			return 0;
+
+		bool res = mergeRunFiles( group, [f]( const BuildEntry &e )
+		{
+			return fwrite( &e, sizeof(e), 1, f ) == 1;
+		});
+		res = (fclose( f ) == 0) && res;
+
+		for ( size_t i=0; i<group.size(); i++ )
+			remove( group[i].c_str() );
+
+		runs.push_back( fnm );
+
+		if ( !res )
+			return 0;
+	}
+	return 1;
+}
+
+static bool buildEntryWeightPred( const BuildEntry &a, const BuildEntry &b )
+{
+	// same order as BookSortPred within a position
+	if ( a.count != b.count )
+		return a.count > b.count;
+	return a.move < b.move;
+}
+
+bool BookBuilder::writePosition( std::vector< BuildEntry > &pos, FILE *fpg, FILE *fcb, pgimport::BookBits &bits, u32 &nent, u32 &npos )
+{
+	size_t cnt = 0;
+	u32 maxCount = 0;
+	for ( size_t i=0; i<pos.size(); i++ )
+	{
+		if ( pos[i].n < minGames )
+			continue;
+		maxCount = std::max( maxCount, pos[i].count );
+		pos[cnt++] = pos[i];
+	}
+	pos.resize( cnt );
+
+	if ( pos.empty() )
+		return 1;
+
+	// polyglot weights are 16-bit => scale per position
+	if ( maxCount > 65535 )
+	{
+		for ( size_t i=0; i<pos.size(); i++ )
+		{
+			u32 c = pos[i].count;
+			pos[i].count = c ? std::max( 1u, (u32)((u64)c * 65535 / maxCount) ) : 0;
+		}
+	}
+
+	std::sort( pos.begin(), pos.end(), buildEntryWeightPred );
+
+	bool res = 1;
+	for ( size_t i=0; i<pos.size(); i++ )
+	{
+		PGEntry ent;
+		ent.key = pos[i].key;
+		ent.move = pos[i].move;
+		ent.count = (u16)pos[i].count;
+		// polyglot learn field stays zero like in converted books
+		ent.n = ent.sum = 0;
+
+		// cheng: key, move, count (native)
+		res = res && fwrite( &ent, 12, 1, fcb ) == 1;
+		ent.byteSwap();
+		res = res && fwrite( &ent, sizeof(ent), 1, fpg ) == 1;
+
+		bits.set( pos[i].key );
+		nent++;
+	}
+	npos++;
+	pos.clear();
+	return res;
+}
+
+static bool writeChengHeader( FILE *f, u32 nent, u32 npos, const pgimport::BookBits &bits )
+{
+	char header[16] = "generic book   ";
+	u32 pad[2] = {0, 0};
+	return fseek( f, 0, SEEK_SET ) == 0 &&
+		fwrite( header, 16, 1, f ) == 1 &&
+		fwrite( &nent, 4, 1, f ) == 1 &&
+		fwrite( &npos, 4, 1, f ) == 1 &&
+		fwrite( pad, sizeof(pad), 1, f ) == 1 &&
+		fwrite( &bits, sizeof(bits), 1, f ) == 1;
+}
+
+bool BookBuilder::mergeRuns( const std::vector< std::string > &runs, const char *outname )
+{
+	std::string pgname = std::string( outname ) + ".bin";
+	std::string cbname = std::string( outname ) + ".cb";
+	FILE *fpg = fopen( pgname.c_str(), "wb" );
+	FILE *fcb = fopen( cbname.c_str(), "wb" );
+
+	pgimport::BookBits bits;
+	bits.clear();
+	u32 nent = 0, npos = 0;
+
+	bool res = fpg && fcb && writeChengHeader( fcb, 0, 0, bits );
+
+	if ( res )
+	{
+		std::vector< BuildEntry > pos;
+
+		res = mergeRunFiles( runs, [&]( const BuildEntry &e )
+		{
+			if ( !pos.empty() && pos[0].key != e.key && !writePosition( pos, fpg, fcb, bits, nent, npos ) )
+				return false;
+			pos.push_back( e );
+			return true;
+		});
+
+		res = res && writePosition( pos, fpg, fcb, bits, nent, npos );
+		// now that we know the counts
+		res = res && writeChengHeader( fcb, nent, npos, bits );
+	}
+
+	if ( fpg )
+		res = (fclose( fpg ) == 0) && res;
+	if ( fcb )
+		res = (fclose( fcb ) == 0) && res;
+
+	std::cout << "Book: " << nent << " entries, " << npos << " positions" << std::endl;
+	return res;
+}
+
+bool BookBuilder::build( const char *infnm, const char *outname )
+{
+	i32 start = Timer::getMillisec();
+
+	if ( !input.open( infnm ) )
+	{
+		std::cout << "unable to open " << infnm << std::endl;
+		return 0;
+	}
+
+	threads = std::max( 1, std::min( threads, 256 ) );
+	bufferEntries = std::max( memoryMB*1024*1024 / threads / sizeof(BuildEntry), (size_t)65536 );
+	runPrefix = outname;
+	findChunks( 16*1024*1024 );
+
+	std::vector< BookBuildWorker * > workers;
+	for ( int i=0; i<threads; i++ )
+	{
+		BookBuildWorker *w = new BookBuildWorker;
+		w->builder = this;
+		w->entries.reserve( bufferEntries );
+		workers.push_back( w );
+		w->run();
+	}
+
+	u64 games = 0, moves = 0;
+	bool res = 1;
+	std::vector< std::string > runs;
+
+	for ( size_t i=0; i<workers.size(); i++ )
+	{
+		BookBuildWorker *w = workers[i];
+		w->wait();
+		games += w->games;
+		moves += w->moves;
+		runs.insert( runs.end(), w->runs.begin(), w->runs.end() );
+		res = res && w->ok;
+		w->kill();
+	}
+
+	input.close();
+
+	std::cout << games << " games, " << moves << " moves, " << runs.size() << " runs" << std::endl;
+
+	res = res && reduceRuns( runs ) && mergeRuns( runs, outname );
+
+	for ( size_t i=0; i<runs.size(); i++ )
+		remove( runs[i].c_str() );
+
+	std::cout << (res ? "Done" : "Failed") << " in " << Timer::getMillisec() - start << " ms" << std::endl;
+	return res;
+}
+
+// pgimport -build <games> [-out name] [-threads n] [-plies n] [-mem mb] [-mingames n]
+static int buildBook( int argc, char **argv )
+{
+	BookBuilder bb;
+	bb.threads = (int)std::max( 1u, std::thread::hardware_concurrency() );
+	const char *infnm = 0;
+	const char *outname = "book";
+
+	for ( int i=2; i<argc; i++ )
+	{
+		if ( i+1 < argc && !strcmp( argv[i], "-out" ) )
+			outname = argv[++i];
+		else if ( i+1 < argc && !strcmp( argv[i], "-threads" ) )
+			bb.threads = atoi( argv[++i] );
+		else if ( i+1 < argc && !strcmp( argv[i], "-plies" ) )
+			bb.maxPlies = atoi( argv[++i] );
+		else if ( i+1 < argc && !strcmp( argv[i], "-mem" ) )
+			bb.memoryMB = (size_t)std::max( 1, atoi( argv[++i] ) );
+		else if ( i+1 < argc && !strcmp( argv[i], "-mingames" ) )
+			bb.minGames = (u32)std::max( 1, atoi( argv[++i] ) );
+		else
+			infnm = argv[i];
+	}
+
+	if ( !infnm )
+	{
+		std::cout << "usage: pgimport -build <games> [-out name] [-threads n] [-plies n] [-mem mb] [-mingames n]" << std::endl;
+		return 1;
+	}
+
+	return bb.build( infnm, outname ) ? 0 : 1;
+}
+
 int main( int argc, char **argv )
 {
 	cheng4::Engine::init();
 
+	if ( argc > 1 && !strcmp( argv[1], "-build" ) )
+	{
+		int res = buildBook( argc, argv );
+		cheng4::Engine::done();
+		return res;
+	}
+
 #if 0
 	// new: use generic book lines...
 	convertBookLines("booklines.txt", "booklines.bin");
@@ -35,15 +35,53 @@ or as public domain (where applicable)
 #include <fstream>
 #include <iostream>
 
-// matches cheng's entry size
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <atomic>
+#include <memory>
+
+#include "../trainer/memmap.h"
+#include "../trainer/train_data.h"
+
+#if defined(_MSC_VER)
+#	include <xmmintrin.h>
+#	define prefetch_entry(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#	define prefetch_entry(p) __builtin_prefetch(p)
+#endif
+
+// matches cheng's entry size (containers store it in their header)
 size_t entry_size = 28;
 
 // min/max entries per chunk
 size_t min_entries = 50'000'000;
 size_t max_entries = 100'000'000;
 
+// external shuffle: number of bucket files (0 = auto, each bucket about min_entries)
+size_t num_buckets = 0;
+// use old chunked shuffle instead of bucket scatter
+bool chunked = false;
+// mmap input and gather through a permutation (input must fit into address space)
+bool mapped = false;
+// gather threads for mapped mode and container decoding threads (0 = auto)
+size_t num_threads = 0;
+
+// I/O block size for streaming passes
+constexpr size_t io_block_size = 64u << 20;
+// per-bucket staging buffer size for scatter pass
+constexpr size_t staging_size = 4u << 20;
+// I/O buffer alignment
+constexpr size_t io_alignment = 4096;
+
 std::string in_filename;
 std::string out_filename;
+std::string tmp_prefix;
+
+// cheng4 training data container input (decoded on the fly), unused for raw input
+train_data container;
 
 struct Plan
 {
@@ -64,6 +102,18 @@ int parse_args(int argc, const char **argv)
 		// ugh... no starts_with for string
 		if (arg.length() > 2 && arg[0] == '-' && arg[1] == '-')
 		{
+			if (arg == "--chunked")
+			{
+				chunked = true;
+				continue;
+			}
+
+			if (arg == "--mmap")
+			{
+				mapped = true;
+				continue;
+			}
+
 			if (i+1 >= argc)
 			{
 				std::cerr << "no argument after " << arg << std::endl;
@@ -89,6 +139,24 @@ int parse_args(int argc, const char **argv)
 				i++;
 			}
 
+			if (arg == "--buckets")
+			{
+				num_buckets = strtol(argv[i+1], nullptr, 10);
+				i++;
+			}
+
+			if (arg == "--threads")
+			{
+				num_threads = strtol(argv[i+1], nullptr, 10);
+				i++;
+			}
+
+			if (arg == "--tmp")
+			{
+				tmp_prefix = argv[i+1];
+				i++;
+			}
+
 			continue;
 		}
 
@@ -125,12 +193,22 @@ int parse_args(int argc, const char **argv)
 	if (file_name_idx != 2)
 	{
 		std::cout << "usage: shuffler <infile> <outfile>" << std::endl;
-		std::cout << "       --entry n    entry size in bytes, default 38" << std::endl;
+		std::cout << "       infile: raw entries or cheng4 training data container (output is raw)" << std::endl;
+		std::cout << "       --entry n    entry size in bytes of raw input, default 28" << std::endl;
 		std::cout << "       --min n      minimum number of entries per batch, default 50 million" << std::endl;
 		std::cout << "       --max n      maximum number of entries per batch, default 100 million" << std::endl;
+		std::cout << "       --buckets n  number of temporary bucket files, default: input size / min" << std::endl;
+		std::cout << "       --tmp path   bucket file prefix, default: <outfile>" << std::endl;
+		std::cout << "       --chunked    old mode: shuffle random chunks (no temporary files)" << std::endl;
+		std::cout << "       --mmap       map input and write gathered permutation (no temporary files)" << std::endl;
+		std::cout << "                    containers are decoded into memory instead" << std::endl;
+		std::cout << "       --threads n  gather threads for --mmap and container decoding threads, default: all cores" << std::endl;
 		return -1;
 	}
 
+	if (tmp_prefix.empty())
+		tmp_prefix = out_filename;
+
 	return 0;
 }
 
@@ -141,15 +219,15 @@ void shuffle_vector(T &rng, std::vector<U> &vec)
 		return;
 
 	// fisher-yates shuffle
-	for (size_t i=vec.size()-1; i>1; i--)
+	for (size_t i=vec.size()-1; i>0; i--)
 	{
-		auto swidx = rng() % i;
+		auto swidx = rng() % (i+1);
 		std::swap(vec[i], vec[swidx]);
 	}
 }
 
 template<typename T>
-void shuffle_buffer(T &rng, std::vector<uint8_t> &buffer, size_t count)
+void shuffle_buffer(T &rng, uint8_t *buffer, size_t count)
 {
 	if (!count)
 		return;
@@ -158,9 +236,13 @@ void shuffle_buffer(T &rng, std::vector<uint8_t> &buffer, size_t count)
 	ebuf.resize(entry_size);
 
 	// fisher-yates shuffle
-	for (size_t i=count-1; i>1; i--)
+	for (size_t i=count-1; i>0; i--)
 	{
-		auto swidx = rng() % i;
+		auto swidx = rng() % (i+1);
+
+		// memcpy can't overlap
+		if (swidx == i)
+			continue;
 
 		// swap
 		memcpy(ebuf.data(), &buffer[i*entry_size], entry_size);
@@ -202,20 +284,25 @@ void create_plan(T &rnd_engine, uint64_t in_size)
 	std::cout << "plan: " << plan.size() << " chunks" << std::endl;
 }
 
-int shuffle_main()
+int chunked_shuffle_main()
 {
 	std::ifstream f;
-	f.open(in_filename.c_str(), std::ios_base::binary | std::ios_base::in);
+	uint64_t in_size = container.size() * entry_size;
 
-	if (f.fail())
+	if (!container.is_container())
 	{
-		std::cerr << "cannot open " << in_filename << std::endl;
-		return 4;
-	}
+		f.open(in_filename.c_str(), std::ios_base::binary | std::ios_base::in);
 
-	f.seekg(0, std::ios_base::end);
-	auto in_size = f.tellg();
-	f.seekg(0, std::ios_base::beg);
+		if (f.fail())
+		{
+			std::cerr << "cannot open " << in_filename << std::endl;
+			return 4;
+		}
+
+		f.seekg(0, std::ios_base::end);
+		in_size = f.tellg();
+		f.seekg(0, std::ios_base::beg);
+	}
 
 	std::mt19937_64 rnd_engine;
 	rnd_engine.seed(std::chrono::high_resolution_clock::now().time_since_epoch().count());
@@ -253,8 +340,16 @@ int shuffle_main()
 			next_report += step_report;
 		}
 
-		f.seekg(it.source_file_offset, std::ios_base::beg);
-		f.read((char *)buffer.data(), it.num_entries * entry_size);
+		if (container.is_container())
+		{
+			if (!container.read(it.source_file_offset / entry_size, it.num_entries, buffer.data()))
+				f.setstate(std::ios_base::failbit);
+		}
+		else
+		{
+			f.seekg(it.source_file_offset, std::ios_base::beg);
+			f.read((char *)buffer.data(), it.num_entries * entry_size);
+		}
 
 		if (f.fail())
 		{
@@ -262,7 +357,7 @@ int shuffle_main()
 			return 6;
 		}
 
-		shuffle_buffer(rnd_engine, buffer, it.num_entries);
+		shuffle_buffer(rnd_engine, buffer.data(), it.num_entries);
 
 		fo.write((char *)buffer.data(), it.num_entries * entry_size);
 
@@ -278,10 +373,577 @@ int shuffle_main()
 	return 0;
 }
 
+// aligned heap buffer for large I/O blocks
+struct aligned_buffer
+{
+	void resize(size_t sz)
+	{
+		if (sz <= capacity)
+		{
+			size = sz;
+			return;
+		}
+
+		storage.reset(new uint8_t[sz + io_alignment]);
+		auto addr = reinterpret_cast<uintptr_t>(storage.get());
+		ptr = reinterpret_cast<uint8_t *>((addr + io_alignment-1) & ~(uintptr_t)(io_alignment-1));
+		size = capacity = sz;
+	}
+
+	uint8_t *data() const {return ptr;}
+
+	size_t size = 0;
+
+private:
+	std::unique_ptr<uint8_t[]> storage;
+	uint8_t *ptr = nullptr;
+	size_t capacity = 0;
+};
+
+// background thread executing I/O jobs in FIFO order
+struct io_thread
+{
+	io_thread()
+	{
+		thread = std::thread([this]{work();});
+	}
+
+	~io_thread()
+	{
+		wait();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+
+		cv_job.notify_all();
+		thread.join();
+	}
+
+	// queue job; blocks while more than max_queued jobs are pending
+	void post(std::function<void()> job, size_t max_queued = 8)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv_done.wait(lock, [&]{return pending <= max_queued;});
+		jobs.push_back(std::move(job));
+		++pending;
+		lock.unlock();
+		cv_job.notify_one();
+	}
+
+	// wait until at most max_pending jobs are left (queued or running)
+	void wait(size_t max_pending = 0)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv_done.wait(lock, [&]{return pending <= max_pending;});
+	}
+
+	// set by jobs on I/O error
+	std::atomic<bool> failed{false};
+
+private:
+	std::mutex mutex;
+	std::condition_variable cv_job;
+	std::condition_variable cv_done;
+	std::deque<std::function<void()>> jobs;
+	size_t pending = 0;
+	bool quit = false;
+	std::thread thread;
+
+	void work()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv_job.wait(lock, [this]{return quit || !jobs.empty();});
+
+				if (jobs.empty())
+					break;
+
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			job();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				--pending;
+			}
+
+			cv_done.notify_all();
+		}
+	}
+};
+
+std::string bucket_filename(size_t index)
+{
+	return tmp_prefix + ".bucket" + std::to_string(index);
+}
+
+// removes bucket files on scope exit unless dismissed
+// (pass 2 removes each bucket file once loaded, so only failures leave any behind)
+struct bucket_cleanup
+{
+	size_t count = 0;
+	bool active = true;
+
+	~bucket_cleanup()
+	{
+		if (!active)
+			return;
+
+		for (size_t i=0; i<count; i++)
+			std::remove(bucket_filename(i).c_str());
+	}
+};
+
+// two-pass external shuffle:
+// pass 1 scatters entries into random bucket files, pass 2 shuffles each bucket in memory
+// reads and writes run on separate threads so that I/O overlaps with scatter/shuffle
+int bucket_shuffle_main()
+{
+	std::ifstream f;
+	uint64_t total_entries = container.size();
+
+	if (!container.is_container())
+	{
+		f.open(in_filename.c_str(), std::ios_base::binary | std::ios_base::in);
+
+		if (f.fail())
+		{
+			std::cerr << "cannot open " << in_filename << std::endl;
+			return 4;
+		}
+
+		f.seekg(0, std::ios_base::end);
+		uint64_t in_size = f.tellg();
+		f.seekg(0, std::ios_base::beg);
+
+		total_entries = in_size / entry_size;
+	}
+
+	size_t buckets = num_buckets;
+
+	if (!buckets)
+		buckets = (size_t)std::max<uint64_t>(1, (total_entries + min_entries-1) / min_entries);
+
+	std::cout << "scattering " << total_entries << " entries into " << buckets << " buckets" << std::endl;
+
+	// note: declared before the bucket streams and I/O threads so that files are closed and jobs done before removal
+	bucket_cleanup cleanup;
+	cleanup.count = buckets;
+
+	std::mt19937_64 rnd_engine;
+	rnd_engine.seed(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+	std::vector<std::ofstream> bucket_files(buckets);
+	std::vector<uint64_t> bucket_sizes(buckets, 0);
+
+	std::ofstream fo;
+
+	const size_t block_entries = std::max<size_t>(1, io_block_size / entry_size);
+	const size_t staging_entries = std::max<size_t>(1, staging_size / entry_size);
+
+	aligned_buffer blocks[2];
+	std::vector<std::vector<uint8_t>> staging(buckets);
+	aligned_buffer bucket_bufs[3];
+
+	// note: declared after everything the jobs reference so that pending jobs finish first on early exit
+	io_thread reader;
+	io_thread writer;
+
+	for (size_t i=0; i<buckets; i++)
+	{
+		bucket_files[i].open(bucket_filename(i).c_str(), std::ios_base::binary | std::ios_base::trunc | std::ios_base::out);
+
+		if (bucket_files[i].fail())
+		{
+			std::cerr << "cannot create " << bucket_filename(i) << std::endl;
+			return 5;
+		}
+	}
+
+	// pass 1: scatter
+
+	auto flush_bucket = [&](size_t b)
+	{
+		auto buf = std::make_shared<std::vector<uint8_t>>(std::move(staging[b]));
+		staging[b] = std::vector<uint8_t>();
+		bucket_sizes[b] += buf->size();
+
+		writer.post([&, b, buf]
+		{
+			bucket_files[b].write((const char *)buf->data(), buf->size());
+
+			if (bucket_files[b].fail())
+				writer.failed = true;
+		});
+	};
+
+	// next entry to read (containers are read by entry index)
+	uint64_t read_pos = 0;
+
+	auto read_block = [&](aligned_buffer &blk, uint64_t entries)
+	{
+		blk.resize(entries * entry_size);
+
+		reader.post([&, entries, first = read_pos]
+		{
+			if (container.is_container())
+			{
+				if (!container.read(first, entries, blk.data()))
+					reader.failed = true;
+
+				return;
+			}
+
+			f.read((char *)blk.data(), entries * entry_size);
+
+			if (f.fail())
+				reader.failed = true;
+		});
+
+		read_pos += entries;
+	};
+
+	uint64_t remaining = total_entries;
+	uint64_t next_read = std::min<uint64_t>(block_entries, remaining);
+	read_block(blocks[0], next_read);
+
+	int step = 0;
+	size_t next_report = 0;
+	uint64_t done_entries = 0;
+
+	while (remaining > 0)
+	{
+		reader.wait();
+
+		if (reader.failed)
+		{
+			std::cerr << "cannot read " << in_filename << std::endl;
+			return 6;
+		}
+
+		auto &blk = blocks[step & 1];
+		const uint64_t count = next_read;
+		remaining -= count;
+
+		// prefetch next block while we scatter this one
+		next_read = std::min<uint64_t>(block_entries, remaining);
+
+		if (next_read)
+			read_block(blocks[(step+1) & 1], next_read);
+
+		const uint8_t *src = blk.data();
+
+		for (uint64_t i=0; i<count; i++, src += entry_size)
+		{
+			auto b = (size_t)(rnd_engine() % buckets);
+			auto &sb = staging[b];
+
+			if (sb.empty())
+				sb.reserve(staging_entries * entry_size);
+
+			sb.insert(sb.end(), src, src + entry_size);
+
+			if (sb.size() >= staging_entries * entry_size)
+				flush_bucket(b);
+		}
+
+		if (writer.failed)
+		{
+			std::cerr << "cannot write bucket file" << std::endl;
+			return 7;
+		}
+
+		done_entries += count;
+		++step;
+
+		auto percent = (size_t)(done_entries * 100 / std::max<uint64_t>(1, total_entries));
+
+		if (percent >= next_report)
+		{
+			std::cout << "scatter " << percent << " %" << std::endl;
+			next_report = percent + 1;
+		}
+	}
+
+	for (size_t b=0; b<buckets; b++)
+		if (!staging[b].empty())
+			flush_bucket(b);
+
+	writer.wait();
+
+	if (writer.failed)
+	{
+		std::cerr << "cannot write bucket file" << std::endl;
+		return 7;
+	}
+
+	bucket_files.clear();
+	f.close();
+
+	// pass 2: shuffle buckets
+
+	fo.open(out_filename.c_str(), std::ios_base::binary | std::ios_base::trunc | std::ios_base::out);
+
+	if (fo.fail())
+	{
+		std::cerr << "cannot create " << out_filename << std::endl;
+		return 5;
+	}
+
+	// load bucket b+1 while shuffling bucket b and writing bucket b-1
+
+	auto load_bucket = [&](size_t b)
+	{
+		auto &buf = bucket_bufs[b % 3];
+		buf.resize(bucket_sizes[b]);
+
+		reader.post([&, b]
+		{
+			auto fn = bucket_filename(b);
+			std::ifstream bf;
+			bf.open(fn.c_str(), std::ios_base::binary | std::ios_base::in);
+			bf.read((char *)bucket_bufs[b % 3].data(), bucket_sizes[b]);
+
+			if (bf.fail())
+				reader.failed = true;
+
+			bf.close();
+			std::remove(fn.c_str());
+		});
+	};
+
+	load_bucket(0);
+
+	for (size_t b=0; b<buckets; b++)
+	{
+		reader.wait();
+
+		if (reader.failed)
+		{
+			std::cerr << "cannot read bucket file" << std::endl;
+			return 6;
+		}
+
+		if (b+1 < buckets)
+		{
+			// buffer for b+1 last held b-2; make sure it's been written
+			writer.wait(1);
+			load_bucket(b+1);
+		}
+
+		auto &buf = bucket_bufs[b % 3];
+		const size_t count = buf.size / entry_size;
+
+		shuffle_buffer(rnd_engine, buf.data(), count);
+
+		writer.post([&, count, b]
+		{
+			fo.write((const char *)bucket_bufs[b % 3].data(), count * entry_size);
+
+			if (fo.fail())
+				writer.failed = true;
+		});
+
+		if (writer.failed)
+		{
+			std::cerr << "cannot write " << out_filename << std::endl;
+			return 7;
+		}
+
+		std::cout << "bucket " << b+1 << " / " << buckets << std::endl;
+	}
+
+	writer.wait();
+
+	if (writer.failed)
+	{
+		std::cerr << "cannot write " << out_filename << std::endl;
+		return 7;
+	}
+
+	cleanup.active = false;
+
+	std::cout << "all done" << std::endl;
+
+	return 0;
+}
+
+// gather output range [begin, end) of permutation perm from mapped input
+template<typename I>
+bool gather_range(const uint8_t *src, const I *perm, uint64_t begin, uint64_t end)
+{
+	// prefetch distance in entries
+	constexpr uint64_t prefetch_ahead = 16;
+	const size_t block_entries = std::max<size_t>(1, io_block_size / 4 / entry_size);
+
+	std::fstream fo;
+	fo.open(out_filename.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+
+	if (fo.fail())
+		return false;
+
+	fo.seekp(begin * entry_size, std::ios_base::beg);
+
+	aligned_buffer buf;
+	buf.resize(block_entries * entry_size);
+
+	for (uint64_t i=begin; i<end; )
+	{
+		auto count = (size_t)std::min<uint64_t>(block_entries, end - i);
+		uint8_t *dst = buf.data();
+
+		for (size_t j=0; j<count; j++, dst += entry_size)
+		{
+			if (i+j+prefetch_ahead < end)
+				prefetch_entry(src + (uint64_t)perm[i+j+prefetch_ahead] * entry_size);
+
+			memcpy(dst, src + (uint64_t)perm[i+j] * entry_size, entry_size);
+		}
+
+		fo.write((const char *)buf.data(), count * entry_size);
+
+		if (fo.fail())
+			return false;
+
+		i += count;
+	}
+
+	return true;
+}
+
+template<typename I>
+int mapped_shuffle(const uint8_t *src, uint64_t total_entries)
+{
+	std::mt19937_64 rnd_engine;
+	rnd_engine.seed(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+	// shuffle indices, not entries
+	std::vector<I> perm((size_t)total_entries);
+
+	for (uint64_t i=0; i<total_entries; i++)
+		perm[(size_t)i] = (I)i;
+
+	for (uint64_t i=total_entries; i>1; i--)
+		std::swap(perm[(size_t)(i-1)], perm[(size_t)(rnd_engine() % i)]);
+
+	// create output file so that gather threads can write their disjoint ranges
+	{
+		std::ofstream fo;
+		fo.open(out_filename.c_str(), std::ios_base::binary | std::ios_base::trunc | std::ios_base::out);
+
+		if (fo.fail())
+		{
+			std::cerr << "cannot create " << out_filename << std::endl;
+			return 5;
+		}
+	}
+
+	size_t threads = num_threads ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+	threads = (size_t)std::max<uint64_t>(1, std::min<uint64_t>(threads, total_entries));
+
+	std::cout << "gathering " << total_entries << " entries using " << threads << " threads" << std::endl;
+
+	std::vector<std::thread> workers;
+	std::atomic<bool> failed{false};
+
+	for (size_t t=0; t<threads; t++)
+	{
+		uint64_t begin = total_entries * t / threads;
+		uint64_t end = total_entries * (t+1) / threads;
+
+		workers.emplace_back([&, begin, end]
+		{
+			if (!gather_range(src, perm.data(), begin, end))
+				failed = true;
+		});
+	}
+
+	for (auto &it : workers)
+		it.join();
+
+	if (failed)
+	{
+		std::cerr << "cannot write " << out_filename << std::endl;
+		return 7;
+	}
+
+	std::cout << "all done" << std::endl;
+
+	return 0;
+}
+
+// zero-copy shuffle: mmap input, shuffle index permutation, gather sequential output
+int mapped_shuffle_main()
+{
+	if (container.is_container())
+	{
+		// no mapping possible: decode everything into memory
+		const uint64_t total_entries = container.size();
+		std::vector<uint8_t> entries;
+
+		entries.resize(total_entries * entry_size);
+
+		if (!container.read(0, total_entries, entries.data()))
+		{
+			std::cerr << "cannot read " << in_filename << std::endl;
+			return 6;
+		}
+
+		if (total_entries <= UINT32_MAX)
+			return mapped_shuffle<uint32_t>(entries.data(), total_entries);
+
+		return mapped_shuffle<uint64_t>(entries.data(), total_entries);
+	}
+
+	memory_mapped_file mf;
+
+	if (!mf.map(in_filename.c_str()))
+	{
+		std::cerr << "cannot map " << in_filename << std::endl;
+		return 4;
+	}
+
+	const uint64_t total_entries = (uint64_t)mf.size() / entry_size;
+
+	// 32-bit indices halve permutation memory whenever possible
+	if (total_entries <= UINT32_MAX)
+		return mapped_shuffle<uint32_t>(mf.data(), total_entries);
+
+	return mapped_shuffle<uint64_t>(mf.data(), total_entries);
+}
+
 int main(int argc, const char **argv)
 {
 	if (int res = parse_args(argc, argv))
 		return res;
 
-	return shuffle_main();
+	if (is_train_container(in_filename.c_str()))
+	{
+		if (!container.open(in_filename.c_str()))
+		{
+			std::cerr << "cannot open " << in_filename << std::endl;
+			return 4;
+		}
+
+		entry_size = container.entry_size();
+		container.set_decode_threads((unsigned)num_threads);
+
+		std::cout << in_filename << ": " << container.size() << " entries of " << entry_size << " bytes" << std::endl;
+	}
+
+	if (chunked)
+		return chunked_shuffle_main();
+
+	if (mapped)
+		return mapped_shuffle_main();
+
+	return bucket_shuffle_main();
 }
@@ -25,6 +25,11 @@ or as public domain (where applicable)
 
 #ifdef _WIN32
 #	include <Windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
 #endif
 
 const uint8_t *memory_mapped_file::map(const char *fn)
@@ -55,6 +60,28 @@ const uint8_t *memory_mapped_file::map(const char *fn)
 		}
 	}
 
+	mapped = res;
+#else
+	int fd = open(fn, O_RDONLY);
+
+	if (fd >= 0)
+	{
+		struct stat st;
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			res = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (res == MAP_FAILED)
+				res = nullptr;
+			else
+				mapped_size = (int64_t)st.st_size;
+		}
+
+		// mapping stays valid after close
+		close(fd);
+	}
+
 	mapped = res;
 #endif
 
@@ -77,5 +104,12 @@ void memory_mapped_file::unmap()
 		CloseHandle(handles[0]);
 
 	handles[0] = handles[1] = nullptr;
+#else
+	if (mapped)
+	{
+		munmap(const_cast<void *>(mapped), (size_t)mapped_size);
+		mapped = nullptr;
+		mapped_size = 0;
+	}
 #endif
 }
@@ -5,6 +5,7 @@
 
 #include "../cheng4/chtypes.h"
 #include "../cheng4/tables.h"
+#include "../cheng4/net.h"
 
 // FIXME: trainer version, copied from Board... should clean this up, really
 
@@ -119,3 +120,37 @@ int netIndices(bool btm, uint64_t occ, const uint8_t buf[16], int16_t *inds)
 {
 	return netIndicesStm(cheng4::Color(btm ? cheng4::ctBlack : cheng4::ctWhite), occ, buf, inds);
 }
+
+// apply king bucket transform to indices from a single point of view, see cheng4::NetArch::kingXor/kingBase
+// own king is the only index below 64
+void netKingTransform(const cheng4::NetArch &arch, int16_t *inds, int count)
+{
+	if (arch.kingBuckets() <= 1)
+		return;
+
+	int ksq = 0;
+
+	for (int i=0; i<count; i++)
+		if (inds[i] < 64)
+			ksq = inds[i];
+
+	const int kxor = arch.kingXor(ksq);
+	const int kbase = arch.kingBase(ksq);
+
+	for (int i=0; i<count; i++)
+		inds[i] = (int16_t)((inds[i] ^ kxor) + kbase);
+}
+
+// indices from stm's and opponent's point of view, including king buckets
+int netIndicesArch(const cheng4::NetArch &arch, bool btm, uint64_t occ, const uint8_t buf[16], int16_t *inds, int16_t *inds_opp)
+{
+	int res = netIndices(btm, occ, buf, inds);
+
+	for (int i=0; i<res; i++)
+		inds_opp[i] = (int16_t)flipNetIndex(inds[i]);
+
+	netKingTransform(arch, inds, res);
+	netKingTransform(arch, inds_opp, res);
+
+	return res;
+}
@@ -30,8 +30,14 @@ or as public domain (where applicable)
 #include <cmath>
 #include <vector>
 #include <random>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include "memmap.h"
+#include "train_data.h"
 
 #include "../cheng4/net.h"
 #include "net_indices.h"
@@ -39,6 +45,7 @@ or as public domain (where applicable)
 #include "../cheng4/shuffle.h"
 #include "rnd_shuf.h"
 
+// raw training file entry size (containers store it in their header, entries may be larger)
 constexpr int PACKED_TRAIN_ENTRY_SIZE = 28;
 
 // set to true to random-shuffle batches before each epoch
@@ -46,7 +53,11 @@ constexpr bool SHUFFLE_BATCHES = true;
 
 // as big as we can fit into memory
 constexpr int BATCH_SIZE = 1024*1024/2;
-constexpr int INPUT_SIZE = cheng4::topo0;
+// max active features per position (=max pieces on board)
+constexpr int MAX_ACTIVE_FEATURES = 32;
+
+// feed layer0 with sparse feature indices (embedding bag) instead of dense one-hot batches
+constexpr bool SPARSE_INPUT = true;
 
 // 1% per epoch
 constexpr double EPOCH_LR_DECAY_RATE = 0.99;
@@ -58,8 +69,8 @@ constexpr char NET_FP_FILENAME_EPOCH[] = "test_epoch%d.fpnet";
 // last cheng HCE K for texel tuning
 constexpr double HCE_K = 1.25098;
 
-// profile batch time?
-constexpr bool profile = false;
+// default number of batches prepared ahead by the loader thread (2 = double buffering)
+constexpr int DEFAULT_LOADER_QUEUE_DEPTH = 2;
 
 std::string epoch_filename(int epoch)
 {
@@ -116,31 +127,30 @@ float label_position(const labeled_position &p)
 	return res;
 }
 
-void unpack_position_fast(void *dstp, void *dstp_opp, const labeled_position &pos)
+// sparse version: returns number of active features (=pieces)
+int unpack_position_indices(const cheng4::NetArch &arch, int16_t *inds, int16_t *inds_opp, const labeled_position &pos)
+{
+	bool blackToMove = (pos.flags & 1) != 0;
+	return netIndicesArch(arch, blackToMove, pos.occupancy, pos.pieces, inds, inds_opp);
+}
+
+// dst, dst_opp: arch.inputs each, zeroed; returns number of active features
+int unpack_position_fast(const cheng4::NetArch &arch, void *dstp, void *dstp_opp, const labeled_position &pos)
 {
 	auto *dst = static_cast<float *>(dstp);
 	auto *dst_opp = static_cast<float *>(dstp_opp);
 
 	int16_t ninds[64];
-	bool blackToMove = (pos.flags & 1) != 0;
-	auto count = (int16_t)netIndices(blackToMove, pos.occupancy, pos.pieces, ninds);
+	int16_t ninds_opp[64];
+	int count = unpack_position_indices(arch, ninds, ninds_opp, pos);
 
 	for (int i=0; i<count; i++)
 	{
 		dst[ninds[i]] = 1.0f;
-		dst_opp[flipNetIndex(ninds[i])] = 1.0f;
+		dst_opp[ninds_opp[i]] = 1.0f;
 	}
-}
-
-void unpack_position(void *dstp, void *dstp_opp, const labeled_position &pos)
-{
-	auto *dst = static_cast<float *>(dstp);
-	auto *dst_opp = static_cast<float *>(dstp_opp);
-
-	for (int i=0; i<INPUT_SIZE; i++)
-		dst[i] = dst_opp[i] = 0.0f;
 
-	unpack_position_fast(dst, dst_opp, pos);
+	return count;
 }
 
 static size_t tensor_size(torch::Tensor t)
@@ -221,14 +231,14 @@ labeled_position mem_load_position(const uint8_t *&ptr, const uint8_t *end)
 	return p;
 }
 
-memory_mapped_file load_trainfile(const char *fn)
+bool load_trainfile(train_data &data, const char *fn)
 {
-	// memory mapping would be best
-	memory_mapped_file mf;
-	auto *buf = mf.map(fn);
-
-	if (!buf)
-		return mf;
+	// raw files are memory mapped, cheng4 training data containers are decoded per batch (chunks in parallel)
+	if (!data.open(fn, PACKED_TRAIN_ENTRY_SIZE))
+	{
+		printf("cannot open %s\n", fn);
+		return false;
+	}
 
 	// i16 label (centipawns)
 	// i8 outcome
@@ -237,11 +247,17 @@ memory_mapped_file load_trainfile(const char *fn)
 	// u8 x 16 nibble-packed board
 	// => 28 bytes per packed position
 
-	size_t num_positions = mf.size() / PACKED_TRAIN_ENTRY_SIZE;
+	if (data.entry_size() < PACKED_TRAIN_ENTRY_SIZE)
+	{
+		printf("%s: unsupported entry size %d\n", fn, (int)data.entry_size());
+		return false;
+	}
+
+	size_t num_positions = data.size();
 
-	printf("%I64u positions\n", num_positions);
+	printf("%I64u positions%s\n", num_positions, data.is_container() ? " (container)" : "");
 
-	return mf;
+	return true;
 #undef mem_read_int
 #undef mem_read_buf
 }
@@ -252,11 +268,34 @@ struct packed_network
 	std::vector<float> biases;
 };
 
+// sparse input batch in embedding bag layout
+struct sparse_batch
+{
+	// flattened feature indices (int64), stm and opponent's point of view
+	torch::Tensor indices;
+	torch::Tensor indices_opp;
+	// start of each position in indices (int64), shared by both views
+	torch::Tensor offsets;
+
+	sparse_batch to(torch::Device device) const;
+};
+
+sparse_batch sparse_batch::to(torch::Device device) const
+{
+	sparse_batch res;
+	res.indices = indices.to(device);
+	res.indices_opp = indices_opp.to(device);
+	res.offsets = offsets.to(device);
+	return res;
+}
+
 struct network : torch::nn::Module
 {
-	torch::Tensor forward(torch::Tensor input, torch::Tensor input_opp);
+	// buckets: output bucket per position (int64, [batch, 1]), ignored for single output
+	torch::Tensor forward(torch::Tensor input, torch::Tensor input_opp, torch::Tensor buckets);
+	torch::Tensor forward(const sparse_batch &batch, torch::Tensor buckets);
 
-	network();
+	explicit network(const cheng4::NetArch &narch = cheng4::NetArch::defaults());
 
 	// pack: weights then biases
 	packed_network pack() const;
@@ -265,8 +304,11 @@ struct network : torch::nn::Module
 
 	void load_file(const char *fn);
 	void save_file(const char *fn);
+	// writes architecture header, see cheng4::NetArch
 	void save_fixedpt_file(const char *fn);
 
+	cheng4::NetArch arch;
+
 	torch::nn::Linear layer0;
 	torch::nn::Linear layer1;
 	torch::nn::Linear layer2;
@@ -276,23 +318,30 @@ struct network : torch::nn::Module
 	void clamp_weights();
 
 	static torch::Tensor activate(torch::Tensor t);
+
+private:
+	// layer0 on sparse input = sum of weight columns of active features
+	torch::Tensor layer0_sparse(torch::Tensor indices, torch::Tensor offsets);
+	// layers past layer0
+	torch::Tensor forward_hidden(torch::Tensor tmp_std, torch::Tensor tmp_opp, torch::Tensor buckets);
 };
 
-network::network()
-	: layer0{INPUT_SIZE, cheng4::topo1}
-	, layer1{cheng4::topo1in, cheng4::topoLayers >= 3 ? cheng4::topo2 : 1}
-	, layer2{cheng4::topo2, 1}
+network::network(const cheng4::NetArch &narch)
+	: arch(narch)
+	, layer0{(int64_t)narch.inputs, (int64_t)narch.hidden1}
+	, layer1{2*(int64_t)narch.hidden1, (int64_t)(narch.hidden2 ? narch.hidden2 : narch.outputs)}
+	, layer2{(int64_t)std::max(narch.hidden2, 1u), (int64_t)narch.outputs}
 {
 	layers.push_back(&layer0);
 	layers.push_back(&layer1);
 
-	if (cheng4::topoLayers >= 3)
+	if (arch.hidden2)
 		layers.push_back(&layer2);
 
 	register_module("layer0", layer0);
 	register_module("layer1", layer1);
 
-	if (cheng4::topoLayers >= 3)
+	if (arch.hidden2)
 		register_module("layer2", layer2);
 }
 
@@ -315,11 +364,17 @@ void network::save_fixedpt_file(const char *fn)
 	input.insert(input.end(), pn.biases.begin(), pn.biases.end());
 	output.resize(input.size());
 
-	// convert to 7:9 fixedpoint
+	// convert to fixedpoint (7:9 by default)
+	const float scale = (float)(1 << arch.shift);
+
 	for (size_t i=0; i<output.size(); i++)
-		output[i] = (int16_t)floor(input[i]*512.0f + 0.5f);
+		output[i] = (int16_t)floor(input[i]*scale + 0.5f);
+
+	uint8_t header[cheng4::NetArch::headerSize];
+	arch.writeHeader(header);
 
 	FILE *f = fopen(fn, "wb");
+	fwrite(header, 1, sizeof(header), f);
 	fwrite(output.data(), sizeof(int16_t), output.size(), f);
 	fclose(f);
 }
@@ -331,6 +386,18 @@ void network::load_file(const char *fn)
 	if (!f)
 		return;
 
+	// float checkpoint has no header => reject if topology doesn't match
+	fseek(f, 0, SEEK_END);
+	auto fsize = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if (fsize != sizeof(float)*(pn.weights.size() + pn.biases.size()))
+	{
+		printf("ignoring %s: topology mismatch\n", fn);
+		fclose(f);
+		return;
+	}
+
 	fread(pn.weights.data(), sizeof(float), pn.weights.size(), f);
 	fread(pn.biases.data(), sizeof(float), pn.biases.size(), f);
 	fclose(f);
@@ -411,14 +478,41 @@ torch::Tensor network::activate(torch::Tensor t)
 	return torch::clamp_(t, 0.0f, 1.0f);
 }
 
-torch::Tensor network::forward(torch::Tensor input, torch::Tensor input_opp)
+torch::Tensor network::layer0_sparse(torch::Tensor indices, torch::Tensor offsets)
+{
+	namespace F = torch::nn::functional;
+
+	// embedding bag wants [inputs, outputs] while Linear keeps [outputs, inputs]
+	// the transposed copy is tiny compared to a dense batch and keeps the packed format intact
+	auto weight = layer0->weight.t().contiguous();
+
+	auto res = F::embedding_bag(indices, weight,
+		F::EmbeddingBagFuncOptions().offsets(offsets).mode(torch::kSum));
+
+	return res + layer0->bias;
+}
+
+torch::Tensor network::forward(const sparse_batch &batch, torch::Tensor buckets)
+{
+	torch::Tensor tmp_std = activate(layer0_sparse(batch.indices, batch.offsets));
+	torch::Tensor tmp_opp = activate(layer0_sparse(batch.indices_opp, batch.offsets));
+
+	return forward_hidden(tmp_std, tmp_opp, buckets);
+}
+
+torch::Tensor network::forward(torch::Tensor input, torch::Tensor input_opp, torch::Tensor buckets)
 {
 	torch::Tensor tmp_std = activate(layer0->forward(input));
 	torch::Tensor tmp_opp = activate(layer0->forward(input_opp));
 
+	return forward_hidden(tmp_std, tmp_opp, buckets);
+}
+
+torch::Tensor network::forward_hidden(torch::Tensor tmp_std, torch::Tensor tmp_opp, torch::Tensor buckets)
+{
 	torch::Tensor tmp = torch::hstack({tmp_std, tmp_opp});
 
-	if (cheng4::topoLayers >= 3)
+	if (arch.hidden2)
 	{
 		tmp = activate(layer1->forward(tmp));
 		tmp = layer2->forward(tmp);
@@ -428,20 +522,320 @@ torch::Tensor network::forward(torch::Tensor input, torch::Tensor input_opp)
 		tmp = layer1->forward(tmp);
 	}
 
+	// output buckets: only the selected output is trained
+	if (arch.outputs > 1)
+		tmp = tmp.gather(1, buckets);
+
 	return tmp;
 }
 
+// batch loader: decodes batches on a background thread while the previous batch trains
+
+using stage_clock = std::chrono::steady_clock;
+
+static double elapsed_sec(stage_clock::time_point from)
+{
+	return std::chrono::duration<double>(stage_clock::now() - from).count();
+}
+
+struct loaded_batch
+{
+	size_t start = 0;
+	size_t count = 0;
+
+	// sparse input (SPARSE_INPUT)
+	sparse_batch sparse;
+	// dense input (!SPARSE_INPUT)
+	torch::Tensor dense;
+	torch::Tensor dense_opp;
+
+	torch::Tensor target;
+	// output bucket per position (int64)
+	torch::Tensor buckets;
+
+	// time spent decoding this batch
+	double load_time = 0.0;
+};
+
+struct batch_loader
+{
+	batch_loader(const train_data &data_, const cheng4::NetArch &arch_, int queue_depth_ = DEFAULT_LOADER_QUEUE_DEPTH)
+		: data(data_)
+		, arch(arch_)
+		, queue_depth(std::max(queue_depth_, 1))
+	{
+	}
+
+	~batch_loader()
+	{
+		stop();
+	}
+
+	// start loading batches (given as starting position indices) in order
+	void start(std::vector<size_t> batch_starts, size_t num_positions);
+	// wait for loader thread to finish
+	void stop();
+
+	// get next batch; returns false when done
+	bool next(loaded_batch &batch);
+
+private:
+	const train_data &data;
+	cheng4::NetArch arch;
+	int queue_depth;
+
+	std::vector<size_t> starts;
+	size_t total_positions = 0;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv_ready;
+	std::condition_variable cv_space;
+	std::deque<loaded_batch> queue;
+	bool done = false;
+	bool quit = false;
+
+	// decoded entries of current batch (containers only, loader thread only)
+	std::vector<uint8_t> entries;
+
+	// per-position feature scratch for sparse batches (loader thread only)
+	std::vector<int16_t> row_indices;
+	std::vector<int16_t> row_indices_opp;
+	std::vector<int64_t> row_offsets;
+
+	void work();
+
+	// src: packed entries of the batch
+	void make_dense_batch(loaded_batch &batch, const uint8_t *src);
+	void make_sparse_batch(loaded_batch &batch, const uint8_t *src);
+};
+
+void batch_loader::start(std::vector<size_t> batch_starts, size_t num_positions)
+{
+	stop();
+
+	starts = std::move(batch_starts);
+	total_positions = num_positions;
+	queue.clear();
+	done = false;
+	quit = false;
+
+	thread = std::thread([this]{work();});
+}
+
+void batch_loader::stop()
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+
+	cv_space.notify_all();
+	thread.join();
+	queue.clear();
+}
+
+bool batch_loader::next(loaded_batch &batch)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	cv_ready.wait(lock, [this]{return !queue.empty() || done;});
+
+	if (queue.empty())
+		return false;
+
+	batch = std::move(queue.front());
+	queue.pop_front();
+
+	lock.unlock();
+	cv_space.notify_one();
+
+	return true;
+}
+
+void batch_loader::work()
+{
+	for (auto start : starts)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv_space.wait(lock, [this]{return quit || (int)queue.size() < queue_depth;});
+
+			if (quit)
+				break;
+		}
+
+		auto t0 = stage_clock::now();
+
+		loaded_batch batch;
+		batch.start = start;
+		batch.count = std::min<size_t>(BATCH_SIZE, total_positions - start);
+
+		auto *src = data.get(start, batch.count, entries);
+
+		if (!src)
+		{
+			printf("cannot read batch at position %I64u\n", (uint64_t)start);
+			break;
+		}
+
+		if constexpr (SPARSE_INPUT)
+			make_sparse_batch(batch, src);
+		else
+			make_dense_batch(batch, src);
+
+		batch.load_time = elapsed_sec(t0);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(std::move(batch));
+		}
+
+		cv_ready.notify_one();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+	}
+
+	cv_ready.notify_all();
+}
+
+void batch_loader::make_dense_batch(loaded_batch &batch, const uint8_t *src)
+{
+	const size_t count = batch.count;
+	const size_t entry_size = data.entry_size();
+
+	const int inputs = (int)arch.inputs;
+
+	batch.dense = torch::zeros({(int)count, inputs});
+	batch.dense_opp = torch::zeros({(int)count, inputs});
+	batch.target = torch::zeros({(int)count, 1});
+	batch.buckets = torch::zeros({(int)count, 1}, torch::kInt64);
+
+	float *itensor = static_cast<float *>(batch.dense.mutable_data_ptr());
+	float *itensor_opp = static_cast<float *>(batch.dense_opp.mutable_data_ptr());
+	float *ttensor = static_cast<float *>(batch.target.mutable_data_ptr());
+	auto *btensor = static_cast<int64_t *>(batch.buckets.mutable_data_ptr());
+
+	#pragma omp parallel for
+	for (int j=0; j<(int)count; j++)
+	{
+		auto *beg = src + (size_t)j*entry_size;
+		auto *end = beg + entry_size;
+		auto lp = mem_load_position(beg, end);
+		int nc = unpack_position_fast(arch, &itensor[(size_t)j*inputs], &itensor_opp[(size_t)j*inputs], lp);
+		ttensor[j] = label_position(lp);
+		btensor[j] = arch.outputBucket(nc);
+	}
+}
+
+void batch_loader::make_sparse_batch(loaded_batch &batch, const uint8_t *src)
+{
+	const size_t count = batch.count;
+	const size_t entry_size = data.entry_size();
+
+	row_indices.resize(count * MAX_ACTIVE_FEATURES);
+	row_indices_opp.resize(count * MAX_ACTIVE_FEATURES);
+	row_offsets.resize(count + 1);
+
+	batch.target = torch::empty({(int)count, 1});
+	batch.buckets = torch::empty({(int)count, 1}, torch::kInt64);
+	float *ttensor = static_cast<float *>(batch.target.mutable_data_ptr());
+	auto *btensor = static_cast<int64_t *>(batch.buckets.mutable_data_ptr());
+
+	// pass 1: extract features per position
+	#pragma omp parallel for
+	for (int j=0; j<(int)count; j++)
+	{
+		auto *beg = src + (size_t)j*entry_size;
+		auto *end = beg + entry_size;
+		auto lp = mem_load_position(beg, end);
+		int16_t ninds[64];
+		int16_t ninds_opp[64];
+		int nc = unpack_position_indices(arch, ninds, ninds_opp, lp);
+		assert(nc <= MAX_ACTIVE_FEATURES);
+		nc = std::min(nc, MAX_ACTIVE_FEATURES);
+		memcpy(&row_indices[j*MAX_ACTIVE_FEATURES], ninds, nc*sizeof(int16_t));
+		memcpy(&row_indices_opp[j*MAX_ACTIVE_FEATURES], ninds_opp, nc*sizeof(int16_t));
+		row_offsets[j+1] = nc;
+		ttensor[j] = label_position(lp);
+		btensor[j] = arch.outputBucket(nc);
+	}
+
+	// exclusive prefix sum => offsets
+	row_offsets[0] = 0;
+
+	for (size_t j=0; j<count; j++)
+		row_offsets[j+1] += row_offsets[j];
+
+	const int64_t total = row_offsets[count];
+
+	sparse_batch &res = batch.sparse;
+	res.indices = torch::empty({total}, torch::kInt64);
+	res.indices_opp = torch::empty({total}, torch::kInt64);
+	res.offsets = torch::from_blob(row_offsets.data(), {(int64_t)count}, torch::kInt64).clone();
+
+	auto *idst = static_cast<int64_t *>(res.indices.mutable_data_ptr());
+	auto *idst_opp = static_cast<int64_t *>(res.indices_opp.mutable_data_ptr());
+
+	// pass 2: scatter into flat index tensors
+	#pragma omp parallel for
+	for (int j=0; j<(int)count; j++)
+	{
+		const int16_t *src = &row_indices[j*MAX_ACTIVE_FEATURES];
+		const int16_t *src_opp = &row_indices_opp[j*MAX_ACTIVE_FEATURES];
+		auto ofs = row_offsets[j];
+		auto nc = row_offsets[j+1] - ofs;
+
+		for (int64_t k=0; k<nc; k++)
+		{
+			idst[ofs+k] = src[k];
+			idst_opp[ofs+k] = src_opp[k];
+		}
+	}
+}
+
+// per-stage timing (seconds)
+struct stage_times
+{
+	double load = 0.0;			// decoding (loader thread)
+	double wait = 0.0;			// trainer stalled waiting for loader
+	double upload = 0.0;		// host to device copy
+	double train = 0.0;			// forward + backward + optimizer step
+	size_t batches = 0;
+
+	void print() const
+	{
+		if (!batches)
+			return;
+
+		double inv = 1000.0 / batches;
+
+		printf("per batch: load %0.1lf ms | wait %0.1lf ms | upload %0.1lf ms | train %0.1lf ms\n",
+			load*inv, wait*inv, upload*inv, train*inv);
+	}
+};
+
 // network trainer
 
 struct net_trainer
 {
-	void train(memory_mapped_file &mf, size_t num_positions, network &net, int epochs = 50);
+	void train(const train_data &data, size_t num_positions, network &net, int epochs = 50);
+
+	// batches prepared ahead of training
+	int loader_queue_depth = DEFAULT_LOADER_QUEUE_DEPTH;
+	// print per-stage timing
+	bool profile = false;
 
 private:
 	network *netref = nullptr;
 };
 
-void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network &net, int epochs)
+void net_trainer::train(const train_data &data, uint64_t num_positions, network &net, int epochs)
 {
 	netref = &net;
 
@@ -466,75 +860,77 @@ void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network
 	const size_t num_batches = (size_t)(num_positions + BATCH_SIZE-1) / BATCH_SIZE;
 
 	std::vector<size_t> shuffled_batches;
+	shuffled_batches.reserve(num_batches);
+
+	for (size_t i=0; i<num_positions; i += BATCH_SIZE)
+		shuffled_batches.push_back(i);
 
 	cheng4::FastRandom shuf_rng;
 
 	if constexpr (SHUFFLE_BATCHES)
-	{
-		shuffled_batches.reserve(num_batches);
-
-		for (size_t i=0; i<num_positions; i += BATCH_SIZE)
-			shuffled_batches.push_back(i);
-
 		shuf_rng.Seed(seed_rnd());
-	}
 
+	batch_loader loader(data, net.arch, loader_queue_depth);
+
+	printf("loader queue depth: %d\n", loader_queue_depth);
 
 	for (int epoch=0; epoch<epochs; epoch++)
 	{
 		printf("starting epoch %d, lr=%0.6lf\n", 1+epoch, lr);
 		size_t idx = 0;
 
-
 		if constexpr (SHUFFLE_BATCHES)
 			cheng4::ShuffleArray(shuffled_batches.data(), shuffled_batches.data() + shuffled_batches.size(), shuf_rng);
 
-		auto cstart = clock();
-
 		double loss_sum = 0.0;
 		size_t batch_count = 0;
 
+		stage_times times;
+
 		net.to(device);
 
+		loader.start(shuffled_batches, num_positions);
+
+		loaded_batch batch;
+
 		// for each batch:
-		for (size_t bi=0; bi<num_positions; bi += BATCH_SIZE)
+		for (;;)
 		{
-			size_t i;
-
-			if constexpr (SHUFFLE_BATCHES)
-				i = shuffled_batches[idx];
-			else
-				i = bi;
+			auto twait = stage_clock::now();
 
-			size_t count = std::min<size_t>(BATCH_SIZE, num_positions - i);
+			if (!loader.next(batch))
+				break;
 
-			// okay, now we must create batch tensor and fill it with data
-			torch::Tensor input_batch = torch::zeros({(int)count, INPUT_SIZE});
-			torch::Tensor input_batch_opp = torch::zeros({(int)count, INPUT_SIZE});
+			times.wait += elapsed_sec(twait);
+			times.load += batch.load_time;
 
-			torch::Tensor target = torch::zeros({(int)count, 1});
+			auto tupload = stage_clock::now();
 
-			float *itensor = static_cast<float *>(input_batch.mutable_data_ptr());
-			float *itensor_opp = static_cast<float *>(input_batch_opp.mutable_data_ptr());
-			float *ttensor = static_cast<float *>(target.mutable_data_ptr());
+			torch::Tensor target = batch.target.to(device);
+			torch::Tensor buckets = batch.buckets.to(device);
+			sparse_batch sparse;
+			torch::Tensor input_batch, input_batch_opp;
 
-			#pragma omp parallel for
-			for (int j=0; j<(int)count; j++)
+			if constexpr (SPARSE_INPUT)
+				sparse = batch.sparse.to(device);
+			else
 			{
-				auto *beg = mf.data() + (i+j)*PACKED_TRAIN_ENTRY_SIZE;
-				auto *end = mf.data() + mf.size();
-				auto lp = mem_load_position(beg, end);
-				unpack_position_fast(&itensor[j*INPUT_SIZE], &itensor_opp[j*INPUT_SIZE], lp);
-				ttensor[j] = label_position(lp);
+				input_batch = batch.dense.to(device);
+				input_batch_opp = batch.dense_opp.to(device);
 			}
 
-			input_batch = input_batch.to(device);
-			input_batch_opp = input_batch_opp.to(device);
-			target = target.to(device);
+			times.upload += elapsed_sec(tupload);
+
+			auto ttrain = stage_clock::now();
 
 			optimizer.zero_grad();
 
-			auto prediction = net.forward(input_batch, input_batch_opp);
+			torch::Tensor prediction;
+
+			if constexpr (SPARSE_INPUT)
+				prediction = net.forward(sparse, buckets);
+			else
+				prediction = net.forward(input_batch, input_batch_opp, buckets);
 
 			torch::Tensor loss = torch::mse_loss(::sigmoid(prediction*100.0f), ::sigmoid(target*100.0f));
 
@@ -545,12 +941,15 @@ void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network
 
 			auto batch_loss = loss.item<float>();
 
+			times.train += elapsed_sec(ttrain);
+			++times.batches;
+
 			if (idx++ % 5 == 0)
 			{
 				// print stuff
 				printf("Epoch: %d | Batch: [src %-5d] %d/%d (%0.2lf%%) | Loss: %0.6lf | Error: %0.6lf\n",
 					(int)(epoch+1),
-					(int)(i / BATCH_SIZE),
+					(int)(batch.start / BATCH_SIZE),
 					(int)batch_count,
 					(int)num_batches,
 					batch_count*100.0/num_batches,
@@ -558,13 +957,11 @@ void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network
 					std::sqrt(batch_loss)*100
 				);
 
-				auto tc = clock();
-				auto delta = tc - cstart;
-
 				if (profile)
-					printf("took %g sec\n", (double)delta / CLOCKS_PER_SEC);
-
-				cstart = tc;
+				{
+					times.print();
+					times = stage_times();
+				}
 
 				net.to(cpudevice);
 				net.save_file(NET_FILENAME);
@@ -576,6 +973,8 @@ void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network
 			++batch_count;
 		}
 
+		loader.stop();
+
 		net.to(cpudevice);
 		net.save_file(NET_FILENAME);
 		net.save_fixedpt_file(NET_FP_FILENAME);
@@ -595,18 +994,58 @@ void net_trainer::train(memory_mapped_file &mf, uint64_t num_positions, network
 	netref = nullptr;
 }
 
-int main()
+int main(int argc, char **argv)
 {
-	// note: must be preshuffled
-	auto mf = load_trainfile("autoplay.bin");
+	net_trainer nt;
+	auto arch = cheng4::NetArch::defaults();
+	unsigned decode_threads = 0;
+
+	// -queue <n>: loader queue depth, -profile: print per-stage timing
+	// -decode <n>: threads decoding container chunks per batch (0 = all cores)
+	// -hidden1 <n>, -hidden2 <n>: layer sizes (engine supports 256, 576, 1024 and 512+32)
+	// -kingbuckets: mirrored king buckets, -outbuckets: output buckets by piece count
+	for (int i=1; i<argc; i++)
+	{
+		if (!strcmp(argv[i], "-queue") && i+1 < argc)
+			nt.loader_queue_depth = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-decode") && i+1 < argc)
+			decode_threads = (unsigned)std::max(0, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-profile"))
+			nt.profile = true;
+		else if (!strcmp(argv[i], "-hidden1") && i+1 < argc)
+			arch.hidden1 = (uint32_t)std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-hidden2") && i+1 < argc)
+			arch.hidden2 = (uint32_t)std::max(0, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-kingbuckets"))
+		{
+			arch.features = cheng4::nfKingBuckets;
+			arch.inputs = cheng4::topo0 * arch.kingBuckets();
+		}
+		else if (!strcmp(argv[i], "-outbuckets"))
+			arch.outputs = cheng4::nobCount;
+	}
+
+	printf("network: %u => %u x2 => ", arch.inputs, arch.hidden1);
+
+	if (arch.hidden2)
+		printf("%u => ", arch.hidden2);
 
-	network net;
+	printf("%u\n", arch.outputs);
+
+	// note: must be preshuffled (raw or container)
+	train_data data;
+
+	if (!load_trainfile(data, "autoplay.bin"))
+		return 1;
+
+	data.set_decode_threads(decode_threads);
+
+	network net(arch);
 
 	net.load_file(NET_FILENAME);
 
-	net_trainer nt;
 	// 50 epochs, overkill as data grows
-	nt.train(mf, mf.size() / PACKED_TRAIN_ENTRY_SIZE, net, 50);
+	nt.train(data, data.size(), net, 50);
 
 	return 0;
 }
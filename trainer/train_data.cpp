@@ -0,0 +1,156 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "train_data.h"
+#include "../cheng4/engine.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+bool is_train_container(const char *fn)
+{
+	FILE *f = fopen(fn, "rb");
+
+	if (!f)
+		return false;
+
+	char magic[4] = {0};
+	bool res = fread(magic, 1, 4, f) == 4 && !memcmp(magic, "CHTD", 4);
+	fclose(f);
+
+	return res;
+}
+
+bool train_data::open(const char *fn, size_t raw_entry_size)
+{
+	close();
+
+	if (is_train_container(fn))
+	{
+		if (!reader.open(fn))
+			return false;
+
+		if (reader.isGames())
+		{
+			// replaying moves needs engine tables
+			static std::once_flag init_flag;
+			std::call_once(init_flag, []{cheng4::Engine::init();});
+		}
+
+		container = true;
+		num_entries = reader.records();
+		entry_sz = reader.recordSize();
+
+		chunk_first.resize(reader.chunks()+1);
+		chunk_first[0] = 0;
+
+		for (size_t i=0; i<reader.chunks(); i++)
+			chunk_first[i+1] = chunk_first[i] + reader.chunk(i).records;
+
+		return true;
+	}
+
+	if (!raw_entry_size || !mf.map(fn))
+		return false;
+
+	entry_sz = raw_entry_size;
+	num_entries = (uint64_t)mf.size() / entry_sz;
+
+	return true;
+}
+
+void train_data::close()
+{
+	mf.unmap();
+	reader.close();
+	container = false;
+	num_entries = 0;
+	entry_sz = 0;
+	chunk_first.clear();
+}
+
+void train_data::set_decode_threads(unsigned n)
+{
+	decode_threads = n ? n : std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool train_data::read(uint64_t start, size_t count, uint8_t *dst) const
+{
+	if (start + count > num_entries)
+		return false;
+
+	if (!container)
+	{
+		memcpy(dst, mf.data() + start * entry_sz, count * entry_sz);
+		return true;
+	}
+
+	// first chunk containing start
+	size_t chunk = (size_t)(std::upper_bound(chunk_first.begin(), chunk_first.end(), start) - chunk_first.begin()) - 1;
+
+	std::vector<std::vector<uint8_t>> records;
+	uint64_t pos = start;
+
+	while (pos < start + count)
+	{
+		// chunks overlapping [pos, start+count), decoded 2 per thread at a time to bound memory
+		size_t last = (size_t)(std::upper_bound(chunk_first.begin(), chunk_first.end(), start + count - 1) - chunk_first.begin());
+		size_t num = std::min<size_t>(last - chunk, 2*(size_t)decode_threads);
+
+		if (!reader.readChunks(chunk, num, records, decode_threads))
+			return false;
+
+		for (size_t i=0; i<num; i++, chunk++)
+		{
+			if (records[i].size() != reader.chunk(chunk).records * entry_sz)
+				return false;
+
+			// part of chunk overlapping [pos, start+count)
+			uint64_t ofs = pos - chunk_first[chunk];
+			uint64_t n = std::min<uint64_t>(chunk_first[chunk+1], start + count) - pos;
+
+			memcpy(dst, records[i].data() + ofs * entry_sz, (size_t)(n * entry_sz));
+			dst += n * entry_sz;
+			pos += n;
+		}
+	}
+
+	return true;
+}
+
+const uint8_t *train_data::get(uint64_t start, size_t count, std::vector<uint8_t> &buf) const
+{
+	if (start + count > num_entries)
+		return nullptr;
+
+	if (!container)
+		return mf.data() + start * entry_sz;
+
+	buf.resize(count * entry_sz);
+
+	return read(start, count, buf.data()) ? buf.data() : nullptr;
+}
@@ -0,0 +1,68 @@
+/*
+You can use this program under the terms of either the following zlib-compatible license
+or as public domain (where applicable)
+
+  Copyright (C) 2012-2015, 2020-2021, 2023-2024 Martin Sedlak
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgement in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "memmap.h"
+#include "../cheng4/trainfile.h"
+
+// training entries from a raw packed file (memory mapped)
+// or a cheng4 training data container (packed records or game sequences, decoded on the fly)
+struct train_data
+{
+	// raw_entry_size: entry size of raw files; containers store it in their header
+	bool open(const char *fn, size_t raw_entry_size = 28);
+	void close();
+
+	bool is_container() const {return container;}
+	uint64_t size() const {return num_entries;}
+	size_t entry_size() const {return entry_sz;}
+
+	// threads used to decode container chunks (0 = all cores)
+	void set_decode_threads(unsigned n);
+
+	// copy entries [start, start+count) to dst
+	// containers decode the covering chunks in blocks, in parallel
+	bool read(uint64_t start, size_t count, uint8_t *dst) const;
+	// get entries [start, start+count)
+	// raw files return a pointer into the mapping, containers decode into buf
+	// returns null on error
+	const uint8_t *get(uint64_t start, size_t count, std::vector<uint8_t> &buf) const;
+
+private:
+	memory_mapped_file mf;
+	cheng4::TrainReader reader;
+	bool container = false;
+	uint64_t num_entries = 0;
+	size_t entry_sz = 0;
+	unsigned decode_threads = 1;
+	// index of first entry per chunk, plus total
+	std::vector<uint64_t> chunk_first;
+};
+
+// returns true if fn starts with the training data container magic
+bool is_train_container(const char *fn);